@@ -11,6 +11,12 @@
 #define KEY2_PIN 20
 #define KEY3_PIN 16
 
+static const uint8_t button_pins[BUTTON_COUNT] = {
+    [BUTTON_UP] = KEY_RIGHT_PIN,  [BUTTON_DOWN] = KEY_LEFT_PIN, [BUTTON_LEFT] = KEY_UP_PIN,
+    [BUTTON_RIGHT] = KEY_DOWN_PIN, [BUTTON_CENTER] = KEY_PRESS_PIN, [BUTTON_KEY_1] = KEY1_PIN,
+    [BUTTON_KEY_2] = KEY2_PIN,    [BUTTON_KEY_3] = KEY3_PIN,
+};
+
 void buttons_init() {
     bcm2835_gpio_fsel(KEY_UP_PIN, BCM2835_GPIO_FSEL_INPT);
     bcm2835_gpio_set_pud(KEY_UP_PIN, BCM2835_GPIO_PUD_UP);
@@ -52,3 +58,35 @@ uint8_t button_key_1() { return bcm2835_gpio_lev(KEY1_PIN); }
 uint8_t button_key_2() { return bcm2835_gpio_lev(KEY2_PIN); }
 
 uint8_t button_key_3() { return bcm2835_gpio_lev(KEY3_PIN); }
+
+uint8_t button_pin(Button button) { return button_pins[button]; }
+
+uint8_t buttons_read_all() {
+    volatile uint32_t *gplev0 = bcm2835_regbase(BCM2835_REGBASE_GPIO) + BCM2835_GPLEV0 / 4;
+    uint32_t levels = bcm2835_peri_read(gplev0);
+    uint8_t held = 0;
+
+    // The buttons pull their pins low
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        if (!(levels & (1u << button_pins[i]))) {
+            held |= BUTTON_MASK(i);
+        }
+    }
+    return held;
+}
+
+void buttons_scanner_init(ButtonScanner *scanner) { scanner->held = buttons_read_all(); }
+
+uint8_t buttons_scan(ButtonScanner *scanner, uint8_t *pressed, uint8_t *released) {
+    uint8_t held = buttons_read_all();
+    uint8_t changed = held ^ scanner->held;
+
+    if (pressed) {
+        *pressed = changed & held;
+    }
+    if (released) {
+        *released = changed & scanner->held;
+    }
+    scanner->held = held;
+    return held;
+}
@@ -1,5 +1,22 @@
+#ifndef __BUTTONS_H
+#define __BUTTONS_H
+
 #include <bcm2835.h>
 
+// The buttons as the app sees them. The HAT is mounted rotated, so these do not match the labels
+// printed on it.
+typedef enum {
+    BUTTON_UP,
+    BUTTON_DOWN,
+    BUTTON_LEFT,
+    BUTTON_RIGHT,
+    BUTTON_CENTER,
+    BUTTON_KEY_1,
+    BUTTON_KEY_2,
+    BUTTON_KEY_3,
+    BUTTON_COUNT,
+} Button;
+
 void buttons_init();
 uint8_t button_up();
 uint8_t button_down();
@@ -9,3 +26,48 @@ uint8_t button_center();
 uint8_t button_key_1();
 uint8_t button_key_2();
 uint8_t button_key_3();
+
+// Returns the GPIO pin a button is wired to
+uint8_t button_pin(Button button);
+
+// Bit for a button in the masks below
+#define BUTTON_MASK(button) ((uint8_t)(1 << (button)))
+
+typedef struct {
+    uint8_t held; // Mask from the last scan
+} ButtonScanner;
+
+/**
+ * Description:
+ *  Reads every button at once with a single read of the GPIO level register, so the result is a
+ *  consistent snapshot. Use this to catch chords such as KEY1 + KEY2.
+ *
+ * Return:
+ *  A mask with BUTTON_MASK(button) set for every button that is held down.
+ */
+uint8_t buttons_read_all();
+
+/**
+ * Description:
+ *  Starts a scanner from the buttons held right now, so they are not reported as new presses.
+ *
+ * Arguments:
+ *  scanner: The scanner to set up.
+ */
+void buttons_scanner_init(ButtonScanner *scanner);
+
+/**
+ * Description:
+ *  Reads every button and compares the result with the previous scan.
+ *
+ * Arguments:
+ *  scanner: The scanner.
+ *  pressed: Where the mask of buttons pushed since the last scan is written. Can be NULL.
+ *  released: Where the mask of buttons let go since the last scan is written. Can be NULL.
+ *
+ * Return:
+ *  The mask of buttons held now.
+ */
+uint8_t buttons_scan(ButtonScanner *scanner, uint8_t *pressed, uint8_t *released);
+
+#endif
@@ -1,35 +1,596 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "camera.h"
+#include "camera_io.h"
+#include "convert.h"
 #include "log.h"
 
-void camera_capture_data(uint8_t *buf, size_t bufsize) {
-    char tmp_file_name[16] = "ecen-224-XXXXXX";
-    char *command = "libcamera-still -n --immediate -e bmp --width 128 --height 128 -o ";
+// Bursts keeping up to this many frames score them without allocating
+#define BURST_STACK_SCORES 16
 
-    // Create the temporary file
-    int fp = mkstemp(tmp_file_name);
+// A source gets longer for its first frame, since the camera stack and auto exposure start up
+#define CAMERA_START_TIMEOUT_MS 5000
 
-    // Create whole command
-    ssize_t size = snprintf(NULL, 0, "%s%s", command, tmp_file_name);
-    char *full_command = malloc(size + 1);
-    snprintf(full_command, size + 1, "%s%s", command, tmp_file_name);
+// Serializes starting and stopping the source
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    // Run the command
-    system(full_command);
+static CameraSource *source = NULL;
+static bool source_owned = false;   // Made from CAMERA_SOURCE_ENV, so destroyed by camera_exit
+static bool source_running = false; // Started, with the reader thread reading from it
+static pthread_t reader_thread;
 
-    // Copy the data out of the file
-    read(fp, buf, bufsize);
+// Everything below is shared with the reader thread and guarded by lock. Each frame in the pool is
+// free (refs 0), being read into by the reader thread, in the ring, held by callers, or both of
+// the last two. The ring holds one reference to each of its frames.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t new_frame;
+static pthread_once_t cond_once = PTHREAD_ONCE_INIT;
+static bool source_alive = false;
+static bool source_stopping = false; // stop_source is interrupting it
+static uint64_t frame_seq = 0;     // Frames read in total
+static uint64_t source_frames = 0; // Frames read since the source last started
 
-    // Clean up
-    close(fp);
-    remove(tmp_file_name);
-    free(full_command);
+static CameraConfig cfg;
+static CameraFrame *pool = NULL;
+static int pool_size = 0;
+static uint8_t *pool_data = NULL; // One CAMERA_FRAME_SIZE buffer per frame, then the scratch buffer
+static uint8_t *scratch = NULL;   // Frames are read into this and dropped when the pool is used up
+static CameraFrame **ring = NULL; // cfg.preroll_frames slots, oldest at ring_head
+static int ring_head = 0;
+static int ring_count = 0;
+static uint64_t dropped = 0; // Frames read into scratch
+static uint64_t drop_warned_ms = 0;
+
+static void init_cond(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&new_frame, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Allocates everything the ring needs up front, so memory use stays fixed while the camera runs
+static int alloc_pool(const CameraConfig *config) {
+    cfg.preroll_frames = config && config->preroll_frames > 0 ? config->preroll_frames
+                                                              : CAMERA_PREROLL_FRAMES;
+    cfg.held_frames = config && config->held_frames > 0 ? config->held_frames : CAMERA_HELD_FRAMES;
+    cfg.burst_frames =
+        config && config->burst_frames > 0 ? config->burst_frames : CAMERA_BURST_FRAMES;
+    // One more for the reader thread to fill
+    pool_size = cfg.preroll_frames + cfg.held_frames + 1;
+
+    pool = calloc(pool_size, sizeof(CameraFrame));
+    pool_data = malloc((size_t)(pool_size + 1) * CAMERA_FRAME_SIZE);
+    ring = calloc(cfg.preroll_frames, sizeof(CameraFrame *));
+    if (pool == NULL || pool_data == NULL || ring == NULL) {
+        log_error("Failed to allocate %d camera frames", pool_size + 1);
+        free(pool);
+        free(pool_data);
+        free(ring);
+        pool = NULL;
+        pool_data = NULL;
+        ring = NULL;
+        return -1;
+    }
+    for (int i = 0; i < pool_size; i++) {
+        pool[i].data = pool_data + (size_t)i * CAMERA_FRAME_SIZE;
+    }
+    scratch = pool_data + (size_t)pool_size * CAMERA_FRAME_SIZE;
+    ring_head = 0;
+    ring_count = 0;
+    log_info("Camera keeps %d frames before a capture, %d KiB in all", cfg.preroll_frames,
+             (int)((size_t)(pool_size + 1) * CAMERA_FRAME_SIZE / 1024));
+    return 0;
+}
+
+// Called with lock held
+static CameraFrame *newest_frame(void) {
+    return ring_count > 0 ? ring[(ring_head + ring_count - 1) % cfg.preroll_frames] : NULL;
+}
+
+// Called with lock held
+static CameraFrame *take_free_frame(void) {
+    for (int i = 0; i < pool_size; i++) {
+        if (pool[i].refs == 0) {
+            pool[i].refs = 1;
+            return &pool[i];
+        }
+    }
+    return NULL;
+}
+
+// Called with lock held. The ring's reference moves over from the reader thread.
+static void push_frame(CameraFrame *frame) {
+    frame->seq = ++frame_seq;
+    frame->timestamp_ms = wall_ms();
+    if (ring_count == cfg.preroll_frames) {
+        ring[ring_head]->refs--;
+        ring_head = (ring_head + 1) % cfg.preroll_frames;
+        ring_count--;
+    }
+    ring[(ring_head + ring_count) % cfg.preroll_frames] = frame;
+    ring_count++;
+    source_frames++;
+}
+
+static void put_u16(uint8_t *out, uint16_t v) {
+    out[0] = v;
+    out[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    out[0] = v;
+    out[1] = v >> 8;
+    out[2] = v >> 16;
+    out[3] = v >> 24;
+}
+
+// The same headers libcamera-still writes: a BITMAPINFOHEADER, 24 bits per pixel, bottom row first
+static void write_bmp_header(uint8_t *out) {
+    memset(out, 0, BMP_HEADER_SIZE);
+    out[0] = 'B';
+    out[1] = 'M';
+    put_u32(out + 2, IMG_SIZE);
+    put_u32(out + 10, BMP_HEADER_SIZE);
+    put_u32(out + 14, 40);
+    put_u32(out + 18, CAMERA_WIDTH);
+    put_u32(out + 22, CAMERA_HEIGHT);
+    put_u16(out + 26, 1);
+    put_u16(out + 28, 24);
+    put_u32(out + 34, IMG_SIZE - BMP_HEADER_SIZE);
+    put_u32(out + 38, 2835); // 72 DPI
+    put_u32(out + 42, 2835);
+}
+
+static void *read_frames(void *arg) {
+    (void)arg;
+    while (true) {
+        pthread_mutex_lock(&lock);
+        CameraFrame *frame = take_free_frame();
+        pthread_mutex_unlock(&lock);
+
+        // The source is read either way, so a helper process never blocks on its pipe
+        uint8_t *into = frame ? (uint8_t *)frame->data : scratch;
+        bool full = source->read(source, into) == 0;
+
+        pthread_mutex_lock(&lock);
+        if (!full) {
+            if (frame) {
+                frame->refs = 0;
+            }
+            source_alive = false;
+            if (!source_stopping) {
+                log_warn("Camera source %s stopped sending frames", source->name);
+            }
+            pthread_cond_broadcast(&new_frame);
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        if (frame) {
+            push_frame(frame);
+            pthread_cond_broadcast(&new_frame);
+        } else if (dropped++ == 0 || now_ms() - drop_warned_ms >= 10000) {
+            drop_warned_ms = now_ms();
+            log_warn("Camera frames are all held, dropping new ones (%d held at most)",
+                     cfg.held_frames);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void stop_source(void) {
+    if (!source_running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    source_stopping = true;
+    pthread_mutex_unlock(&lock);
+    source->interrupt(source);
+    pthread_join(reader_thread, NULL);
+    source->stop(source);
+    source_running = false;
+    source_stopping = false;
+}
+
+// Uses the source the config names, or else the one CAMERA_SOURCE_ENV describes
+static int pick_source(const CameraConfig *config) {
+    if (config != NULL && config->source != NULL) {
+        source = config->source;
+        source_owned = false;
+        return 0;
+    }
+    source = camera_source_parse(getenv(CAMERA_SOURCE_ENV));
+    source_owned = true;
+    return source != NULL ? 0 : -1;
+}
+
+static int start_source(void) {
+    pthread_once(&cond_once, init_cond);
+    if (pool == NULL && alloc_pool(NULL) != 0) {
+        return -1;
+    }
+    if (source == NULL && pick_source(NULL) != 0) {
+        return -1;
+    }
+    if (source->start(source) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+    source_alive = true;
+    source_frames = 0;
+    pthread_mutex_unlock(&lock);
+    if (pthread_create(&reader_thread, NULL, read_frames, NULL) != 0) {
+        log_error("Failed to start the camera reader thread");
+        source->interrupt(source);
+        source->stop(source);
+        return -1;
+    }
+    source_running = true;
+    return 0;
+}
+
+// Waits for a frame newer than the newest one there was when called and returns it with a
+// reference taken. Called with lock held. Returns NULL if the source stopped or took too long.
+static CameraFrame *wait_for_frame(void) {
+    uint64_t after = frame_seq;
+    uint64_t timeout = source_frames == 0 ? CAMERA_START_TIMEOUT_MS : CAMERA_FRAME_TIMEOUT_MS;
+    // A slow replay is not a stalled camera
+    if (source->fps > 0 && timeout < 2000 / source->fps) {
+        timeout = 2000 / source->fps;
+    }
+    uint64_t deadline = now_ms() + timeout;
+    struct timespec ts = {
+        .tv_sec = deadline / 1000,
+        .tv_nsec = (deadline % 1000) * 1000000,
+    };
+
+    while (source_alive && frame_seq == after) {
+        if (pthread_cond_timedwait(&new_frame, &lock, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (frame_seq == after) {
+        return NULL;
+    }
+    CameraFrame *frame = newest_frame();
+    frame->refs++;
+    return frame;
+}
+
+// Takes one picture with its own libcamera-still, for when the source is not working. The BMP
+// comes through a pipe straight into buf, so nothing is written to the SD card.
+static int capture_once(uint8_t *buf) {
+    const char *command = getenv(CAMERA_STILL_ENV);
+    if (command == NULL || command[0] == '\0') {
+        command = CAMERA_STILL;
+    }
+    pid_t pid;
+    int fd = camera_spawn_reader(command, &pid);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint64_t deadline = now_ms() + CAMERA_STILL_TIMEOUT_MS;
+    bool full = camera_read_full(fd, buf, IMG_SIZE, deadline);
+    // Anything after IMG_SIZE bytes means the picture was not the size asked for
+    uint8_t extra;
+    bool longer = full && camera_read_full(fd, &extra, 1, deadline);
+    close(fd);
+    if (!full || longer) {
+        // It may be stuck, and closing the pipe is not always enough to stop it
+        kill(pid, SIGTERM);
+    }
+    waitpid(pid, NULL, 0);
+
+    if (!full || longer) {
+        log_error("%s did not write a %d byte picture", command, IMG_SIZE);
+        return -1;
+    }
+    if (buf[0] != 'B' || buf[1] != 'M' || camera_get_u32(buf + 2) != IMG_SIZE ||
+        camera_get_u32(buf + 10) != BMP_HEADER_SIZE) {
+        log_error("%s did not write a %dx%d BMP", command, CAMERA_WIDTH, CAMERA_HEIGHT);
+        return -1;
+    }
+    return 0;
+}
+
+int camera_init(const CameraConfig *config) {
+    pthread_mutex_lock(&capture_lock);
+    int result = 0;
+    if (!source_running) {
+        if (pool == NULL) {
+            result = alloc_pool(config);
+        }
+        if (result == 0 && source == NULL) {
+            result = pick_source(config);
+        }
+        if (result == 0) {
+            result = start_source();
+        }
+    }
+    pthread_mutex_unlock(&capture_lock);
+    return result;
+}
+
+void camera_exit() {
+    pthread_mutex_lock(&capture_lock);
+    stop_source();
+    if (source_owned) {
+        camera_source_destroy(source);
+    }
+    source = NULL;
+
+    pthread_mutex_lock(&lock);
+    while (ring_count > 0) {
+        ring[ring_head]->refs--;
+        ring_head = (ring_head + 1) % cfg.preroll_frames;
+        ring_count--;
+    }
+    bool held = false;
+    for (int i = 0; i < pool_size; i++) {
+        held |= pool[i].refs > 0;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (held) {
+        // Freeing them would pull the data out from under whoever has them
+        log_warn("Camera frames are still held, not freeing them");
+    } else if (pool != NULL) {
+        free(pool);
+        free(pool_data);
+        free(ring);
+        pool = NULL;
+        pool_data = NULL;
+        ring = NULL;
+        pool_size = 0;
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+CameraFrame *camera_next_frame() {
+    // Starts the source the first time, and again after it ended
+    pthread_mutex_lock(&capture_lock);
+    pthread_mutex_lock(&lock);
+    bool alive = source_running && source_alive;
+    pthread_mutex_unlock(&lock);
+    if (!alive) {
+        stop_source();
+        start_source();
+    }
+    bool running = source_running;
+    pthread_mutex_unlock(&capture_lock);
+    if (!running) {
+        return NULL;
+    }
+
+    // Every caller waiting at once gets the same frame
+    pthread_mutex_lock(&lock);
+    uint64_t dropped_before = dropped;
+    CameraFrame *frame = wait_for_frame();
+    // Frames kept coming but had nowhere to go, which is not the source's fault
+    bool starved = frame == NULL && source_alive && dropped != dropped_before;
+    pthread_mutex_unlock(&lock);
+
+    if (frame == NULL && !starved) {
+        pthread_mutex_lock(&capture_lock);
+        if (source_running) {
+            log_warn("No frame from the camera source, restarting it on the next picture");
+            stop_source();
+        }
+        pthread_mutex_unlock(&capture_lock);
+    }
+    return frame;
+}
+
+int camera_snapshot(CameraFrame **frames, int max) {
+    pthread_mutex_lock(&lock);
+    int count = ring_count < max ? ring_count : max;
+    // The newest ones if there is not room for all of them
+    int skip = ring_count - count;
+    for (int i = 0; i < count; i++) {
+        frames[i] = ring[(ring_head + skip + i) % cfg.preroll_frames];
+        frames[i]->refs++;
+    }
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void camera_frame_ref(CameraFrame *frame) {
+    pthread_mutex_lock(&lock);
+    frame->refs++;
+    pthread_mutex_unlock(&lock);
+}
+
+void camera_frame_release(CameraFrame *frame) {
+    if (frame == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    frame->refs--;
+    pthread_mutex_unlock(&lock);
+}
+
+int camera_frame_to_bmp(const CameraFrame *frame, uint8_t *buf, size_t bufsize) {
+    if (bufsize < IMG_SIZE) {
+        log_error("Camera buffer is %zu bytes, a picture needs %d", bufsize, IMG_SIZE);
+        return -1;
+    }
+    write_bmp_header(buf);
+    convert_yuv420_to_bgr888(frame->data, buf + BMP_HEADER_SIZE, CAMERA_WIDTH, CAMERA_HEIGHT);
+    return 0;
+}
+
+void camera_get_stats(CameraStats *stats) {
+    pthread_mutex_lock(&lock);
+    stats->frames = frame_seq;
+    stats->dropped = dropped;
+    pthread_mutex_unlock(&lock);
+}
+
+double camera_frame_sharpness(const CameraFrame *frame) {
+    // Sums of 2x2 blocks of luma. Scoring at half size takes out most sensor noise, which would
+    // otherwise read as detail, and is a quarter of the work.
+    uint16_t small[CAMERA_HEIGHT / 2][CAMERA_WIDTH / 2];
+    for (int row = 0; row < CAMERA_HEIGHT / 2; row++) {
+        const uint8_t *top = frame->data + 2 * row * CAMERA_WIDTH;
+        const uint8_t *bottom = top + CAMERA_WIDTH;
+        for (int col = 0; col < CAMERA_WIDTH / 2; col++) {
+            small[row][col] =
+                top[2 * col] + top[2 * col + 1] + bottom[2 * col] + bottom[2 * col + 1];
+        }
+    }
+
+    int64_t sum = 0;
+    int64_t sum_sq = 0;
+    for (int row = 1; row < CAMERA_HEIGHT / 2 - 1; row++) {
+        for (int col = 1; col < CAMERA_WIDTH / 2 - 1; col++) {
+            int laplacian = 4 * small[row][col] - small[row - 1][col] - small[row + 1][col] -
+                            small[row][col - 1] - small[row][col + 1];
+            sum += laplacian;
+            sum_sq += laplacian * laplacian;
+        }
+    }
+    double n = (CAMERA_HEIGHT / 2 - 2) * (CAMERA_WIDTH / 2 - 2);
+    double mean = sum / n;
+    // The block sums are four times the mean luma, so the variance is sixteen times too big
+    return (sum_sq / n - mean * mean) / 16;
+}
+
+// Puts frame into best, which holds kept frames sorted sharpest first, if it is among the keep
+// sharpest. A frame that is not, or one pushed out, is released. Returns the new kept.
+static int keep_sharpest(CameraFrame **best, double *scores, int kept, int keep,
+                         CameraFrame *frame, double score) {
+    int i = kept;
+    if (kept == keep) {
+        if (score <= scores[keep - 1]) {
+            camera_frame_release(frame);
+            return kept;
+        }
+        camera_frame_release(best[keep - 1]);
+        i = keep - 1;
+    } else {
+        kept++;
+    }
+    while (i > 0 && scores[i - 1] < score) {
+        best[i] = best[i - 1];
+        scores[i] = scores[i - 1];
+        i--;
+    }
+    best[i] = frame;
+    scores[i] = score;
+    return kept;
+}
+
+// Room for keep scores: stack when keep is small, as it is for a single picture, otherwise
+// allocated. Returns NULL, having logged why, if the allocation fails.
+static double *score_buffer(double *stack, int keep) {
+    if (keep <= BURST_STACK_SCORES) {
+        return stack;
+    }
+    double *scores = malloc(keep * sizeof(double));
+    if (scores == NULL) {
+        log_error("Failed to allocate scores for %d frames", keep);
+    }
+    return scores;
+}
+
+int camera_burst(int count, int keep, CameraFrame **best, double *scores) {
+    if (keep < 1) {
+        return 0;
+    }
+    double stack_scores[BURST_STACK_SCORES];
+    double *own_scores = NULL;
+    if (scores == NULL) {
+        own_scores = score_buffer(stack_scores, keep);
+        if (own_scores == NULL) {
+            return 0;
+        }
+        scores = own_scores;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        CameraFrame *frame = camera_next_frame();
+        if (frame == NULL) {
+            break;
+        }
+        // Scored as it comes in, so no more than keep + 1 frames are held at once
+        kept = keep_sharpest(best, scores, kept, keep, frame, camera_frame_sharpness(frame));
+    }
+
+    if (own_scores != stack_scores) {
+        free(own_scores);
+    }
+    return kept;
+}
+
+int camera_select_sharpest(CameraFrame **frames, int count, int keep) {
+    double stack_scores[BURST_STACK_SCORES];
+    double *scores = keep >= 1 ? score_buffer(stack_scores, keep) : NULL;
+    if (scores == NULL) {
+        for (int i = 0; i < count; i++) {
+            camera_frame_release(frames[i]);
+        }
+        return 0;
+    }
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        // frames[i] is only overwritten once it has been read, since kept <= i
+        CameraFrame *frame = frames[i];
+        kept = keep_sharpest(frames, scores, kept, keep, frame, camera_frame_sharpness(frame));
+    }
+    if (scores != stack_scores) {
+        free(scores);
+    }
+    return kept;
+}
+
+int camera_capture_data(uint8_t *buf, size_t bufsize) {
+    if (bufsize < IMG_SIZE) {
+        log_error("Camera buffer is %zu bytes, a picture needs %d", bufsize, IMG_SIZE);
+        return -1;
+    }
+
+    CameraFrame *frame = NULL;
+    if (cfg.burst_frames > 1) {
+        camera_burst(cfg.burst_frames, 1, &frame, NULL);
+    } else {
+        frame = camera_next_frame();
+    }
+    if (frame == NULL) {
+        pthread_mutex_lock(&capture_lock);
+        int result = capture_once(buf);
+        pthread_mutex_unlock(&capture_lock);
+        return result;
+    }
+    int result = camera_frame_to_bmp(frame, buf, bufsize);
+    camera_frame_release(frame);
+    return result;
 }
 
 void camera_save_to_file(uint8_t *buf, size_t bufsize, char *filename) {
@@ -1,17 +1,203 @@
+#ifndef __CAMERA_H
+#define __CAMERA_H
+
+#include <stddef.h>
 #include <stdint.h>
 
+#include "camera_source.h"
+
 #define IMG_SIZE 49206
 
+#define CAMERA_WIDTH 128
+#define CAMERA_HEIGHT 128
+#define CAMERA_FPS 30
+
+/*
+ * Frames come from a CameraSource (see camera_source.h) as raw YUV420 (I420), CAMERA_FRAME_SIZE
+ * bytes each. The default source is a helper process that keeps the camera running and writes
+ * frames to its stdout, one after another with no header. Setting CAMERA_HELPER_ENV to a command
+ * line runs that instead, for example tools/fake_camera on a machine with no camera.
+ */
+#define CAMERA_FRAME_SIZE (CAMERA_WIDTH * CAMERA_HEIGHT * 3 / 2)
+#define CAMERA_HELPER                                                                              \
+    "libcamera-vid -t 0 -n --codec yuv420 --width 128 --height 128 --framerate 30 -o -"
+#define CAMERA_HELPER_ENV "DOORBELL_CAMERA_CMD"
+
+/*
+ * The one-off capture camera_capture_data falls back on. It must write a whole IMG_SIZE byte BMP
+ * to its stdout. CAMERA_STILL_ENV overrides it the same way CAMERA_HELPER_ENV does the helper.
+ */
+#define CAMERA_STILL "libcamera-still -n --immediate -e bmp --width 128 --height 128 -o -"
+#define CAMERA_STILL_ENV "DOORBELL_CAMERA_STILL_CMD"
+#define CAMERA_STILL_TIMEOUT_MS 5000
+
+// How long camera_capture_data waits for the source's next frame before giving up on it. Slow
+// sources get two frame intervals if that is longer.
+#define CAMERA_FRAME_TIMEOUT_MS 1000
+
+/*
+ * The newest frames from the source are kept in a ring, so a picture can include what the camera
+ * saw before it was asked for one. All frame memory is allocated once, by camera_init: that is
+ * preroll_frames + held_frames + 2 frames of CAMERA_FRAME_SIZE bytes.
+ */
+#define CAMERA_PREROLL_FRAMES 15 // Half a second at CAMERA_FPS
+#define CAMERA_HELD_FRAMES 8
+
+/*
+ * camera_capture_data keeps the sharpest of this many frames in a row. 1 takes the next frame as
+ * it is. A few more, 4 to 6, are usually enough to get one frame without motion blur from someone
+ * walking up, at the cost of a frame interval each.
+ */
+#define CAMERA_BURST_FRAMES 1
+
+typedef struct {
+    int preroll_frames;   // Frames the ring keeps. 0: CAMERA_PREROLL_FRAMES.
+    int held_frames;      // Frames that may stay held once out of the ring. 0: CAMERA_HELD_FRAMES
+    int burst_frames;     // Frames camera_capture_data picks from. 0: CAMERA_BURST_FRAMES.
+    CameraSource *source; // Where frames come from. NULL: whatever CAMERA_SOURCE_ENV says.
+} CameraConfig;
+
+typedef struct {
+    uint64_t frames;  // Read from the source and put in the ring
+    uint64_t dropped; // Read and thrown away, because callers held every free frame
+} CameraStats;
+
+/*
+ * A frame from the source. Frames are shared rather than copied: whoever gets one from
+ * camera_snapshot or camera_next_frame holds a reference and must give it back with
+ * camera_frame_release. Until then the frame stays as it is, even after the ring moves past it.
+ * If callers hold more than held_frames frames that are no longer in the ring, new frames are
+ * dropped until some are released.
+ */
+typedef struct {
+    const uint8_t *data;   // CAMERA_FRAME_SIZE bytes of YUV420
+    uint64_t seq;          // Counts up by one per frame, across source restarts
+    uint64_t timestamp_ms; // When the frame arrived, in milliseconds since the Unix epoch
+    int refs;              // Belongs to lib/camera
+} CameraFrame;
+
+/*
+ * Allocates the frame ring and starts the source, so the camera is already streaming when
+ * the first picture is taken. camera_capture_data starts it on its own if this was not called,
+ * with the default CameraConfig, but then the first picture pays for the camera starting up.
+ *
+ * const CameraConfig * config: how many frames to keep and where from, or NULL for the defaults.
+ *                              A source given here is not destroyed by camera_exit.
+ *
+ * Returns 0 on success, -1 if the source could not be started.
+ */
+int camera_init(const CameraConfig *config);
+
+/*
+ * Stops the source and frees the frame ring. Every frame must have been released first.
+ * camera_init can be called again afterwards.
+ */
+void camera_exit();
+
+/*
+ * Waits for the next frame from the source, starting the source if it is not running. This takes
+ * at most one frame interval once the source is running.
+ *
+ * Returns the frame, which must be released with camera_frame_release, or NULL if the source
+ * could not be started or sent nothing for CAMERA_FRAME_TIMEOUT_MS.
+ */
+CameraFrame *camera_next_frame();
+
+/*
+ * Takes a reference to every frame in the ring, without copying any. Call it when the doorbell is
+ * rung to get what the camera saw just before.
+ *
+ * CameraFrame ** frames: where the frames are written, oldest first
+ * int max: the most frames to take. If the ring holds more, the newest ones are taken.
+ *
+ * Returns the number of frames written. Each must be released with camera_frame_release.
+ */
+int camera_snapshot(CameraFrame **frames, int max);
+
+/*
+ * Takes another reference to a frame, to hand it to something else that releases it on its own.
+ */
+void camera_frame_ref(CameraFrame *frame);
+
+/*
+ * Gives back a reference to a frame. Does nothing if frame is NULL.
+ */
+void camera_frame_release(CameraFrame *frame);
+
+/*
+ * Converts a frame to the BMP camera_capture_data returns, for display or upload.
+ *
+ * const CameraFrame * frame: the frame to convert
+ * uint8_t * buf: where the BMP is written
+ * size_t bufsize: the size of buf, at least IMG_SIZE
+ *
+ * Returns 0 on success, -1 if buf is too small.
+ */
+int camera_frame_to_bmp(const CameraFrame *frame, uint8_t *buf, size_t bufsize);
+
+/*
+ * Scores how sharp a frame is: the variance of the Laplacian of its luma, downsampled by two.
+ * Motion blur and bad focus smooth out edges and lower it. Scores only compare frames of the same
+ * scene, not different scenes. Takes a few microseconds, so a whole burst can be scored as it
+ * arrives.
+ *
+ * const CameraFrame * frame: the frame to score
+ *
+ * Returns the score, 0 for a flat frame.
+ */
+double camera_frame_sharpness(const CameraFrame *frame);
+
+/*
+ * Takes count frames in a row from the source and keeps the sharpest. Frames are scored as they
+ * arrive and the rest released right away, so no more than keep + 1 are held at once.
+ *
+ * int count: how many frames to take
+ * int keep: how many of them to keep
+ * CameraFrame ** best: where the kept frames are written, sharpest first. Room for keep.
+ * double * scores: where their camera_frame_sharpness scores are written, or NULL
+ *
+ * Returns the number of frames kept, fewer than keep only if the source stopped sending frames,
+ * or 0 if there was no memory to score them. Each must be released with camera_frame_release.
+ */
+int camera_burst(int count, int keep, CameraFrame **best, double *scores);
+
+/*
+ * Keeps the sharpest of frames already held, such as a camera_snapshot of the pre-roll ring, and
+ * releases the rest.
+ *
+ * CameraFrame ** frames: the frames. The kept ones are moved to the front, sharpest first.
+ * int count: the number of frames
+ * int keep: how many to keep
+ *
+ * Returns the number of frames kept, 0 if there was no memory to score them.
+ */
+int camera_select_sharpest(CameraFrame **frames, int count, int keep);
+
+/*
+ * Reads the frame counters, which count from the first camera_init.
+ *
+ * CameraStats * stats: where the counters are written
+ */
+void camera_get_stats(CameraStats *stats);
+
 /*
  * Takes a picture using the camera. It returns the full image *with* the BMP header. This buffer
  * can not be used in some functions that are expecting only the pixel data, such as
  * display_draw_image_data in display.h.
  *
+ * The picture is the next frame the source sends, so this takes at most one frame interval once
+ * the source is running. With burst_frames set in CameraConfig, it is the sharpest of that many
+ * frames instead. If the source cannot be started or stops sending frames, the picture is taken
+ * with a one-off CAMERA_STILL instead.
+ *
  * uint8_t * buf: a buffer where the image data of the photo taken will be stored
  * size_t bufsize: integer that holds the size of the buffer. The size of the photo
  *                 being taken is found as a #DEFINEd variable in "camera.h"
+ *
+ * Returns 0 on success, or -1 if no picture could be taken, in which case buf holds nothing
+ * useful. A picture is always exactly IMG_SIZE bytes.
  */
-void camera_capture_data(uint8_t *buf, size_t bufsize);
+int camera_capture_data(uint8_t *buf, size_t bufsize);
 
 /*
  * Takes image data *with* the BMP header and saves it to a file.
@@ -22,3 +208,5 @@ void camera_capture_data(uint8_t *buf, size_t bufsize);
  * char * filename: name of the file that is being saved
  */
 void camera_save_to_file(uint8_t *buf, size_t bufsize, char *filename);
+
+#endif
@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "camera_io.h"
+#include "log.h"
+
+extern char **environ;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t camera_get_u32(const uint8_t *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+bool camera_read_full(int fd, uint8_t *buf, size_t len, uint64_t deadline_ms) {
+    size_t got = 0;
+    while (got < len) {
+        if (deadline_ms != 0) {
+            uint64_t now = now_ms();
+            if (now >= deadline_ms) {
+                return false;
+            }
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            int ready = poll(&pfd, 1, deadline_ms - now);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                return false;
+            }
+        }
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+int camera_spawn_reader(const char *command, pid_t *pid) {
+    size_t len = strlen(command) + sizeof("exec ");
+    char *shell_command = malloc(len);
+    if (shell_command == NULL) {
+        log_error("Failed to allocate the camera command");
+        return -1;
+    }
+    snprintf(shell_command, len, "exec %s", command);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        log_error("Failed to create the camera pipe: %s", strerror(errno));
+        free(shell_command);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    // The doorbell ignores SIGPIPE, which the camera should not inherit
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    char *argv[] = {"sh", "-c", shell_command, NULL};
+    int err = posix_spawn(pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    free(shell_command);
+    close(fds[1]);
+    if (err != 0) {
+        log_error("Failed to run %s: %s", command, strerror(err));
+        close(fds[0]);
+        return -1;
+    }
+    return fds[0];
+}
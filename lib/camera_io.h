@@ -0,0 +1,58 @@
+#ifndef __CAMERA_IO_H
+#define __CAMERA_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "camera.h"
+
+// Helpers shared by lib/camera.c and lib/camera_source.c. Not part of the camera API.
+
+// Bytes before the pixels in an IMG_SIZE picture
+#define BMP_HEADER_SIZE (IMG_SIZE - CAMERA_WIDTH * CAMERA_HEIGHT * 3)
+
+/**
+ * Description:
+ *  Reads a little-endian 32-bit value, as BMP headers store them.
+ *
+ * Arguments:
+ *  in: The four bytes.
+ *
+ * Return:
+ *  The value.
+ */
+uint32_t camera_get_u32(const uint8_t *in);
+
+/**
+ * Description:
+ *  Reads exactly len bytes, retrying short reads and EINTR.
+ *
+ * Arguments:
+ *  fd: The file or pipe.
+ *  buf: Where the bytes go.
+ *  len: How many to read.
+ *  deadline_ms: When to give up, in CLOCK_MONOTONIC milliseconds, or 0 to wait as long as it
+ *               takes.
+ *
+ * Return:
+ *  true once len bytes are in buf, false on end of file, an error or the deadline.
+ */
+bool camera_read_full(int fd, uint8_t *buf, size_t len, uint64_t deadline_ms);
+
+/**
+ * Description:
+ *  Runs a command through /bin/sh with its stdout going to a pipe. SIGPIPE is set back to its
+ *  default in the command, in case the caller ignores it.
+ *
+ * Arguments:
+ *  command: The command line.
+ *  pid: Where the process ID is written.
+ *
+ * Return:
+ *  The read end of the pipe, or -1 if the command could not be started.
+ */
+int camera_spawn_reader(const char *command, pid_t *pid);
+
+#endif
@@ -0,0 +1,516 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "camera.h"
+#include "camera_io.h"
+#include "camera_source.h"
+#include "convert.h"
+#include "log.h"
+
+// Longest path kept for a replayed file
+#define REPLAY_PATH_MAX 512
+
+// True if name ends in suffix and has more in front of it, as a file name with that extension does
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+// Allocates a source and state_size bytes of zeroed state for it. Returns NULL, having logged
+// why, if either cannot be allocated.
+static CameraSource *new_source(const char *name, size_t state_size) {
+    CameraSource *source = calloc(1, sizeof(CameraSource));
+    void *state = calloc(1, state_size);
+    if (source == NULL || state == NULL) {
+        log_error("Failed to allocate the %s camera source", name);
+        free(source);
+        free(state);
+        return NULL;
+    }
+    source->name = name;
+    source->state = state;
+    return source;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Command
+// ---------------------------------------------------------------------------------------------
+
+typedef struct {
+    char *command;
+    pid_t pid;
+    int fd;
+} command_state;
+
+static int command_start(CameraSource *source) {
+    command_state *st = source->state;
+    st->fd = camera_spawn_reader(st->command, &st->pid);
+    if (st->fd < 0) {
+        st->pid = -1;
+        return -1;
+    }
+    log_info("Started camera helper: %s", st->command);
+    return 0;
+}
+
+static int command_read(CameraSource *source, uint8_t *frame) {
+    command_state *st = source->state;
+    return camera_read_full(st->fd, frame, CAMERA_FRAME_SIZE, 0) ? 0 : -1;
+}
+
+static void command_interrupt(CameraSource *source) {
+    command_state *st = source->state;
+    // The helper exiting closes the pipe, which ends a read
+    if (st->pid > 0) {
+        kill(st->pid, SIGTERM);
+    }
+}
+
+static void command_stop(CameraSource *source) {
+    command_state *st = source->state;
+    if (st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+    }
+    if (st->pid > 0) {
+        waitpid(st->pid, NULL, 0);
+        st->pid = -1;
+    }
+}
+
+static void command_destroy(CameraSource *source) {
+    command_state *st = source->state;
+    free(st->command);
+}
+
+CameraSource *camera_source_command(const char *command) {
+    CameraSource *source = new_source("command", sizeof(command_state));
+    if (source == NULL) {
+        return NULL;
+    }
+    command_state *st = source->state;
+    st->command = strdup(command);
+    if (st->command == NULL) {
+        log_error("Failed to allocate the camera command");
+        free(st);
+        free(source);
+        return NULL;
+    }
+    st->pid = -1;
+    st->fd = -1;
+
+    source->fps = CAMERA_FPS;
+    source->start = command_start;
+    source->read = command_read;
+    source->interrupt = command_interrupt;
+    source->stop = command_stop;
+    source->destroy = command_destroy;
+    return source;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Pacing, shared by the sources that make their own frames
+// ---------------------------------------------------------------------------------------------
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool interrupted;
+    struct timespec next; // When the next frame is due, CLOCK_MONOTONIC
+} pacer;
+
+static void pacer_init(pacer *p) {
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->wake, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void pacer_destroy(pacer *p) {
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+}
+
+static void pacer_start(pacer *p) {
+    pthread_mutex_lock(&p->lock);
+    p->interrupted = false;
+    clock_gettime(CLOCK_MONOTONIC, &p->next);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void pacer_interrupt(pacer *p) {
+    pthread_mutex_lock(&p->lock);
+    p->interrupted = true;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Waits until the next frame is due. Returns false if interrupted.
+static bool pacer_wait(pacer *p, double fps) {
+    pthread_mutex_lock(&p->lock);
+    if (fps > 0) {
+        while (!p->interrupted &&
+               pthread_cond_timedwait(&p->wake, &p->lock, &p->next) != ETIMEDOUT) {
+        }
+        long interval_ns = (long)(1e9 / fps);
+        p->next.tv_sec += interval_ns / 1000000000;
+        p->next.tv_nsec += interval_ns % 1000000000;
+        if (p->next.tv_nsec >= 1000000000) {
+            p->next.tv_nsec -= 1000000000;
+            p->next.tv_sec++;
+        }
+        // After falling behind, the schedule starts over from now instead of catching up with a
+        // burst of frames
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > p->next.tv_sec ||
+            (now.tv_sec == p->next.tv_sec && now.tv_nsec > p->next.tv_nsec)) {
+            p->next = now;
+        }
+    }
+    bool ok = !p->interrupted;
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Synthetic
+// ---------------------------------------------------------------------------------------------
+
+typedef struct {
+    pacer pace;
+    uint64_t count;
+} synthetic_state;
+
+static void draw_pattern(uint8_t *frame, uint64_t n) {
+    uint8_t *y = frame;
+    uint8_t *u = frame + CAMERA_WIDTH * CAMERA_HEIGHT;
+    uint8_t *v = u + (CAMERA_WIDTH / 2) * (CAMERA_HEIGHT / 2);
+    int bar = n % CAMERA_WIDTH;
+
+    for (int row = 0; row < CAMERA_HEIGHT; row++) {
+        for (int col = 0; col < CAMERA_WIDTH; col++) {
+            int luma = 16 + (col + row) * 219 / (CAMERA_WIDTH + CAMERA_HEIGHT);
+            if (col >= bar && col < bar + 8) {
+                luma = 235;
+            }
+            y[row * CAMERA_WIDTH + col] = luma;
+        }
+    }
+    for (int bit = 0; bit < 16; bit++) {
+        uint8_t luma = (n >> (15 - bit)) & 1 ? 235 : 16;
+        for (int row = 0; row < 4; row++) {
+            memset(y + row * CAMERA_WIDTH + bit * 4, luma, 4);
+        }
+    }
+    for (int row = 0; row < CAMERA_HEIGHT / 2; row++) {
+        for (int col = 0; col < CAMERA_WIDTH / 2; col++) {
+            u[row * (CAMERA_WIDTH / 2) + col] = 16 + col * 224 / (CAMERA_WIDTH / 2);
+            v[row * (CAMERA_WIDTH / 2) + col] = 16 + row * 224 / (CAMERA_HEIGHT / 2);
+        }
+    }
+}
+
+static int synthetic_start(CameraSource *source) {
+    synthetic_state *st = source->state;
+    pacer_start(&st->pace);
+    return 0;
+}
+
+static int synthetic_read(CameraSource *source, uint8_t *frame) {
+    synthetic_state *st = source->state;
+    if (!pacer_wait(&st->pace, source->fps)) {
+        return -1;
+    }
+    draw_pattern(frame, st->count++);
+    return 0;
+}
+
+static void synthetic_interrupt(CameraSource *source) {
+    synthetic_state *st = source->state;
+    pacer_interrupt(&st->pace);
+}
+
+static void synthetic_stop(CameraSource *source) { (void)source; }
+
+static void synthetic_destroy(CameraSource *source) {
+    synthetic_state *st = source->state;
+    pacer_destroy(&st->pace);
+}
+
+CameraSource *camera_source_synthetic(double fps) {
+    CameraSource *source = new_source("synthetic", sizeof(synthetic_state));
+    if (source == NULL) {
+        return NULL;
+    }
+    synthetic_state *st = source->state;
+    pacer_init(&st->pace);
+
+    source->fps = fps;
+    source->start = synthetic_start;
+    source->read = synthetic_read;
+    source->interrupt = synthetic_interrupt;
+    source->stop = synthetic_stop;
+    source->destroy = synthetic_destroy;
+    return source;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Replay
+// ---------------------------------------------------------------------------------------------
+
+typedef struct {
+    pacer pace;
+    char *dir;
+    char **names; // The .bmp and .yuv files, sorted
+    int num_names;
+    int next_name;
+    int fd;             // The .yuv file being played, or -1
+    int frames_in_pass; // Frames delivered since the first file, to notice a pass with none
+    uint8_t bmp[IMG_SIZE];
+} replay_state;
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_names(replay_state *st) {
+    for (int i = 0; i < st->num_names; i++) {
+        free(st->names[i]);
+    }
+    free(st->names);
+    st->names = NULL;
+    st->num_names = 0;
+}
+
+static int replay_start(CameraSource *source) {
+    replay_state *st = source->state;
+    DIR *d = opendir(st->dir);
+    if (d == NULL) {
+        log_error("Failed to open %s: %s", st->dir, strerror(errno));
+        return -1;
+    }
+    free_names(st);
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!has_suffix(entry->d_name, ".bmp") && !has_suffix(entry->d_name, ".yuv")) {
+            continue;
+        }
+        if (st->num_names == capacity) {
+            int grown = capacity ? capacity * 2 : 16;
+            char **names = realloc(st->names, grown * sizeof(char *));
+            if (names != NULL) {
+                st->names = names;
+                capacity = grown;
+            }
+        }
+        char *name = st->num_names < capacity ? strdup(entry->d_name) : NULL;
+        if (name == NULL) {
+            log_error("Failed to allocate the list of files in %s", st->dir);
+            closedir(d);
+            free_names(st);
+            return -1;
+        }
+        st->names[st->num_names++] = name;
+    }
+    closedir(d);
+
+    if (st->num_names == 0) {
+        log_error("No .bmp or .yuv files to replay in %s", st->dir);
+        return -1;
+    }
+    qsort(st->names, st->num_names, sizeof(char *), compare_names);
+    st->next_name = 0;
+    st->frames_in_pass = 0;
+    st->fd = -1;
+    pacer_start(&st->pace);
+    log_info("Replaying %d files from %s", st->num_names, st->dir);
+    return 0;
+}
+
+// Reads one frame from a .bmp file
+static bool read_bmp(int fd, uint8_t *bmp, uint8_t *frame) {
+    if (!camera_read_full(fd, bmp, IMG_SIZE, 0) || bmp[0] != 'B' || bmp[1] != 'M' ||
+        camera_get_u32(bmp + 10) != BMP_HEADER_SIZE ||
+        camera_get_u32(bmp + 18) != CAMERA_WIDTH || camera_get_u32(bmp + 22) != CAMERA_HEIGHT ||
+        bmp[28] != 24) {
+        return false;
+    }
+    convert_bgr888_to_yuv420(bmp + BMP_HEADER_SIZE, frame, CAMERA_WIDTH, CAMERA_HEIGHT);
+    return true;
+}
+
+static int replay_read(CameraSource *source, uint8_t *frame) {
+    replay_state *st = source->state;
+    if (!pacer_wait(&st->pace, source->fps)) {
+        return -1;
+    }
+
+    // A whole pass over the files without a frame ends the replay
+    while (st->num_names > 0) {
+        if (st->fd >= 0) {
+            if (camera_read_full(st->fd, frame, CAMERA_FRAME_SIZE, 0)) {
+                st->frames_in_pass++;
+                return 0;
+            }
+            close(st->fd);
+            st->fd = -1;
+        }
+
+        if (st->next_name == st->num_names) {
+            if (st->frames_in_pass == 0) {
+                break;
+            }
+            st->next_name = 0;
+            st->frames_in_pass = 0;
+        }
+        const char *name = st->names[st->next_name];
+        char path[REPLAY_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", st->dir, name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 && has_suffix(name, ".yuv")) {
+            st->fd = fd;
+            st->next_name++;
+            continue;
+        }
+        bool ok = fd >= 0 && read_bmp(fd, st->bmp, frame);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (ok) {
+            st->next_name++;
+            st->frames_in_pass++;
+            return 0;
+        }
+
+        // Dropped from the list, so it is only complained about once
+        if (fd < 0) {
+            log_warn("Skipping %s: %s", path, strerror(errno));
+        } else {
+            log_warn("Skipping %s, it is not a %dx%d 24-bit BMP", path, CAMERA_WIDTH,
+                     CAMERA_HEIGHT);
+        }
+        free(st->names[st->next_name]);
+        memmove(st->names + st->next_name, st->names + st->next_name + 1,
+                (st->num_names - st->next_name - 1) * sizeof(char *));
+        st->num_names--;
+    }
+    log_error("Nothing left to replay in %s", st->dir);
+    return -1;
+}
+
+static void replay_interrupt(CameraSource *source) {
+    replay_state *st = source->state;
+    pacer_interrupt(&st->pace);
+}
+
+static void replay_stop(CameraSource *source) {
+    replay_state *st = source->state;
+    if (st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+    }
+}
+
+static void replay_destroy(CameraSource *source) {
+    replay_state *st = source->state;
+    free_names(st);
+    free(st->dir);
+    pacer_destroy(&st->pace);
+}
+
+CameraSource *camera_source_replay(const char *dir, double fps) {
+    CameraSource *source = new_source("replay", sizeof(replay_state));
+    if (source == NULL) {
+        return NULL;
+    }
+    replay_state *st = source->state;
+    st->dir = strdup(dir);
+    if (st->dir == NULL) {
+        log_error("Failed to allocate the replay directory name");
+        free(st);
+        free(source);
+        return NULL;
+    }
+    pacer_init(&st->pace);
+    st->fd = -1;
+
+    source->fps = fps;
+    source->start = replay_start;
+    source->read = replay_read;
+    source->interrupt = replay_interrupt;
+    source->stop = replay_stop;
+    source->destroy = replay_destroy;
+    return source;
+}
+
+// ---------------------------------------------------------------------------------------------
+
+// Splits an "@fps" suffix off arg. Returns false if it is there but not a number.
+static bool split_fps(char *arg, double *fps) {
+    char *at = strrchr(arg, '@');
+    if (at == NULL) {
+        *fps = CAMERA_FPS;
+        return true;
+    }
+    char *end;
+    *at = '\0';
+    *fps = strtod(at + 1, &end);
+    return end != at + 1 && *end == '\0' && *fps >= 0;
+}
+
+CameraSource *camera_source_parse(const char *spec) {
+    if (spec == NULL || spec[0] == '\0' || strcmp(spec, "libcamera") == 0) {
+        const char *command = getenv(CAMERA_HELPER_ENV);
+        return camera_source_command(command != NULL && command[0] != '\0' ? command
+                                                                           : CAMERA_HELPER);
+    }
+
+    char *copy = strdup(spec);
+    if (copy == NULL) {
+        log_error("Failed to allocate a copy of %s", spec);
+        return NULL;
+    }
+    CameraSource *source = NULL;
+    bool known = false;
+    double fps;
+    if (strncmp(copy, "synthetic", 9) == 0 && (copy[9] == '\0' || copy[9] == '@')) {
+        if (split_fps(copy, &fps)) {
+            known = true;
+            source = camera_source_synthetic(fps);
+        }
+    } else if (strncmp(copy, "replay:", 7) == 0 && copy[7] != '\0') {
+        if (split_fps(copy + 7, &fps) && copy[7] != '\0') {
+            known = true;
+            source = camera_source_replay(copy + 7, fps);
+        }
+    }
+    if (!known) {
+        log_error("Unknown camera source: %s", spec);
+    }
+    free(copy);
+    return source;
+}
+
+void camera_source_destroy(CameraSource *source) {
+    if (source == NULL) {
+        return;
+    }
+    source->destroy(source);
+    free(source->state);
+    free(source);
+}
@@ -0,0 +1,105 @@
+#ifndef __CAMERA_SOURCE_H
+#define __CAMERA_SOURCE_H
+
+#include <stdint.h>
+
+// Where lib/camera.c gets its frames from. Every source delivers raw YUV420 (I420) frames of
+// CAMERA_FRAME_SIZE bytes, as libcamera-vid does with --codec yuv420, so everything downstream of
+// capture runs the same whether the frames come from the camera, from files or from nothing.
+//
+// A source is started, read from one frame at a time on the camera's reader thread, interrupted
+// from any other thread to make that read return, and stopped. It can be started again after
+// being stopped.
+
+// Picks the source when CameraConfig does not give one:
+//   libcamera           The camera, through CAMERA_HELPER (the default)
+//   synthetic[@fps]     A moving test pattern
+//   replay:dir[@fps]    The frames in a directory, over and over
+// fps defaults to CAMERA_FPS. An fps of 0 delivers frames as fast as they are read.
+#define CAMERA_SOURCE_ENV "DOORBELL_CAMERA_SOURCE"
+
+typedef struct CameraSource CameraSource;
+
+struct CameraSource {
+    const char *name;
+    double fps; // Frames per second it delivers, 0 if as fast as it can
+
+    // Returns 0 on success, -1 if the source cannot deliver frames
+    int (*start)(CameraSource *source);
+    // Blocks until the next frame is in frame. Returns 0, or -1 if the source has ended or was
+    // interrupted.
+    int (*read)(CameraSource *source, uint8_t *frame);
+    // Makes a read in progress, and every later one, return -1. Safe to call from any thread.
+    void (*interrupt)(CameraSource *source);
+    // Called once read has returned -1 or will not be called again
+    void (*stop)(CameraSource *source);
+    void (*destroy)(CameraSource *source);
+
+    void *state;
+};
+
+/**
+ * Description:
+ *  A source that runs a command and reads frames from its stdout, which is how the camera itself
+ *  is used: see CAMERA_HELPER in camera.h. tools/fake_camera can stand in for it.
+ *
+ * Arguments:
+ *  command: Run with /bin/sh. It is copied.
+ *
+ * Return:
+ *  The source, to be freed with camera_source_destroy, or NULL if it could not be allocated.
+ */
+CameraSource *camera_source_command(const char *command);
+
+/**
+ * Description:
+ *  A source that makes up frames: a gradient with a bar moving across it, and the frame number in
+ *  the top left corner as 16 black or white 4x4 blocks, most significant bit first. Costs next to
+ *  nothing to produce, so it shows what everything after it can keep up with.
+ *
+ * Arguments:
+ *  fps: Frames per second, or 0 for as fast as they are read.
+ *
+ * Return:
+ *  The source, to be freed with camera_source_destroy, or NULL if it could not be allocated.
+ */
+CameraSource *camera_source_synthetic(double fps);
+
+/**
+ * Description:
+ *  A source that plays back the files in a directory, in name order, starting over after the
+ *  last. Files ending in .bmp must be IMG_SIZE byte pictures like camera_capture_data takes, and
+ *  are converted to YUV420. Files ending in .yuv hold any number of raw frames back to back, such
+ *  as what libcamera-vid -o clip.yuv records. Anything else is skipped.
+ *
+ * Arguments:
+ *  dir: The directory. It is copied.
+ *  fps: Frames per second, or 0 for as fast as they can be read.
+ *
+ * Return:
+ *  The source, to be freed with camera_source_destroy, or NULL if it could not be allocated.
+ */
+CameraSource *camera_source_replay(const char *dir, double fps);
+
+/**
+ * Description:
+ *  Makes a source from a description like the ones CAMERA_SOURCE_ENV takes.
+ *
+ * Arguments:
+ *  spec: The description. NULL or an empty string means libcamera.
+ *
+ * Return:
+ *  The source, or NULL if spec does not describe one or it could not be allocated.
+ */
+CameraSource *camera_source_parse(const char *spec);
+
+/**
+ * Description:
+ *  Frees a source. It must be stopped.
+ *
+ * Arguments:
+ *  source: The source. Can be NULL.
+ */
+void camera_source_destroy(CameraSource *source);
+
+#endif
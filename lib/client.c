@@ -1,62 +1,207 @@
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "client.h"
 #include "log.h"
 
-int client_connect(const Config *config) {
-    // Sets up structs for address info of specified hostname/port pair
-    log_info("Connecting to server...");
-    struct addrinfo hints, *result, *rp;
-    int sockfd = -1;
-    int status;
+typedef struct {
+    int sockfd; // -1 if the slot is free
+    char host[64];
+    char port[8];
+    uint64_t idle_since;
+} pool_entry;
+
+static pool_entry pool[CLIENT_POOL_SIZE] = {
+    [0 ... CLIENT_POOL_SIZE - 1] = {.sockfd = -1},
+};
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    // Sets the IP version to unspecified to be version neutral and the socket type to TCP
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC;     // Either IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP
+static const ClientDeadlines default_deadlines = {
+    .connect_ms = CLIENT_CONNECT_TIMEOUT_MS,
+    .send_ms = CLIENT_SEND_TIMEOUT_MS,
+    .recv_ms = CLIENT_RECV_TIMEOUT_MS,
+};
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    // Checks to see if there is correct address info for hostname/port pair
-    if ((status = getaddrinfo(config->host, config->port, &hints, &result)) != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
-        exit(EXIT_FAILURE);
+static void set_nonblocking(int fd, bool nonblocking) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+static void connector_abort(ClientConnector *c) {
+    for (int i = 0; i < c->num_attempts; i++) {
+        close(c->attempts[i]);
     }
+    c->num_attempts = 0;
+}
 
-    // Loops through linked list pairs of info to establish a valid socket
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+// Starts the next address that gets as far as a pending connect
+static void connector_launch(ClientConnector *c) {
+    while (c->next < c->addrs.count && c->num_attempts < CLIENT_MAX_ATTEMPTS) {
+        int index = c->next++;
+        const ResolvedAddr *addr = &c->addrs.addrs[index];
+        int fd = socket(addr->family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            continue;
+        }
+        // Nagle would hold the last segment of a file until the server ACKs the one before it,
+        // which the server delays when it has nothing to send yet. MSG_MORE still keeps a header
+        // together with the start of its file.
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        // A connect that finishes straight away still shows up as writable on the next poll
+        if (connect(fd, (const struct sockaddr *)&addr->addr, addr->len) == 0 ||
+            errno == EINPROGRESS) {
+            c->attempts[c->num_attempts] = fd;
+            c->attempt_addr[c->num_attempts] = index;
+            c->num_attempts++;
+            c->next_attempt_ms = monotonic_ms() + CLIENT_CONNECT_STAGGER_MS;
+            return;
+        }
+        close(fd);
+    }
+}
 
-        // Socket incorrect
-        if (sockfd < 0) {
-            printf(strerror(ENOTCONN));
+static int connector_start(ClientConnector *c, const char *host, const char *port) {
+    memset(c, 0, sizeof(*c));
+    c->winner = -1;
+    if (resolver_lookup(host, port, &c->addrs) != 0) {
+        return -1;
+    }
+    connector_launch(c);
+    return 0;
+}
+
+static int connector_pollfds(const ClientConnector *c, struct pollfd *fds) {
+    for (int i = 0; i < c->num_attempts; i++) {
+        fds[i].fd = c->attempts[i];
+        fds[i].events = POLLOUT;
+        fds[i].revents = 0;
+    }
+    return c->num_attempts;
+}
+
+// Milliseconds until the next attempt is due, or -1 if there is nothing left to start
+static int connector_timeout(const ClientConnector *c) {
+    if (c->next >= c->addrs.count || c->num_attempts >= CLIENT_MAX_ATTEMPTS) {
+        return -1;
+    }
+    uint64_t now = monotonic_ms();
+    return c->next_attempt_ms > now ? (int)(c->next_attempt_ms - now) : 0;
+}
+
+// Remembers which address won, so the next connection tries it first
+static void connector_won(const ClientConnector *c, const char *host, const char *port) {
+    if (c->winner > 0) {
+        resolver_prefer(host, port, &c->addrs.addrs[c->winner]);
+    }
+}
+
+// Returns the connected socket once an attempt wins, -1 while attempts are pending, or -2 once
+// every address failed
+static int connector_step(ClientConnector *c, const struct pollfd *fds, int nfds) {
+    bool failed = false;
+
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        int slot = -1;
+        for (int a = 0; a < c->num_attempts; a++) {
+            if (c->attempts[a] == fds[i].fd) {
+                slot = a;
+            }
+        }
+        if (slot < 0) {
             continue;
         }
 
-        // Checks to see if connection is valid
-        if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) != -1) {
-            log_info("Connection established");
+        int fd = c->attempts[slot];
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        c->num_attempts--;
+        c->attempts[slot] = c->attempts[c->num_attempts];
+        if (err == 0) {
+            c->winner = c->attempt_addr[slot];
+            connector_abort(c);
+            return fd;
+        }
+        c->attempt_addr[slot] = c->attempt_addr[c->num_attempts];
+        log_warn("connect: %s", strerror(err));
+        close(fd);
+        failed = true;
+    }
+
+    // A failure hands the turn to the next address right away instead of waiting out the stagger
+    if (failed || connector_timeout(c) == 0) {
+        connector_launch(c);
+    }
+    if (c->num_attempts == 0 && c->next >= c->addrs.count) {
+        return -2;
+    }
+    return -1;
+}
+
+int client_connect(const Config *config) {
+    log_info("Connecting to server...");
+    ClientConnector c;
+    if (connector_start(&c, config->host, config->port) != 0) {
+        return -1;
+    }
+
+    uint64_t deadline = monotonic_ms() + CLIENT_CONNECT_TIMEOUT_MS;
+    struct pollfd fds[CLIENT_MAX_ATTEMPTS];
+    int nfds = connector_pollfds(&c, fds);
+    int sockfd;
+    while ((sockfd = connector_step(&c, fds, nfds)) == -1) {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
             break;
-        } else {
-            printf(strerror(ETIMEDOUT));
-            close(sockfd);
+        }
+        int timeout = (int)(deadline - now);
+        int next = connector_timeout(&c);
+        if (next >= 0 && next < timeout) {
+            timeout = next;
+        }
+        nfds = connector_pollfds(&c, fds);
+        if (poll(fds, nfds, timeout) <= 0) {
+            nfds = 0;
         }
     }
 
-    freeaddrinfo(result); // free the linked list
-    if (sockfd == -1) {
-        printf("could not establish connection with TCP server\n");
-        exit(EXIT_FAILURE);
+    if (sockfd < 0) {
+        connector_abort(&c);
+        resolver_invalidate(config->host, config->port);
+        log_error("Could not establish connection with TCP server");
+        return -1;
     }
+    connector_won(&c, config->host, config->port);
+    set_nonblocking(sockfd, false);
+    log_info("Connection established");
     return sockfd;
 }
 
@@ -73,14 +218,810 @@ void client_send_image(int sockfd, const Config *config) {
     }
 }
 
-void client_receive_response(int sockfd) {
+int client_send_parts(int sockfd, const char *hw_id, const uint8_t *body, size_t body_size) {
+    struct iovec iov[2] = {
+        {.iov_base = (void *)hw_id, .iov_len = strlen(hw_id)},
+        {.iov_base = (void *)body, .iov_len = body_size},
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+
+    // Partial sends advance through the iovecs instead of copying what is left
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            perror("sendmsg");
+            return -1;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+// Sends a header and then the file behind it, carrying on from where header_sent and file_offset
+// say the last call stopped. MSG_MORE holds the header back so it leaves in the same segment as
+// the start of the file. Returns 1 once all of it is out, 0 if the socket is full, or -1 if the
+// connection broke or the file shrank after its length went out.
+static int send_header_and_file(int sockfd, const void *header, size_t header_len,
+                                size_t *header_sent, int file_fd, int64_t *file_offset,
+                                int64_t file_size) {
+    int flags = MSG_NOSIGNAL | (file_size > 0 ? MSG_MORE : 0);
+    while (*header_sent < header_len) {
+        ssize_t sent = send(sockfd, (const uint8_t *)header + *header_sent,
+                            header_len - *header_sent, flags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        *header_sent += sent;
+    }
+
+    while (*file_offset < file_size) {
+        off_t offset = *file_offset;
+        ssize_t sent = sendfile(sockfd, file_fd, &offset, file_size - offset);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (sent == 0) {
+            return -1;
+        }
+        *file_offset = offset;
+    }
+    return 1;
+}
+
+int client_send_file(int sockfd, const char *hw_id, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // The socket blocks, so it is never full
+    size_t header_sent = 0;
+    int64_t offset = 0;
+    int done = send_header_and_file(sockfd, hw_id, strlen(hw_id), &header_sent, fd, &offset,
+                                    st.st_size);
+    if (done != 1) {
+        perror("send");
+    }
+    close(fd);
+    return done == 1 ? 0 : -1;
+}
+
+int client_receive_response(int sockfd) {
     uint8_t buf[101];
     int num_recv = recv(sockfd, buf, 100, 0);
+    if (num_recv <= 0) {
+        return num_recv;
+    }
     buf[num_recv] = '\0';
 
     printf("Response from server: %s\n", buf);
+    return num_recv;
 }
 
 void client_close(int sockfd) {
     close(sockfd);
 }
+
+// Checks that an idle connection is still usable without blocking. Anything readable on it means
+// either the server closed it (recv returns 0) or sent something nobody asked for.
+static bool connection_healthy(int sockfd) {
+    uint8_t byte;
+    ssize_t got = recv(sockfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Takes a healthy idle connection out of the pool, or returns -1 if there is none
+static int pool_take(const Config *config) {
+    uint64_t now = monotonic_ms();
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < CLIENT_POOL_SIZE; i++) {
+        pool_entry *entry = &pool[i];
+        if (entry->sockfd < 0 || strcmp(entry->host, config->host) != 0 ||
+            strcmp(entry->port, config->port) != 0) {
+            continue;
+        }
+
+        int sockfd = entry->sockfd;
+        entry->sockfd = -1;
+        if (now - entry->idle_since < CLIENT_POOL_IDLE_S * 1000 && connection_healthy(sockfd)) {
+            pthread_mutex_unlock(&pool_lock);
+            return sockfd;
+        }
+        log_info("Dropping a stale connection to %s:%s", config->host, config->port);
+        close(sockfd);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return -1;
+}
+
+int client_pool_get(const Config *config, bool *reused) {
+    int sockfd = pool_take(config);
+    *reused = sockfd >= 0;
+    if (sockfd < 0) {
+        return client_connect(config);
+    }
+    // It may have been left non-blocking by a ClientUpload
+    set_nonblocking(sockfd, false);
+    return sockfd;
+}
+
+void client_pool_put(const Config *config, int sockfd, bool reusable) {
+    if (sockfd < 0) {
+        return;
+    }
+    if (reusable && strlen(config->host) < sizeof(pool[0].host) &&
+        strlen(config->port) < sizeof(pool[0].port)) {
+        pthread_mutex_lock(&pool_lock);
+        for (int i = 0; i < CLIENT_POOL_SIZE; i++) {
+            pool_entry *entry = &pool[i];
+            if (entry->sockfd < 0) {
+                entry->sockfd = sockfd;
+                strcpy(entry->host, config->host);
+                strcpy(entry->port, config->port);
+                entry->idle_since = monotonic_ms();
+                pthread_mutex_unlock(&pool_lock);
+                return;
+            }
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    close(sockfd);
+}
+
+void client_pool_close_all() {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < CLIENT_POOL_SIZE; i++) {
+        if (pool[i].sockfd >= 0) {
+            close(pool[i].sockfd);
+            pool[i].sockfd = -1;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void upload_fail(ClientUpload *up, ClientError error) {
+    up->phase = CLIENT_DONE;
+    up->error = error;
+}
+
+static void enter_phase(ClientUpload *up, ClientPhase phase, unsigned int timeout_ms) {
+    up->phase = phase;
+    up->deadline_ms = monotonic_ms() + timeout_ms;
+}
+
+static void begin_connect(ClientUpload *up) {
+    if (connector_start(&up->connector, up->config.host, up->config.port) != 0) {
+        upload_fail(up, CLIENT_ERR_RESOLVE);
+        return;
+    }
+    if (up->connector.num_attempts == 0) {
+        upload_fail(up, CLIENT_ERR_CONNECT);
+        return;
+    }
+    enter_phase(up, CLIENT_CONNECTING, up->deadlines.connect_ms);
+}
+
+int client_upload_start(ClientUpload *up, const Config *config, const char *path,
+                        const ClientDeadlines *deadlines) {
+    memset(up, 0, sizeof(*up));
+    up->sockfd = -1;
+    up->config = *config;
+    up->deadlines = deadlines ? *deadlines : default_deadlines;
+
+    up->file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (up->file_fd < 0 || fstat(up->file_fd, &st) != 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        upload_fail(up, CLIENT_ERR_FILE);
+        return -1;
+    }
+    up->file_size = st.st_size;
+
+    up->sockfd = config->reuse_connection ? pool_take(config) : -1;
+    if (up->sockfd >= 0) {
+        up->reused = true;
+        set_nonblocking(up->sockfd, true);
+        enter_phase(up, CLIENT_SENDING, up->deadlines.send_ms);
+    } else {
+        begin_connect(up);
+    }
+    return up->phase == CLIENT_DONE ? -1 : 0;
+}
+
+int client_upload_pollfds(const ClientUpload *up, struct pollfd *fds) {
+    switch (up->phase) {
+    case CLIENT_CONNECTING:
+        return connector_pollfds(&up->connector, fds);
+    case CLIENT_SENDING:
+    case CLIENT_RECEIVING:
+        fds[0].fd = up->sockfd;
+        fds[0].events = up->phase == CLIENT_SENDING ? POLLOUT : POLLIN;
+        fds[0].revents = 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int client_upload_timeout(const ClientUpload *up) {
+    if (up->phase == CLIENT_DONE) {
+        return -1;
+    }
+    uint64_t now = monotonic_ms();
+    int timeout = up->deadline_ms > now ? (int)(up->deadline_ms - now) : 0;
+    if (up->phase == CLIENT_CONNECTING) {
+        int next = connector_timeout(&up->connector);
+        if (next >= 0 && next < timeout) {
+            timeout = next;
+        }
+    }
+    return timeout;
+}
+
+// Sends as much as the socket takes. Returns false on a broken connection.
+static bool upload_send(ClientUpload *up) {
+    int done = send_header_and_file(up->sockfd, up->config.hw_id, strlen(up->config.hw_id),
+                                    &up->header_sent, up->file_fd, &up->file_offset,
+                                    up->file_size);
+    if (done <= 0) {
+        return done == 0;
+    }
+    enter_phase(up, CLIENT_RECEIVING, up->deadlines.recv_ms);
+    return true;
+}
+
+// Reads the response. Returns CLIENT_OK unless the connection broke or closed.
+static ClientError upload_receive(ClientUpload *up) {
+    ssize_t got = recv(up->sockfd, up->response, CLIENT_RESPONSE_MAX, 0);
+    if (got < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? CLIENT_OK : CLIENT_ERR_RECV;
+    }
+    if (got == 0) {
+        return CLIENT_ERR_CLOSED;
+    }
+    up->response[got] = '\0';
+    log_info("Response from server: %s", up->response);
+    up->phase = CLIENT_DONE;
+    up->error = CLIENT_OK;
+    return CLIENT_OK;
+}
+
+// A pooled connection the server has since closed fails on first use, or never answers if the
+// server dropped it without a FIN. That is not the upload's fault, so it gets one more go on a new
+// connection.
+static bool retry_fresh(ClientUpload *up) {
+    if (!up->reused || up->retried) {
+        return false;
+    }
+    log_info("Pooled connection to %s:%s failed, reconnecting", up->config.host, up->config.port);
+    close(up->sockfd);
+    up->sockfd = -1;
+    up->reused = false;
+    up->retried = true;
+    up->header_sent = 0;
+    up->file_offset = 0;
+    begin_connect(up);
+    return true;
+}
+
+bool client_upload_step(ClientUpload *up, const struct pollfd *fds, int nfds) {
+    if (up->phase == CLIENT_DONE) {
+        return true;
+    }
+
+    short revents = 0;
+    if (up->phase == CLIENT_CONNECTING) {
+        int sockfd = connector_step(&up->connector, fds, nfds);
+        if (sockfd >= 0) {
+            connector_won(&up->connector, up->config.host, up->config.port);
+            up->sockfd = sockfd;
+            enter_phase(up, CLIENT_SENDING, up->deadlines.send_ms);
+            // A socket that just connected can be written to
+            revents = POLLOUT;
+        } else if (sockfd == -2) {
+            resolver_invalidate(up->config.host, up->config.port);
+            upload_fail(up, CLIENT_ERR_CONNECT);
+        }
+    } else if (nfds > 0 && fds[0].fd == up->sockfd) {
+        revents = fds[0].revents;
+    }
+
+    // Either phase may finish straight away, so they run one after the other
+    bool alive = true;
+    if (up->phase == CLIENT_SENDING && revents != 0) {
+        alive = upload_send(up);
+        if (!alive && !retry_fresh(up)) {
+            upload_fail(up, CLIENT_ERR_SEND);
+        }
+    }
+    if (alive && up->phase == CLIENT_RECEIVING && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        ClientError error = upload_receive(up);
+        if (error != CLIENT_OK && !retry_fresh(up)) {
+            upload_fail(up, error);
+        }
+    }
+
+    if (up->phase != CLIENT_DONE && monotonic_ms() >= up->deadline_ms &&
+        !(up->phase == CLIENT_RECEIVING && retry_fresh(up))) {
+        upload_fail(up, up->phase == CLIENT_CONNECTING ? CLIENT_ERR_CONNECT_TIMEOUT
+                        : up->phase == CLIENT_SENDING  ? CLIENT_ERR_SEND_TIMEOUT
+                                                       : CLIENT_ERR_RECV_TIMEOUT);
+    }
+    return up->phase == CLIENT_DONE;
+}
+
+void client_upload_finish(ClientUpload *up) {
+    if (up->sockfd >= 0) {
+        client_pool_put(&up->config, up->sockfd,
+                        up->config.reuse_connection && up->phase == CLIENT_DONE &&
+                            up->error == CLIENT_OK);
+        up->sockfd = -1;
+    }
+    if (up->file_fd >= 0) {
+        close(up->file_fd);
+        up->file_fd = -1;
+    }
+    connector_abort(&up->connector);
+}
+
+ClientError client_upload_file(const Config *config, const char *path,
+                               const ClientDeadlines *deadlines) {
+    ClientUpload up;
+    client_upload_start(&up, config, path, deadlines);
+
+    struct pollfd fds[CLIENT_MAX_ATTEMPTS];
+    int nfds = client_upload_pollfds(&up, fds);
+    while (!client_upload_step(&up, fds, nfds)) {
+        nfds = client_upload_pollfds(&up, fds);
+        if (poll(fds, nfds, client_upload_timeout(&up)) <= 0) {
+            nfds = 0;
+        }
+    }
+
+    ClientError error = up.error;
+    client_upload_finish(&up);
+    return error;
+}
+
+static void stream_fail(ClientStream *s, ClientError error) {
+    s->phase = CLIENT_DONE;
+    s->error = error;
+}
+
+static void stream_begin_connect(ClientStream *s) {
+    if (connector_start(&s->connector, s->config.host, s->config.port) != 0) {
+        stream_fail(s, CLIENT_ERR_RESOLVE);
+        return;
+    }
+    if (s->connector.num_attempts == 0) {
+        stream_fail(s, CLIENT_ERR_CONNECT);
+        return;
+    }
+    s->phase = CLIENT_CONNECTING;
+    s->deadline_ms = monotonic_ms() + s->deadlines.connect_ms;
+}
+
+static void frame_release(ClientFrame *f) {
+    close(f->file_fd);
+    f->used = false;
+}
+
+// Works out the phase of a connected stream. Frames go out in the order they were pushed, and
+// each one gets send_ms from when it starts.
+static void stream_update_phase(ClientStream *s) {
+    if (s->sending < 0) {
+        for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+            const ClientFrame *f = &s->frames[i];
+            if (f->used && f->sent_ms == 0 &&
+                (s->sending < 0 || (int32_t)(f->seq - s->frames[s->sending].seq) < 0)) {
+                s->sending = i;
+            }
+        }
+        if (s->sending >= 0) {
+            s->deadline_ms = monotonic_ms() + s->deadlines.send_ms;
+        }
+    }
+    s->phase = s->sending >= 0 ? CLIENT_SENDING : CLIENT_RECEIVING;
+}
+
+int client_stream_open(ClientStream *s, const Config *config, const ClientDeadlines *deadlines) {
+    memset(s, 0, sizeof(*s));
+    s->sockfd = -1;
+    s->sending = -1;
+    s->next_seq = 1;
+    s->config = *config;
+    s->deadlines = deadlines ? *deadlines : default_deadlines;
+
+    s->sockfd = pool_take(config);
+    if (s->sockfd >= 0) {
+        s->reused = true;
+        set_nonblocking(s->sockfd, true);
+        stream_update_phase(s);
+    } else {
+        stream_begin_connect(s);
+    }
+    return s->phase == CLIENT_DONE ? -1 : 0;
+}
+
+static uint16_t content_type(const char *path, const uint8_t *start, ssize_t len) {
+    if (len >= 2 && start[0] == 'B' && start[1] == 'M') {
+        return FRAME_CONTENT_BMP;
+    }
+    const char *ext = strrchr(path, '.');
+    if (ext && (strcmp(ext, ".log") == 0 || strcmp(ext, ".txt") == 0)) {
+        return FRAME_CONTENT_TEXT;
+    }
+    return FRAME_CONTENT_BINARY;
+}
+
+uint32_t client_stream_push(ClientStream *s, const char *path) {
+    if (client_stream_space(s) == 0) {
+        return 0;
+    }
+    ClientFrame *f = &s->frames[0];
+    while (f->used) {
+        f++;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    if (st.st_size > FRAME_SEND_MAX) {
+        log_error("%s is over the %d bytes sent in a frame", path, FRAME_SEND_MAX);
+        close(fd);
+        return 0;
+    }
+
+    // The checksum goes in the header, so the file is read once before any of it is sent. It is
+    // left in the page cache for sendfile.
+    uint8_t buf[16384];
+    uint8_t start[2];
+    ssize_t start_len = 0;
+    uint32_t crc = 0;
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t got = pread(fd, buf, sizeof(buf), offset);
+        if (got <= 0) {
+            log_error("Failed to read %s", path);
+            close(fd);
+            return 0;
+        }
+        if (offset == 0) {
+            start_len = got < 2 ? got : 2;
+            memcpy(start, buf, start_len);
+        }
+        crc = frame_crc32(crc, buf, got);
+        offset += got;
+    }
+
+    FrameHeader header = {
+        .seq = s->next_seq++,
+        .length = st.st_size,
+        .content_type = content_type(path, start, start_len),
+        .timestamp_ms = (uint64_t)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000,
+        .crc32 = crc,
+    };
+    strncpy(header.hw_id, s->config.hw_id, FRAME_HW_ID_MAX);
+    if (s->next_seq == 0) {
+        s->next_seq = 1;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->used = true;
+    f->seq = header.seq;
+    f->file_fd = fd;
+    f->file_size = st.st_size;
+    frame_encode_header(&header, f->header);
+
+    if (s->phase == CLIENT_SENDING || s->phase == CLIENT_RECEIVING) {
+        stream_update_phase(s);
+    }
+    return header.seq;
+}
+
+int client_stream_space(const ClientStream *s) {
+    if (s->phase == CLIENT_DONE) {
+        return 0;
+    }
+    return CLIENT_STREAM_WINDOW - client_stream_outstanding(s);
+}
+
+int client_stream_outstanding(const ClientStream *s) {
+    int count = 0;
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        count += s->frames[i].used;
+    }
+    return count;
+}
+
+int client_stream_pollfds(const ClientStream *s, struct pollfd *fds) {
+    switch (s->phase) {
+    case CLIENT_CONNECTING:
+        return connector_pollfds(&s->connector, fds);
+    case CLIENT_SENDING:
+    case CLIENT_RECEIVING:
+        // Always readable, so acks are taken while later frames are still going out
+        fds[0].fd = s->sockfd;
+        fds[0].events = POLLIN | (s->phase == CLIENT_SENDING ? POLLOUT : 0);
+        fds[0].revents = 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int client_stream_timeout(const ClientStream *s) {
+    if (s->phase == CLIENT_DONE) {
+        return -1;
+    }
+    uint64_t now = monotonic_ms();
+    uint64_t due = UINT64_MAX;
+    if (s->phase == CLIENT_CONNECTING || s->phase == CLIENT_SENDING) {
+        due = s->deadline_ms;
+    }
+    for (int i = 0; s->phase != CLIENT_CONNECTING && i < CLIENT_STREAM_WINDOW; i++) {
+        const ClientFrame *f = &s->frames[i];
+        if (f->used && f->sent_ms != 0 && f->sent_ms + s->deadlines.recv_ms < due) {
+            due = f->sent_ms + s->deadlines.recv_ms;
+        }
+    }
+
+    int timeout = due == UINT64_MAX ? -1 : due > now ? (int)(due - now) : 0;
+    if (s->phase == CLIENT_CONNECTING) {
+        int next = connector_timeout(&s->connector);
+        if (next >= 0 && next < timeout) {
+            timeout = next;
+        }
+    }
+    return timeout;
+}
+
+// Writes frames until the socket is full. Returns CLIENT_OK unless the connection broke.
+static ClientError stream_send(ClientStream *s) {
+    while (s->sending >= 0) {
+        ClientFrame *f = &s->frames[s->sending];
+        int done = send_header_and_file(s->sockfd, f->header, FRAME_HEADER_SIZE, &f->header_sent,
+                                        f->file_fd, &f->file_offset, f->file_size);
+        if (done <= 0) {
+            return done == 0 ? CLIENT_OK : CLIENT_ERR_SEND;
+        }
+
+        f->sent_ms = monotonic_ms();
+        s->sending = -1;
+        stream_update_phase(s);
+    }
+    return CLIENT_OK;
+}
+
+// Reads every ack that has arrived. Returns CLIENT_OK unless the connection broke, closed or
+// carried something that is not an ack for a frame that was sent.
+static ClientError stream_receive(ClientStream *s, ClientAck *acks, int *num_acks) {
+    for (;;) {
+        ssize_t got = recv(s->sockfd, s->ack + s->ack_got, FRAME_ACK_SIZE - s->ack_got, 0);
+        if (got < 0) {
+            return (errno == EAGAIN || errno == EINTR) ? CLIENT_OK : CLIENT_ERR_RECV;
+        }
+        if (got == 0) {
+            return CLIENT_ERR_CLOSED;
+        }
+        s->ack_got += got;
+        if (s->ack_got < FRAME_ACK_SIZE) {
+            continue;
+        }
+        s->ack_got = 0;
+
+        FrameAck ack;
+        if (frame_decode_ack(s->ack, &ack) != 0) {
+            return CLIENT_ERR_PROTOCOL;
+        }
+        ClientFrame *f = NULL;
+        for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+            if (s->frames[i].used && s->frames[i].seq == ack.seq && s->frames[i].sent_ms != 0) {
+                f = &s->frames[i];
+            }
+        }
+        if (!f) {
+            return CLIENT_ERR_PROTOCOL;
+        }
+        if (ack.status != FRAME_STATUS_OK) {
+            log_warn("Server rejected frame %u with status %u", ack.seq, ack.status);
+        }
+        acks[*num_acks] = (ClientAck){
+            .seq = ack.seq,
+            .error = ack.status == FRAME_STATUS_OK ? CLIENT_OK : CLIENT_ERR_REJECTED,
+        };
+        (*num_acks)++;
+        s->acked = true;
+        frame_release(f);
+    }
+}
+
+static ClientError stream_check_deadlines(const ClientStream *s) {
+    uint64_t now = monotonic_ms();
+    if (s->phase == CLIENT_SENDING && now >= s->deadline_ms) {
+        return CLIENT_ERR_SEND_TIMEOUT;
+    }
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        const ClientFrame *f = &s->frames[i];
+        if (f->used && f->sent_ms != 0 && now >= f->sent_ms + s->deadlines.recv_ms) {
+            return CLIENT_ERR_RECV_TIMEOUT;
+        }
+    }
+    return CLIENT_OK;
+}
+
+// Like retry_fresh, the frames not acked yet go again on a new connection when one breaks. The
+// server takes frames in order, so the connection broke on the oldest one that had started going
+// out and the ones behind it go again at no cost. That frame gets one more try, so a server that
+// drops a message now and then costs nothing, while a frame that keeps breaking connections fails
+// on its own. A pooled connection that was already dead is not the frames' fault and does not
+// count. Returns false, with a frame that used up its try in acks, if the stream should fail.
+static bool stream_retry(ClientStream *s, ClientError error, ClientAck *acks, int *num_acks) {
+    bool broke = error == CLIENT_ERR_SEND || error == CLIENT_ERR_RECV || error == CLIENT_ERR_CLOSED;
+    if (!broke) {
+        return false;
+    }
+    bool dead_in_pool = s->reused && !s->acked;
+    ClientFrame *oldest = NULL;
+    for (int i = 0; i < CLIENT_STREAM_WINDOW && !dead_in_pool; i++) {
+        ClientFrame *f = &s->frames[i];
+        if (f->used && f->header_sent > 0 &&
+            (!oldest || (int32_t)(f->seq - oldest->seq) < 0)) {
+            oldest = f;
+        }
+    }
+    if (oldest && oldest->resent) {
+        log_warn("Frame %u broke two connections, giving up on it", oldest->seq);
+        acks[(*num_acks)++] = (ClientAck){.seq = oldest->seq, .error = error};
+        frame_release(oldest);
+    } else if (oldest) {
+        oldest->resent = true;
+    }
+    if (client_stream_outstanding(s) == 0) {
+        return false;
+    }
+
+    log_info("Connection to %s:%s %s, reconnecting for %d frames", s->config.host, s->config.port,
+             dead_in_pool ? "from the pool was dead" : "broke", client_stream_outstanding(s));
+    close(s->sockfd);
+    s->sockfd = -1;
+    s->reused = false;
+    s->acked = false;
+    s->sending = -1;
+    s->ack_got = 0;
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        ClientFrame *f = &s->frames[i];
+        f->header_sent = 0;
+        f->file_offset = 0;
+        f->sent_ms = 0;
+    }
+    stream_begin_connect(s);
+    return true;
+}
+
+int client_stream_step(ClientStream *s, const struct pollfd *fds, int nfds, ClientAck *acks) {
+    int num_acks = 0;
+    if (s->phase == CLIENT_DONE) {
+        return 0;
+    }
+
+    short revents = 0;
+    ClientError error = CLIENT_OK;
+    if (s->phase == CLIENT_CONNECTING) {
+        int sockfd = connector_step(&s->connector, fds, nfds);
+        if (sockfd >= 0) {
+            connector_won(&s->connector, s->config.host, s->config.port);
+            s->sockfd = sockfd;
+            stream_update_phase(s);
+            // A socket that just connected can be written to
+            revents = POLLOUT;
+        } else if (sockfd == -2) {
+            resolver_invalidate(s->config.host, s->config.port);
+            error = CLIENT_ERR_CONNECT;
+        } else if (monotonic_ms() >= s->deadline_ms) {
+            error = CLIENT_ERR_CONNECT_TIMEOUT;
+        }
+    } else if (nfds > 0 && fds[0].fd == s->sockfd) {
+        revents = fds[0].revents;
+    }
+
+    if (error == CLIENT_OK && s->phase == CLIENT_SENDING && (revents & POLLOUT)) {
+        error = stream_send(s);
+    }
+    // Acks that arrived before the connection broke still count, and show it made progress
+    if (s->phase != CLIENT_CONNECTING &&
+        (error != CLIENT_OK || (revents & (POLLIN | POLLHUP | POLLERR)))) {
+        ClientError recv_error = stream_receive(s, acks, &num_acks);
+        error = error != CLIENT_OK ? error : recv_error;
+    }
+    if (error == CLIENT_OK && s->phase != CLIENT_CONNECTING) {
+        error = stream_check_deadlines(s);
+    }
+    if (error != CLIENT_OK && !stream_retry(s, error, acks, &num_acks)) {
+        stream_fail(s, error);
+    }
+
+    // A failed connection takes every frame still on it down too
+    for (int i = 0; s->phase == CLIENT_DONE && i < CLIENT_STREAM_WINDOW; i++) {
+        ClientFrame *f = &s->frames[i];
+        if (f->used) {
+            acks[num_acks++] = (ClientAck){.seq = f->seq, .error = s->error};
+            frame_release(f);
+        }
+    }
+    return num_acks;
+}
+
+void client_stream_close(ClientStream *s) {
+    if (s->sockfd >= 0) {
+        bool idle = client_stream_outstanding(s) == 0 && s->ack_got == 0;
+        client_pool_put(&s->config, s->sockfd, s->phase != CLIENT_DONE && idle);
+        s->sockfd = -1;
+    }
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        if (s->frames[i].used) {
+            frame_release(&s->frames[i]);
+        }
+    }
+    connector_abort(&s->connector);
+}
+
+const char *client_strerror(ClientError error) {
+    switch (error) {
+    case CLIENT_OK:
+        return "ok";
+    case CLIENT_ERR_FILE:
+        return "could not open the file";
+    case CLIENT_ERR_RESOLVE:
+        return "host name did not resolve";
+    case CLIENT_ERR_CONNECT:
+        return "connection refused or failed";
+    case CLIENT_ERR_CONNECT_TIMEOUT:
+        return "timed out connecting";
+    case CLIENT_ERR_SEND:
+        return "connection broke while sending";
+    case CLIENT_ERR_SEND_TIMEOUT:
+        return "timed out sending";
+    case CLIENT_ERR_RECV:
+        return "connection broke while waiting for the response";
+    case CLIENT_ERR_RECV_TIMEOUT:
+        return "timed out waiting for the response";
+    case CLIENT_ERR_CLOSED:
+        return "server closed the connection without answering";
+    case CLIENT_ERR_REJECTED:
+        return "server rejected the frame";
+    case CLIENT_ERR_PROTOCOL:
+        return "server sent something that is not an ack";
+    }
+    return "unknown error";
+}
@@ -1,6 +1,20 @@
 #ifndef CLIENT_H_
 #define CLIENT_H_
 
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "resolver.h"
+
+// Most idle connections client_pool_put keeps, across all hosts
+#define CLIENT_POOL_SIZE 4
+
+// Idle connections older than this are closed instead of reused
+#define CLIENT_POOL_IDLE_S 30
+
 // Contains all of the information needed to create to connect to the server and
 // send it a message.
 typedef struct Config {
@@ -9,11 +23,141 @@ typedef struct Config {
     uint8_t *payload;
     uint32_t payload_size;
     const char *hw_id;
+    // A plain upload may take an idle connection from the pool and gives its own back when done.
+    // Only for servers that read more than one file per connection. ClientStreams always pool.
+    bool reuse_connection;
 } Config;
 
+// Default limits on each phase of a ClientUpload. A phase that runs past its limit fails the
+// upload, so a slow or unreachable server cannot hold it up forever.
+#define CLIENT_CONNECT_TIMEOUT_MS 5000
+#define CLIENT_SEND_TIMEOUT_MS 15000
+#define CLIENT_RECV_TIMEOUT_MS 5000
+
+// How long a connection attempt gets before the next address is tried alongside it (the
+// "Connection Attempt Delay" of Happy Eyeballs, RFC 8305)
+#define CLIENT_CONNECT_STAGGER_MS 250
+
+// Most connection attempts racing at once. Also the most pollfds a ClientUpload needs.
+#define CLIENT_MAX_ATTEMPTS 4
+
+// Longest server response a ClientUpload keeps
+#define CLIENT_RESPONSE_MAX 100
+
+// Most frames a ClientStream has sent or queued without an ack
+#define CLIENT_STREAM_WINDOW 8
+
+typedef enum {
+    CLIENT_OK,
+    CLIENT_ERR_FILE,            // The file could not be opened
+    CLIENT_ERR_RESOLVE,         // The host name did not resolve
+    CLIENT_ERR_CONNECT,         // Every address refused or failed the connection
+    CLIENT_ERR_CONNECT_TIMEOUT, // No address answered within connect_ms
+    CLIENT_ERR_SEND,            // The connection broke while sending
+    CLIENT_ERR_SEND_TIMEOUT,    // The server did not take the file within send_ms
+    CLIENT_ERR_RECV,            // The connection broke while waiting for the response
+    CLIENT_ERR_RECV_TIMEOUT,    // The server did not answer within recv_ms
+    CLIENT_ERR_CLOSED,          // The server closed the connection without answering
+    CLIENT_ERR_REJECTED,        // The server acked a frame with an error status
+    CLIENT_ERR_PROTOCOL,        // The server sent something that is not an ack
+} ClientError;
+
+typedef enum {
+    CLIENT_CONNECTING,
+    CLIENT_SENDING,
+    CLIENT_RECEIVING,
+    CLIENT_DONE,
+} ClientPhase;
+
+typedef struct {
+    unsigned int connect_ms;
+    unsigned int send_ms; // For the whole file, not each write
+    unsigned int recv_ms;
+} ClientDeadlines;
+
+// Races connections to a host's addresses. A new attempt starts every CLIENT_CONNECT_STAGGER_MS,
+// or as soon as one fails, and the first to connect wins.
+typedef struct {
+    ResolvedAddrs addrs;
+    int next; // Index of the next address to try
+    int attempts[CLIENT_MAX_ATTEMPTS];
+    int attempt_addr[CLIENT_MAX_ATTEMPTS]; // Index into addrs of each attempt
+    int num_attempts;
+    int winner; // Index into addrs of the address that connected, -1 until one does
+    uint64_t next_attempt_ms; // CLOCK_MONOTONIC time the next address gets a turn
+} ClientConnector;
+
+// One upload of a file on a non-blocking socket. Set up with client_upload_start, then call
+// client_upload_step whenever the socket is ready or the timeout passes. The fields are read-only
+// outside lib/client.c.
+//
+// The file goes out with sendfile, which raises SIGPIPE if the server has closed the connection,
+// so programs using ClientUpload or ClientStream should ignore SIGPIPE.
+typedef struct {
+    ClientPhase phase;
+    ClientError error; // Why the upload failed, once phase is CLIENT_DONE
+    int sockfd;
+    bool reused;  // sockfd came from the connection pool
+    bool retried; // A reused connection already failed once and was replaced
+    Config config;
+    ClientDeadlines deadlines;
+    uint64_t deadline_ms; // CLOCK_MONOTONIC time the current phase fails at
+    ClientConnector connector;
+    int file_fd;
+    int64_t file_offset;
+    int64_t file_size;
+    size_t header_sent;
+    char response[CLIENT_RESPONSE_MAX + 1];
+} ClientUpload;
+
+// One file on a ClientStream, from client_stream_push until its ack
+typedef struct {
+    bool used;
+    uint32_t seq;
+    int file_fd;
+    int64_t file_offset;
+    int64_t file_size;
+    uint8_t header[FRAME_HEADER_SIZE];
+    size_t header_sent;
+    uint64_t sent_ms; // CLOCK_MONOTONIC time the last byte went out, 0 until then
+    bool resent;      // A connection already broke on it, and it is being sent again
+} ClientFrame;
+
+// How a frame on a ClientStream ended
+typedef struct {
+    uint32_t seq;
+    ClientError error;
+} ClientAck;
+
+// A connection carrying many files as frames of the framed protocol in lib/frame.h. Frames are
+// written back to back without waiting, and the server's acks are matched to them by seq as they
+// arrive. Set up with client_stream_open, then call client_stream_step whenever the socket is
+// ready or the timeout passes. The fields are read-only outside lib/client.c.
+//
+// The phase is CLIENT_SENDING while any frame has bytes left to write, CLIENT_RECEIVING while
+// only acks are missing (or nothing is queued), and CLIENT_DONE once the connection failed.
+typedef struct {
+    ClientPhase phase;
+    ClientError error; // Why the connection failed, once phase is CLIENT_DONE
+    int sockfd;
+    bool reused; // sockfd came from the connection pool
+    bool acked;  // At least one ack has arrived since the connection was made
+    Config config;
+    ClientDeadlines deadlines;
+    uint64_t deadline_ms; // CLOCK_MONOTONIC time connecting or the frame being written fails at
+    ClientConnector connector;
+    ClientFrame frames[CLIENT_STREAM_WINDOW];
+    int sending; // Index into frames being written, -1 if none
+    uint32_t next_seq;
+    uint8_t ack[FRAME_ACK_SIZE];
+    size_t ack_got;
+} ClientStream;
+
 /**
  * Creates a TCP socket and connects it to the specified host and port. It returns the socket file
- * descriptor.
+ * descriptor, or -1 if the host does not resolve or no address accepts the connection within
+ * CLIENT_CONNECT_TIMEOUT_MS. Addresses come from the resolver cache and are raced, so one dead
+ * address costs CLIENT_CONNECT_STAGGER_MS rather than a full TCP timeout.
  *
  * Config *config: A filled out Config struct. This function uses the host and port to connect to
  * the server.
@@ -30,12 +174,36 @@ int client_connect(const Config *config);
  */
 void client_send_image(int sockfd, const Config *config);
 
+/**
+ * Send the homework ID followed by the body in a single sendmsg call, without copying them into
+ * one buffer first. Returns 0 once everything is sent, or -1 on failure.
+ *
+ * int sockfd: The socket file descriptor returned by the client_connect function.
+ * const char *hw_id: The homework ID, sent first.
+ * const uint8_t *body: The data to send after the homework ID.
+ * size_t body_size: The size of body in bytes.
+ */
+int client_send_parts(int sockfd, const char *hw_id, const uint8_t *body, size_t body_size);
+
+/**
+ * Send the homework ID followed by the contents of a file. The file goes from the page cache
+ * straight to the socket with sendfile, so it is never read into memory. Returns 0 once
+ * everything is sent, or -1 on failure.
+ *
+ * int sockfd: The socket file descriptor returned by the client_connect function.
+ * const char *hw_id: The homework ID, sent first.
+ * const char *path: The file to send.
+ */
+int client_send_file(int sockfd, const char *hw_id, const char *path);
+
 /**
  * Using the socket receive a response. This function just prints out the response from the server.
+ * Returns the number of bytes received, 0 if the server closed the connection without answering,
+ * or -1 on failure.
  *
  * int sockfd: The socket file descriptor to receive a response from.
  */
-void client_receive_response(int sockfd);
+int client_receive_response(int sockfd);
 
 /**
  * Close the socket.
@@ -44,4 +212,183 @@ void client_receive_response(int sockfd);
  */
 void client_close(int sockfd);
 
+/**
+ * Get a connection to the host and port in config. An idle connection kept by client_pool_put is
+ * reused if it is still healthy, otherwise a new one is made with client_connect. Returns the
+ * socket file descriptor, or -1 on failure.
+ *
+ * Config *config: A filled out Config struct. Only the host and port are used.
+ * bool *reused: Set to true if the connection was already open. Data sent on a reused connection
+ * can fail because the server closed it in the meantime, so it is worth one retry on a new one.
+ */
+int client_pool_get(const Config *config, bool *reused);
+
+/**
+ * Give a connection from client_pool_get back to the pool so the next upload can skip the DNS
+ * lookup and handshake. Connections that are not reusable, or that do not fit, are closed.
+ *
+ * Config *config: The Config struct the connection was made with.
+ * int sockfd: The socket file descriptor.
+ * bool reusable: false if anything went wrong on the connection.
+ */
+void client_pool_put(const Config *config, int sockfd, bool reusable);
+
+/**
+ * Close every idle connection in the pool.
+ */
+void client_pool_close_all();
+
+/**
+ * Start uploading the homework ID followed by a file. Nothing blocks except a DNS lookup that is
+ * not cached yet: the connection is raced on non-blocking sockets, or taken from the connection
+ * pool if config->reuse_connection is set. Returns 0 if the upload is underway, or -1 if it
+ * already failed, in which case up->error says why.
+ *
+ * ClientUpload *up: Where the upload keeps its state. It must stay in place until
+ * client_upload_finish.
+ * Config *config: A filled out Config struct. This function uses the host, port, hw_id and
+ * reuse_connection. The strings must stay valid until client_upload_finish.
+ * const char *path: The file to send.
+ * ClientDeadlines *deadlines: How long each phase may take, or NULL for the CLIENT_*_TIMEOUT_MS
+ * defaults.
+ */
+int client_upload_start(ClientUpload *up, const Config *config, const char *path,
+                        const ClientDeadlines *deadlines);
+
+/**
+ * Fill in the sockets the upload is waiting on and the events it waits for. Returns how many
+ * pollfds were filled in, at most CLIENT_MAX_ATTEMPTS, or 0 once the upload is done.
+ *
+ * ClientUpload *up: An upload from client_upload_start.
+ * struct pollfd *fds: Room for CLIENT_MAX_ATTEMPTS pollfds.
+ */
+int client_upload_pollfds(const ClientUpload *up, struct pollfd *fds);
+
+/**
+ * Milliseconds until the upload next needs to be stepped, when its phase runs out of time or the
+ * next connection attempt is due. For use as a poll timeout. Returns -1 once the upload is done.
+ *
+ * ClientUpload *up: An upload from client_upload_start.
+ */
+int client_upload_timeout(const ClientUpload *up);
+
+/**
+ * Move the upload along as far as it can go without blocking. Returns true once it is done,
+ * successfully or not. A reused pooled connection that turns out to be dead, or never answers
+ * within recv_ms, is replaced with a new one once before the upload counts as failed.
+ *
+ * ClientUpload *up: An upload from client_upload_start.
+ * struct pollfd *fds: The pollfds from client_upload_pollfds, after poll filled in revents.
+ * int nfds: How many pollfds client_upload_pollfds returned.
+ */
+bool client_upload_step(ClientUpload *up, const struct pollfd *fds, int nfds);
+
+/**
+ * Release what the upload holds. With config->reuse_connection, a connection that finished
+ * cleanly goes back to the pool. Can be called before the upload is done to abandon it.
+ *
+ * ClientUpload *up: An upload from client_upload_start.
+ */
+void client_upload_finish(ClientUpload *up);
+
+/**
+ * Upload a file and wait for the server's response, with every phase under its deadline.
+ * Returns CLIENT_OK or why the upload failed.
+ *
+ * Config *config: A filled out Config struct. This function uses the host, port and hw_id.
+ * const char *path: The file to send.
+ * ClientDeadlines *deadlines: How long each phase may take, or NULL for the defaults.
+ */
+ClientError client_upload_file(const Config *config, const char *path,
+                               const ClientDeadlines *deadlines);
+
+/**
+ * Open a stream for framed uploads to the host and port in config. Like client_upload_start, an
+ * idle pooled connection is used if there is one, otherwise connections are raced on non-blocking
+ * sockets. Returns 0 if the stream is open or connecting, or -1 if it already failed, in which
+ * case s->error says why.
+ *
+ * ClientStream *s: Where the stream keeps its state. It must stay in place until
+ * client_stream_close.
+ * Config *config: A filled out Config struct. This function uses the host, port and hw_id. The
+ * strings must stay valid until client_stream_close.
+ * ClientDeadlines *deadlines: connect_ms bounds connecting, send_ms bounds writing each frame and
+ * recv_ms bounds the wait for each ack after its frame is written. NULL for the defaults.
+ */
+int client_stream_open(ClientStream *s, const Config *config, const ClientDeadlines *deadlines);
+
+/**
+ * Queue a file as the next frame. The file is read once here for its checksum and content type,
+ * blocking until it is, then sent straight from the page cache with sendfile. Returns the frame's
+ * seq, or 0 if the file is over FRAME_SEND_MAX bytes or could not be read, the window is full or
+ * the stream has failed.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ * const char *path: The file to send.
+ */
+uint32_t client_stream_push(ClientStream *s, const char *path);
+
+/**
+ * How many more frames client_stream_push will take before the window is full. Returns 0 once the
+ * stream has failed.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ */
+int client_stream_space(const ClientStream *s);
+
+/**
+ * How many frames are queued, being written or waiting for their ack.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ */
+int client_stream_outstanding(const ClientStream *s);
+
+/**
+ * Fill in the sockets the stream is waiting on, like client_upload_pollfds. Returns how many
+ * pollfds were filled in, or 0 once the stream has failed.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ * struct pollfd *fds: Room for CLIENT_MAX_ATTEMPTS pollfds.
+ */
+int client_stream_pollfds(const ClientStream *s, struct pollfd *fds);
+
+/**
+ * Milliseconds until the stream next needs to be stepped for a deadline or a connection attempt.
+ * Returns -1 if nothing is due, including once the stream has failed.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ */
+int client_stream_timeout(const ClientStream *s);
+
+/**
+ * Move the stream along as far as it can go without blocking and collect the frames that ended.
+ * A frame ends when its ack arrives, or with the stream's error if the connection fails. A
+ * connection that breaks is replaced and the frames not acked yet are sent again, but a frame
+ * that a connection already broke on once fails with the error instead. A pooled connection
+ * that was already dead does not count against its frames. A frame whose ack was lost can reach
+ * the server twice. Returns how many ClientAcks were written.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ * struct pollfd *fds: The pollfds from client_stream_pollfds, after poll filled in revents.
+ * int nfds: How many pollfds client_stream_pollfds returned.
+ * ClientAck *acks: Room for CLIENT_STREAM_WINDOW acks.
+ */
+int client_stream_step(ClientStream *s, const struct pollfd *fds, int nfds, ClientAck *acks);
+
+/**
+ * Release what the stream holds. A healthy connection with nothing outstanding goes back to the
+ * pool, where ClientUploads and other streams can pick it up. Frames still outstanding are
+ * abandoned.
+ *
+ * ClientStream *s: A stream from client_stream_open.
+ */
+void client_stream_close(ClientStream *s);
+
+/**
+ * A short description of an error, for logging.
+ *
+ * ClientError error: The error.
+ */
+const char *client_strerror(ClientError error);
+
 #endif
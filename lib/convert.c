@@ -0,0 +1,264 @@
+#include <string.h>
+
+#include "convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#if defined(__SSE2__)
+#define CONVERT_SSE2
+#endif
+#if defined(__GNUC__)
+#define CONVERT_AVX2
+#endif
+#endif
+
+static inline uint16_t to_wire(uint16_t color) { return (uint16_t)((color >> 8) | (color << 8)); }
+
+void convert_bgr888_to_rgb565_scalar(const uint8_t *src, uint16_t *dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t blue = src[i * 3];
+        uint8_t green = src[i * 3 + 1];
+        uint8_t red = src[i * 3 + 2];
+        uint16_t color = ((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3);
+        dst[i] = to_wire(color);
+    }
+}
+
+#if defined(CONVERT_SSE2) || defined(CONVERT_AVX2)
+// Loads four bytes starting at a pixel. The fourth byte belongs to the next pixel, so callers must
+// make sure one more pixel follows.
+static inline int load_pixel(const uint8_t *src) {
+    uint32_t word;
+    memcpy(&word, src, sizeof(word));
+    return (int)word;
+}
+#endif
+
+// The vector kernels hold one pixel per 32-bit lane, loaded little-endian so blue is in the low
+// byte. The RGB() macro then becomes ((bgr >> 8) & 0xF800) | ((bgr >> 5) & 0x07E0) |
+// ((bgr >> 3) & 0x001F).
+
+#ifdef CONVERT_SSE2
+// Converts four pixels held one per 32-bit lane into wire-order RGB565, still one per lane
+static inline __m128i sse2_pack_lanes(__m128i bgr) {
+    __m128i red = _mm_and_si128(_mm_srli_epi32(bgr, 8), _mm_set1_epi32(0xF800));
+    __m128i green = _mm_and_si128(_mm_srli_epi32(bgr, 5), _mm_set1_epi32(0x07E0));
+    __m128i blue = _mm_and_si128(_mm_srli_epi32(bgr, 3), _mm_set1_epi32(0x001F));
+    __m128i color = _mm_or_si128(_mm_or_si128(red, green), blue);
+
+    // Swap the two bytes, then sign extend so _mm_packs_epi32 does not saturate
+    color = _mm_or_si128(_mm_srli_epi32(color, 8), _mm_slli_epi32(color, 8));
+    return _mm_srai_epi32(_mm_slli_epi32(color, 16), 16);
+}
+
+static size_t convert_sse2(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t i = 0;
+    for (; i + 9 <= count; i += 8) {
+        const uint8_t *p = src + i * 3;
+        __m128i lo = _mm_set_epi32(load_pixel(p + 9), load_pixel(p + 6), load_pixel(p + 3),
+                                   load_pixel(p));
+        __m128i hi = _mm_set_epi32(load_pixel(p + 21), load_pixel(p + 18), load_pixel(p + 15),
+                                   load_pixel(p + 12));
+        __m128i packed = _mm_packs_epi32(sse2_pack_lanes(lo), sse2_pack_lanes(hi));
+        _mm_storeu_si128((__m128i *)(dst + i), packed);
+    }
+    return i;
+}
+#endif
+
+#ifdef CONVERT_AVX2
+__attribute__((target("avx2"))) static size_t convert_avx2(const uint8_t *src, uint16_t *dst,
+                                                            size_t count) {
+    // Spreads the four 3-byte pixels at the start of each 128-bit lane out to one per 32-bit lane
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    size_t i = 0;
+
+    // Each 16 byte load reads 4 bytes past the 8 pixels being converted
+    for (; i + 10 <= count; i += 8) {
+        const uint8_t *p = src + i * 3;
+        __m256i bgr = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+            _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+        bgr = _mm256_shuffle_epi8(bgr, spread);
+
+        __m256i red = _mm256_and_si256(_mm256_srli_epi32(bgr, 8), _mm256_set1_epi32(0xF800));
+        __m256i green = _mm256_and_si256(_mm256_srli_epi32(bgr, 5), _mm256_set1_epi32(0x07E0));
+        __m256i blue = _mm256_and_si256(_mm256_srli_epi32(bgr, 3), _mm256_set1_epi32(0x001F));
+        __m256i color = _mm256_or_si256(_mm256_or_si256(red, green), blue);
+        color = _mm256_or_si256(_mm256_srli_epi32(color, 8),
+                                _mm256_and_si256(_mm256_slli_epi32(color, 8),
+                                                 _mm256_set1_epi32(0xFF00)));
+
+        // Every lane fits in 16 bits, so the unsigned pack is exact. It works within each 128-bit
+        // half, so gather the low quadword of both halves afterwards.
+        __m256i packed = _mm256_packus_epi32(color, color);
+        packed = _mm256_permute4x64_epi64(packed, 0x08);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(packed));
+    }
+    return i;
+}
+#endif
+
+#ifdef CONVERT_NEON
+static size_t convert_neon(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // De-interleaves into val[0] = blue, val[1] = green, val[2] = red
+        uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+
+        // Start with red in the top five bits, then shift-insert green and blue below it
+        uint16x8_t lo = vshll_n_u8(vget_low_u8(bgr.val[2]), 8);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(bgr.val[1]), 8), 5);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(bgr.val[0]), 8), 11);
+
+        uint16x8_t hi = vshll_n_u8(vget_high_u8(bgr.val[2]), 8);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(bgr.val[1]), 8), 5);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(bgr.val[0]), 8), 11);
+
+        vst1q_u8((uint8_t *)(dst + i), vrev16q_u8(vreinterpretq_u8_u16(lo)));
+        vst1q_u8((uint8_t *)(dst + i + 8), vrev16q_u8(vreinterpretq_u8_u16(hi)));
+    }
+    return i;
+}
+#endif
+
+void convert_bgr888_to_rgb565(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t done = 0;
+
+#if defined(CONVERT_NEON)
+    done = convert_neon(src, dst, count);
+#else
+#if defined(CONVERT_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        done = convert_avx2(src, dst, count);
+    }
+#endif
+#if defined(CONVERT_SSE2)
+    if (done == 0) {
+        done = convert_sse2(src, dst, count);
+    }
+#endif
+#endif
+
+    // Whatever the vector kernel could not cover
+    convert_bgr888_to_rgb565_scalar(src + done * 3, dst + done, count - done);
+}
+
+#ifdef CONVERT_SSE2
+static void convert_all_sse2(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t done = convert_sse2(src, dst, count);
+    convert_bgr888_to_rgb565_scalar(src + done * 3, dst + done, count - done);
+}
+#endif
+
+#ifdef CONVERT_AVX2
+static void convert_all_avx2(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t done = convert_avx2(src, dst, count);
+    convert_bgr888_to_rgb565_scalar(src + done * 3, dst + done, count - done);
+}
+#endif
+
+#ifdef CONVERT_NEON
+static void convert_all_neon(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t done = convert_neon(src, dst, count);
+    convert_bgr888_to_rgb565_scalar(src + done * 3, dst + done, count - done);
+}
+#endif
+
+int convert_kernels(ConvertKernel *kernels) {
+    int count = 0;
+#if defined(CONVERT_NEON)
+    kernels[count++] = (ConvertKernel){"neon", convert_all_neon};
+#else
+#if defined(CONVERT_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[count++] = (ConvertKernel){"avx2", convert_all_avx2};
+    }
+#endif
+#if defined(CONVERT_SSE2)
+    kernels[count++] = (ConvertKernel){"sse2", convert_all_sse2};
+#endif
+#endif
+    kernels[count++] = (ConvertKernel){"scalar", convert_bgr888_to_rgb565_scalar};
+    return count;
+}
+
+const char *convert_kernel_name() {
+#if defined(CONVERT_NEON)
+    return "neon";
+#else
+#if defined(CONVERT_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+#endif
+#if defined(CONVERT_SSE2)
+    return "sse2";
+#endif
+    return "scalar";
+#endif
+}
+
+static inline uint8_t clamp_channel(int v) { return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v; }
+
+void convert_yuv420_to_bgr888(const uint8_t *src, uint8_t *dst, int width, int height) {
+    const uint8_t *y_plane = src;
+    const uint8_t *u_plane = src + width * height;
+    const uint8_t *v_plane = u_plane + (width / 2) * (height / 2);
+
+    for (int row = 0; row < height; row++) {
+        const uint8_t *y = y_plane + row * width;
+        const uint8_t *u = u_plane + (row / 2) * (width / 2);
+        const uint8_t *v = v_plane + (row / 2) * (width / 2);
+        // BMP rows are stored bottom up
+        uint8_t *out = dst + (size_t)(height - 1 - row) * width * 3;
+
+        for (int col = 0; col < width; col++) {
+            // 8.8 fixed point, rounded
+            int c = 298 * (y[col] - 16) + 128;
+            int d = u[col / 2] - 128;
+            int e = v[col / 2] - 128;
+            out[0] = clamp_channel((c + 516 * d) >> 8);
+            out[1] = clamp_channel((c - 100 * d - 208 * e) >> 8);
+            out[2] = clamp_channel((c + 409 * e) >> 8);
+            out += 3;
+        }
+    }
+}
+
+void convert_bgr888_to_yuv420(const uint8_t *src, uint8_t *dst, int width, int height) {
+    uint8_t *y_plane = dst;
+    uint8_t *u_plane = dst + width * height;
+    uint8_t *v_plane = u_plane + (width / 2) * (height / 2);
+
+    for (int row = 0; row < height; row += 2) {
+        // BMP rows are stored bottom up
+        const uint8_t *in[2] = {
+            src + (size_t)(height - 1 - row) * width * 3,
+            src + (size_t)(height - 2 - row) * width * 3,
+        };
+        uint8_t *u = u_plane + (row / 2) * (width / 2);
+        uint8_t *v = v_plane + (row / 2) * (width / 2);
+
+        for (int col = 0; col < width; col += 2) {
+            int b = 0, g = 0, r = 0;
+            for (int i = 0; i < 2; i++) {
+                for (int j = 0; j < 2; j++) {
+                    const uint8_t *px = in[i] + (col + j) * 3;
+                    y_plane[(row + i) * width + col + j] =
+                        ((66 * px[2] + 129 * px[1] + 25 * px[0] + 128) >> 8) + 16;
+                    b += px[0];
+                    g += px[1];
+                    r += px[2];
+                }
+            }
+            // The sums are four pixels' worth, so the rounding and shift take two more bits
+            u[col / 2] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+            v[col / 2] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+        }
+    }
+}
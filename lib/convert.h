@@ -0,0 +1,98 @@
+#ifndef __CONVERT_H
+#define __CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Most kernels convert_kernels lists
+#define CONVERT_MAX_KERNELS 4
+
+// One implementation of convert_bgr888_to_rgb565
+typedef struct {
+    const char *name;
+    void (*convert)(const uint8_t *src, uint16_t *dst, size_t count);
+} ConvertKernel;
+
+/**
+ * Description:
+ *  Converts BMP pixel data (BGR, one byte per channel) into RGB565 pixels ready to be sent to the
+ *  LCD. The output is in wire order (high byte first), which is the format the framebuffer in
+ *  display.c and LCD_WritePixels expect. Each output pixel is bit for bit the same as passing the
+ *  channels through the RGB() macro in colors.h and swapping the bytes.
+ *
+ *  Uses NEON on ARM, AVX2 or SSE2 on x86 and plain C everywhere else. On 32-bit ARM the NEON
+ *  kernel is only used when the compiler is told the FPU has NEON (-mfpu=neon-vfpv4).
+ *
+ * Arguments:
+ *  src: The BGR pixel data. It must hold count * 3 bytes.
+ *  dst: Where the RGB565 pixels will be written. It must hold count pixels.
+ *  count: The number of pixels to convert.
+ */
+void convert_bgr888_to_rgb565(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * Description:
+ *  Same as convert_bgr888_to_rgb565, but always uses the plain C implementation. This is what the
+ *  vectorized kernels are checked against.
+ *
+ * Arguments:
+ *  src: The BGR pixel data. It must hold count * 3 bytes.
+ *  dst: Where the RGB565 pixels will be written. It must hold count pixels.
+ *  count: The number of pixels to convert.
+ */
+void convert_bgr888_to_rgb565_scalar(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * Description:
+ *  Returns the name of the kernel convert_bgr888_to_rgb565 uses on this machine ("neon", "avx2",
+ *  "sse2" or "scalar").
+ *
+ * Arguments:
+ *  None
+ */
+const char *convert_kernel_name();
+
+/**
+ * Description:
+ *  Lists every RGB565 kernel this machine can run, the one convert_bgr888_to_rgb565 picks first
+ *  and "scalar" last, so each can be checked and timed on its own. Each one converts the whole
+ *  run, finishing what its vector loop leaves with the scalar code, just as
+ *  convert_bgr888_to_rgb565 does.
+ *
+ * Arguments:
+ *  kernels: Room for CONVERT_MAX_KERNELS kernels.
+ *
+ * Return:
+ *  How many were written.
+ */
+int convert_kernels(ConvertKernel *kernels);
+
+/**
+ * Description:
+ *  Converts a raw YUV420 (I420) frame, as libcamera-vid writes it with --codec yuv420, into BMP
+ *  pixel data: BGR, one byte per channel, with the bottom row first. Uses the BT.601 limited range
+ *  coefficients the camera encodes with.
+ *
+ * Arguments:
+ *  src: The full Y plane, then the U and V planes at half the width and height. It must hold
+ *       width * height * 3 / 2 bytes.
+ *  dst: Where the BGR pixel data will be written. It must hold width * height * 3 bytes.
+ *  width: The frame width in pixels. It must be even.
+ *  height: The frame height in pixels. It must be even.
+ */
+void convert_yuv420_to_bgr888(const uint8_t *src, uint8_t *dst, int width, int height);
+
+/**
+ * Description:
+ *  The reverse of convert_yuv420_to_bgr888: turns BMP pixel data, bottom row first, into a YUV420
+ *  (I420) frame. Each U and V sample is the average of the 2x2 pixels it covers.
+ *
+ * Arguments:
+ *  src: The BGR pixel data. It must hold width * height * 3 bytes.
+ *  dst: Where the frame will be written. It must hold width * height * 3 / 2 bytes.
+ *  width: The frame width in pixels. It must be even.
+ *  height: The frame height in pixels. It must be even.
+ */
+void convert_bgr888_to_yuv420(const uint8_t *src, uint8_t *dst, int width, int height);
+
+#endif
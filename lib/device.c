@@ -1,5 +1,37 @@
+#include <stdlib.h>
+
 #include "device.h"
 #include "log.h"
+#include "st7735_emu.h"
+
+// Set DOORBELL_SPI_TRACE to a file name to record every byte sent to the LCD. tools/st7735_trace
+// decodes the recording.
+#define TRACE_ENV "DOORBELL_SPI_TRACE"
+
+static FILE *trace = NULL;
+static uint8_t dc_level = 0;
+
+static void trace_record(uint8_t type, const uint8_t *data, uint32_t len) {
+    uint8_t header[5] = {type, (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16),
+                         (uint8_t)(len >> 24)};
+    fwrite(header, 1, sizeof(header), trace);
+    if (len > 0) {
+        fwrite(data, 1, len, trace);
+    }
+}
+
+static void trace_open(void) {
+    const char *path = getenv(TRACE_ENV);
+    if (!path || !*path) {
+        return;
+    }
+    trace = fopen(path, "wb");
+    if (!trace) {
+        log_error("Failed to open SPI trace %s", path);
+    } else {
+        log_info("Recording SPI trace to %s", path);
+    }
+}
 
 void DEV_GPIO_Init() {
     DEV_GPIO_Mode(LCD_CS, 1);
@@ -24,6 +56,7 @@ uint8_t DEV_ModuleInit(void) {
         printf("bcm2835 init success !!! \r\n");
     }
     DEV_GPIO_Init();
+    trace_open();
 
     // Start SPI
     bcm2835_spi_begin();
@@ -42,6 +75,10 @@ parameter:
 Info:
 ******************************************************************************/
 void DEV_ModuleExit(void) {
+    if (trace) {
+        fclose(trace);
+        trace = NULL;
+    }
     bcm2835_spi_end();
     bcm2835_close();
 }
@@ -54,10 +91,36 @@ void DEV_GPIO_Mode(uint16_t Pin, uint16_t Mode) {
     }
 }
 
-void DEV_Digital_Write(uint16_t Pin, uint8_t Value) { bcm2835_gpio_write(Pin, Value); }
+void DEV_Digital_Write(uint16_t Pin, uint8_t Value) {
+    if (Pin == LCD_DC) {
+        dc_level = Value;
+    }
+    bcm2835_gpio_write(Pin, Value);
+}
 
 uint8_t DEV_Digital_Read(uint16_t Pin) { return bcm2835_gpio_lev(Pin); }
 
-void DEV_SPI_WriteByte(uint8_t Value) { bcm2835_spi_transfer(Value); }
+void DEV_SPI_WriteByte(uint8_t Value) {
+    if (trace) {
+        trace_record(dc_level ? ST7735_TRACE_DATA : ST7735_TRACE_COMMAND, &Value, 1);
+    }
+    bcm2835_spi_transfer(Value);
+}
+
+void DEV_SPI_Write_nByte(const uint8_t *pData, uint32_t Len) {
+    if (trace) {
+        trace_record(dc_level ? ST7735_TRACE_DATA : ST7735_TRACE_COMMAND, pData, Len);
+    }
+    bcm2835_spi_writenb((const char *)pData, Len);
+}
+
+void DEV_Trace_Frame(void) {
+    if (trace) {
+        trace_record(ST7735_TRACE_FRAME, NULL, 0);
+    }
+#ifdef BCM2835_SIM
+    bcm2835_sim_frame();
+#endif
+}
 
 void delay_ms(unsigned int ms) { bcm2835_delay(ms); }
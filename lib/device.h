@@ -22,5 +22,9 @@ void DEV_Digital_Write(uint16_t Pin, uint8_t Value);
 uint8_t DEV_Digital_Read(uint16_t Pin);
 
 void DEV_SPI_WriteByte(uint8_t value);
+void DEV_SPI_Write_nByte(const uint8_t *pData, uint32_t Len);
+
+// Marks the end of a frame in the SPI trace, if one is being recorded, and in the simulator
+void DEV_Trace_Frame(void);
 
 #endif
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "colors.h"
+#include "convert.h"
 #include "device.h"
 #include "display.h"
 #include "lcd.h"
@@ -48,6 +49,174 @@ typedef struct {
 LCD_DIS sLCD_DIS;
 static bool initialized = false;
 
+// The most rectangles display_flush will track before merging them together
+#define DIRTY_RECT_MAX 8
+
+// Converts an RGB565 color into the byte order the ST7735 expects on the wire (high byte first)
+#define WIRE_COLOR(color) ((uint16_t)(((color) >> 8) | ((color) << 8)))
+
+typedef struct {
+    int32_t x_start; // Inclusive
+    int32_t y_start; // Inclusive
+    int32_t x_end;   // Exclusive
+    int32_t y_end;   // Exclusive
+} dirty_rect;
+
+// Off-screen copy of the panel. Every display_* call draws in here and display_flush pushes the
+// changed regions out to the LCD. Pixels are stored in wire order so rows can be sent as is.
+static uint16_t framebuffer[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+static dirty_rect dirty_rects[DIRTY_RECT_MAX];
+static int dirty_count = 0;
+
+// Rendered glyphs are kept so drawing a character is a block copy instead of walking the font
+// bitmap. The cache is GLYPH_CACHE_SIZE entries split into sets of GLYPH_CACHE_WAYS, each entry
+// holding up to one MAX_WIDTH_FONT x MAX_HEIGHT_FONT glyph. Build with -DGLYPH_CACHE_SIZE=0 to
+// turn it off.
+#ifndef GLYPH_CACHE_SIZE
+#define GLYPH_CACHE_SIZE 128
+#endif
+#define GLYPH_CACHE_WAYS 4
+
+#if GLYPH_CACHE_SIZE > 0
+#if GLYPH_CACHE_SIZE % GLYPH_CACHE_WAYS != 0
+#error "GLYPH_CACHE_SIZE must be a multiple of GLYPH_CACHE_WAYS"
+#endif
+
+typedef struct {
+    const sFONT *font;
+    char character;
+    uint16_t background_color;
+    uint16_t foreground_color;
+    uint32_t last_used; // 0 if the slot is empty
+    uint16_t pixels[MAX_HEIGHT_FONT * MAX_WIDTH_FONT];
+} cached_glyph;
+
+static cached_glyph glyph_cache[GLYPH_CACHE_SIZE];
+static uint32_t glyph_clock = 0;
+#endif
+
+static int32_t rect_area(const dirty_rect *rect) {
+    return (rect->x_end - rect->x_start) * (rect->y_end - rect->y_start);
+}
+
+static dirty_rect rect_union(const dirty_rect *a, const dirty_rect *b) {
+    dirty_rect result = {
+        .x_start = a->x_start < b->x_start ? a->x_start : b->x_start,
+        .y_start = a->y_start < b->y_start ? a->y_start : b->y_start,
+        .x_end = a->x_end > b->x_end ? a->x_end : b->x_end,
+        .y_end = a->y_end > b->y_end ? a->y_end : b->y_end,
+    };
+    return result;
+}
+
+// Rectangles that overlap or share an edge are cheaper to send as one window
+static bool rect_touches(const dirty_rect *a, const dirty_rect *b) {
+    return a->x_start <= b->x_end && b->x_start <= a->x_end && a->y_start <= b->y_end &&
+           b->y_start <= a->y_end;
+}
+
+static void mark_dirty(int32_t x_start, int32_t y_start, int32_t x_end, int32_t y_end) {
+    dirty_rect rect = {x_start, y_start, x_end, y_end};
+
+    // Clip to the screen
+    if (rect.x_start < 0) {
+        rect.x_start = 0;
+    }
+    if (rect.y_start < 0) {
+        rect.y_start = 0;
+    }
+    if (rect.x_end > DISPLAY_WIDTH) {
+        rect.x_end = DISPLAY_WIDTH;
+    }
+    if (rect.y_end > DISPLAY_HEIGHT) {
+        rect.y_end = DISPLAY_HEIGHT;
+    }
+    if (rect.x_start >= rect.x_end || rect.y_start >= rect.y_end) {
+        return;
+    }
+
+    // Fold the new rectangle into any it touches. Growing a rectangle can make it touch one it
+    // did not before, so keep going until nothing changes.
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < dirty_count; i++) {
+            if (rect_touches(&rect, &dirty_rects[i])) {
+                rect = rect_union(&rect, &dirty_rects[i]);
+                dirty_rects[i] = dirty_rects[--dirty_count];
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    // Out of slots, so merge with whichever rectangle grows the least
+    if (dirty_count == DIRTY_RECT_MAX) {
+        int best = 0;
+        int32_t best_growth = INT32_MAX;
+        for (int i = 0; i < dirty_count; i++) {
+            dirty_rect joined = rect_union(&rect, &dirty_rects[i]);
+            int32_t growth = rect_area(&joined) - rect_area(&dirty_rects[i]);
+            if (growth < best_growth) {
+                best_growth = growth;
+                best = i;
+            }
+        }
+        rect = rect_union(&rect, &dirty_rects[best]);
+        dirty_rects[best] = dirty_rects[--dirty_count];
+    }
+
+    dirty_rects[dirty_count++] = rect;
+}
+
+// Fills [x_start, x_end) x [y_start, y_end) in the framebuffer, clipping to the screen
+static void fb_fill_rect(int32_t x_start, int32_t y_start, int32_t x_end, int32_t y_end,
+                         uint16_t color) {
+    if (x_start < 0) {
+        x_start = 0;
+    }
+    if (y_start < 0) {
+        y_start = 0;
+    }
+    if (x_end > DISPLAY_WIDTH) {
+        x_end = DISPLAY_WIDTH;
+    }
+    if (y_end > DISPLAY_HEIGHT) {
+        y_end = DISPLAY_HEIGHT;
+    }
+    if (x_start >= x_end || y_start >= y_end) {
+        return;
+    }
+
+    uint16_t pixel = WIRE_COLOR(color);
+    for (int32_t y = y_start; y < y_end; y++) {
+        for (int32_t x = x_start; x < x_end; x++) {
+            framebuffer[y][x] = pixel;
+        }
+    }
+    mark_dirty(x_start, y_start, x_end, y_end);
+}
+
+// Copies a width x height block of wire-order pixels into the framebuffer, clipping to the screen
+static void fb_blit(int32_t x_start, int32_t y_start, const uint16_t *pixels, int32_t width,
+                    int32_t height) {
+    int32_t skip_x = x_start < 0 ? -x_start : 0;
+    int32_t skip_y = y_start < 0 ? -y_start : 0;
+    int32_t x_end = x_start + width > DISPLAY_WIDTH ? DISPLAY_WIDTH : x_start + width;
+    int32_t y_end = y_start + height > DISPLAY_HEIGHT ? DISPLAY_HEIGHT : y_start + height;
+    int32_t copy = x_end - (x_start + skip_x);
+
+    if (copy <= 0 || y_start + skip_y >= y_end) {
+        return;
+    }
+
+    for (int32_t y = y_start + skip_y; y < y_end; y++) {
+        memcpy(&framebuffer[y][x_start + skip_x], &pixels[(y - y_start) * width + skip_x],
+               copy * sizeof(uint16_t));
+    }
+    mark_dirty(x_start + skip_x, y_start + skip_y, x_end, y_end);
+}
+
 void display_init() {
     initialized = true;
     lcd_init();
@@ -60,18 +229,71 @@ void display_exit() {
     }
 }
 
-void display_clear(uint16_t color) { LCD_SetArealColor(0, 0, LCD_WIDTH, LCD_HEIGHT, color); }
-
-void DEV_SPI_Write_nByte(char *pData, uint32_t Len) {
-    char rData[Len];
-    bcm2835_spi_transfernb(pData, rData, Len);
+void display_flush() {
+    for (int i = 0; i < dirty_count; i++) {
+        const dirty_rect *rect = &dirty_rects[i];
+        uint32_t width = rect->x_end - rect->x_start;
+
+        LCD_BeginPixels(rect->x_start, rect->y_start, rect->x_end, rect->y_end);
+        if (width == DISPLAY_WIDTH) {
+            // Full rows are contiguous in the framebuffer, so send them all at once
+            LCD_WritePixels(&framebuffer[rect->y_start][0],
+                            width * (rect->y_end - rect->y_start));
+        } else {
+            for (int32_t y = rect->y_start; y < rect->y_end; y++) {
+                LCD_WritePixels(&framebuffer[y][rect->x_start], width);
+            }
+        }
+        LCD_EndPixels();
+    }
+    if (dirty_count > 0) {
+        DEV_Trace_Frame();
+    }
+    dirty_count = 0;
 }
 
-void swap(uint16_t Point1, uint16_t Point2) {
+void display_clear(uint16_t color) { fb_fill_rect(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, color); }
+
+static void swap(uint16_t *Point1, uint16_t *Point2) {
     uint16_t Temp;
-    Temp = Point1;
-    Point1 = Point2;
-    Point2 = Temp;
+    Temp = *Point1;
+    *Point1 = *Point2;
+    *Point2 = Temp;
+}
+
+// Horizontal runs of pixels, one per screen row, that are filled together once a shape is done.
+// Rows that nothing touched have left > right.
+typedef struct {
+    int32_t left[DISPLAY_HEIGHT];
+    int32_t right[DISPLAY_HEIGHT];
+} span_set;
+
+static void spans_init(span_set *spans) {
+    for (int32_t row = 0; row < DISPLAY_HEIGHT; row++) {
+        spans->left[row] = INT32_MAX;
+        spans->right[row] = INT32_MIN;
+    }
+}
+
+// Widens the span on row y to cover x_left through x_right (inclusive)
+static void spans_add(span_set *spans, int32_t y, int32_t x_left, int32_t x_right) {
+    if (y < 0 || y >= DISPLAY_HEIGHT) {
+        return;
+    }
+    if (x_left < spans->left[y]) {
+        spans->left[y] = x_left;
+    }
+    if (x_right > spans->right[y]) {
+        spans->right[y] = x_right;
+    }
+}
+
+static void spans_fill(const span_set *spans, uint16_t color) {
+    for (int32_t row = 0; row < DISPLAY_HEIGHT; row++) {
+        if (spans->left[row] <= spans->right[row]) {
+            fb_fill_rect(spans->left[row], row, spans->right[row] + 1, row + 1, color);
+        }
+    }
 }
 
 void display_draw_point(uint16_t x_point, uint16_t y_point, uint16_t color, uint8_t dot_weight) {
@@ -79,34 +301,103 @@ void display_draw_point(uint16_t x_point, uint16_t y_point, uint16_t color, uint
         return;
     }
 
-    uint16_t XDir_Num, YDir_Num;
-    for (XDir_Num = 0; XDir_Num < 2 * dot_weight - 1; XDir_Num++) {
-        for (YDir_Num = 0; YDir_Num < 2 * dot_weight - 1; YDir_Num++) {
-            LCD_SetPointlColor(x_point + XDir_Num - dot_weight, y_point + YDir_Num - dot_weight,
-                               color);
+    // A point covers a (2 * dot_weight - 1) square starting dot_weight pixels up and to the left
+    fb_fill_rect((int32_t)x_point - dot_weight, (int32_t)y_point - dot_weight,
+                 (int32_t)x_point + dot_weight - 1, (int32_t)y_point + dot_weight - 1, color);
+}
+
+#define OUT_LEFT 1
+#define OUT_RIGHT 2
+#define OUT_TOP 4
+#define OUT_BOTTOM 8
+
+static int outcode(int32_t x, int32_t y, int32_t x_min, int32_t y_min, int32_t x_max,
+                   int32_t y_max) {
+    int code = 0;
+    if (x < x_min) {
+        code |= OUT_LEFT;
+    } else if (x > x_max) {
+        code |= OUT_RIGHT;
+    }
+    if (y < y_min) {
+        code |= OUT_TOP;
+    } else if (y > y_max) {
+        code |= OUT_BOTTOM;
+    }
+    return code;
+}
+
+// Cohen-Sutherland clipping of a line to [x_min, x_max] x [y_min, y_max]. Returns false if no part
+// of the line is inside.
+static bool clip_line(int32_t *x_start, int32_t *y_start, int32_t *x_end, int32_t *y_end,
+                      int32_t x_min, int32_t y_min, int32_t x_max, int32_t y_max) {
+    int code_start = outcode(*x_start, *y_start, x_min, y_min, x_max, y_max);
+    int code_end = outcode(*x_end, *y_end, x_min, y_min, x_max, y_max);
+
+    while (code_start | code_end) {
+        if (code_start & code_end) {
+            return false;
+        }
+
+        // Move whichever endpoint is outside onto the edge it is past
+        int code = code_start ? code_start : code_end;
+        int64_t dx = (int64_t)*x_end - *x_start;
+        int64_t dy = (int64_t)*y_end - *y_start;
+        int32_t x, y;
+        if (code & OUT_TOP) {
+            y = y_min;
+            x = *x_start + (int32_t)(dx * (y_min - *y_start) / dy);
+        } else if (code & OUT_BOTTOM) {
+            y = y_max;
+            x = *x_start + (int32_t)(dx * (y_max - *y_start) / dy);
+        } else if (code & OUT_LEFT) {
+            x = x_min;
+            y = *y_start + (int32_t)(dy * (x_min - *x_start) / dx);
+        } else {
+            x = x_max;
+            y = *y_start + (int32_t)(dy * (x_max - *x_start) / dx);
+        }
+
+        if (code == code_start) {
+            *x_start = x;
+            *y_start = y;
+            code_start = outcode(x, y, x_min, y_min, x_max, y_max);
+        } else {
+            *x_end = x;
+            *y_end = y;
+            code_end = outcode(x, y, x_min, y_min, x_max, y_max);
         }
     }
+    return true;
 }
 
-void display_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
-                       uint16_t color, uint8_t line_weight) {
+// Draws a line between two points that may be off the screen. Every point on the line is a
+// (2 * line_weight - 1) square placed like display_draw_point, and the squares are collected into
+// one span per row before anything is filled.
+static void draw_line(int32_t x_start, int32_t y_start, int32_t x_end, int32_t y_end,
+                      uint16_t color, uint8_t line_weight) {
+    int32_t weight = line_weight > 0 ? line_weight : 1;
 
-    if (x_start > sLCD_DIS.LCD_Dis_Column || y_start > sLCD_DIS.LCD_Dis_Page ||
-        x_end > sLCD_DIS.LCD_Dis_Column || y_end > sLCD_DIS.LCD_Dis_Page) {
+    // Points this far past the screen can still color pixels on it
+    if (!clip_line(&x_start, &y_start, &x_end, &y_end, -weight, -weight, DISPLAY_WIDTH + weight,
+                   DISPLAY_HEIGHT + weight)) {
         return;
     }
 
-    if (x_start > x_end) {
-        swap(x_start, x_end);
-    }
-    if (y_start > y_end) {
-        swap(y_start, y_end);
+    // Horizontal and vertical lines are a single rectangle
+    if (y_start == y_end || x_start == x_end) {
+        int32_t left = x_start < x_end ? x_start : x_end;
+        int32_t right = x_start < x_end ? x_end : x_start;
+        int32_t top = y_start < y_end ? y_start : y_end;
+        int32_t bottom = y_start < y_end ? y_end : y_start;
+        fb_fill_rect(left - weight, top - weight, right + weight - 1, bottom + weight - 1, color);
+        return;
     }
 
-    uint16_t x_point = x_start;
-    uint16_t y_point = y_start;
-    int32_t dx = (int32_t)x_end - (int32_t)x_start >= 0 ? x_end - x_start : x_start - x_end;
-    int32_t dy = (int32_t)y_end - (int32_t)y_start <= 0 ? y_end - y_start : y_start - y_end;
+    int32_t x_point = x_start;
+    int32_t y_point = y_start;
+    int32_t dx = x_end >= x_start ? x_end - x_start : x_start - x_end;
+    int32_t dy = y_end <= y_start ? y_end - y_start : y_start - y_end;
 
     // Increment direction, 1 is positive, -1 is counter;
     int32_t XAddway = x_start < x_end ? 1 : -1;
@@ -115,8 +406,13 @@ void display_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint1
     // Cumulative error
     int32_t Esp = dx + dy;
 
+    span_set spans;
+    spans_init(&spans);
+
     for (;;) {
-        display_draw_point(x_point, y_point, color, line_weight);
+        for (int32_t row = y_point - weight; row <= y_point + weight - 2; row++) {
+            spans_add(&spans, row, x_point - weight, x_point + weight - 2);
+        }
 
         if (2 * Esp >= dy) {
             if (x_point == x_end) {
@@ -133,6 +429,101 @@ void display_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint1
             y_point += YAddway;
         }
     }
+
+    spans_fill(&spans, color);
+}
+
+void display_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
+                       uint16_t color, uint8_t line_weight) {
+    // Coordinates are read as signed so a line can start or end off the screen
+    draw_line((int16_t)x_start, (int16_t)y_start, (int16_t)x_end, (int16_t)y_end, color,
+              line_weight);
+}
+
+void display_draw_polyline(const DisplayPoint *points, int num_points, uint16_t color,
+                           uint8_t line_weight) {
+    for (int i = 0; i + 1 < num_points; i++) {
+        draw_line(points[i].x, points[i].y, points[i + 1].x, points[i + 1].y, color, line_weight);
+    }
+}
+
+static int64_t ceil_div(int64_t num, int64_t den) {
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    return num >= 0 ? (num + den - 1) / den : -(-num / den);
+}
+
+// Fills the inside of a polygon one scanline at a time using the even-odd rule. Points are pixel
+// centers, so each row is sampled at its own y and gets the pixels whose x falls inside a pair of
+// crossings. The result is placed like display_draw_point.
+static void fill_polygon(const DisplayPoint *points, int num_points, uint16_t color) {
+    int32_t crossings[num_points];
+    int32_t y_min = INT32_MAX;
+    int32_t y_max = INT32_MIN;
+
+    for (int i = 0; i < num_points; i++) {
+        if (points[i].y < y_min) {
+            y_min = points[i].y;
+        }
+        if (points[i].y > y_max) {
+            y_max = points[i].y;
+        }
+    }
+
+    // Only rows that land on the screen once shifted by one
+    if (y_min < 1) {
+        y_min = 1;
+    }
+    if (y_max > DISPLAY_HEIGHT) {
+        y_max = DISPLAY_HEIGHT;
+    }
+
+    for (int32_t y = y_min; y <= y_max; y++) {
+        int count = 0;
+
+        for (int i = 0; i < num_points; i++) {
+            const DisplayPoint *a = &points[i];
+            const DisplayPoint *b = &points[(i + 1) % num_points];
+            if ((a->y <= y && b->y > y) || (b->y <= y && a->y > y)) {
+                // The first pixel at or right of the crossing
+                int64_t num = (int64_t)a->x * (b->y - a->y) + (int64_t)(b->x - a->x) * (y - a->y);
+                crossings[count++] = (int32_t)ceil_div(num, b->y - a->y);
+            }
+        }
+
+        // Insertion sort, polygons here only have a handful of edges
+        for (int i = 1; i < count; i++) {
+            int32_t value = crossings[i];
+            int j = i - 1;
+            while (j >= 0 && crossings[j] > value) {
+                crossings[j + 1] = crossings[j];
+                j--;
+            }
+            crossings[j + 1] = value;
+        }
+
+        for (int i = 0; i + 1 < count; i += 2) {
+            fb_fill_rect(crossings[i] - 1, y - 1, crossings[i + 1] - 1, y, color);
+        }
+    }
+}
+
+void display_draw_polygon(const DisplayPoint *points, int num_points, uint16_t color, bool filled,
+                          uint8_t line_weight) {
+    if (num_points < 2) {
+        return;
+    }
+
+    if (filled) {
+        fill_polygon(points, num_points, color);
+        line_weight = 1;
+    }
+
+    display_draw_polyline(points, num_points, color, line_weight);
+    draw_line(points[num_points - 1].x, points[num_points - 1].y, points[0].x, points[0].y, color,
+              line_weight);
 }
 
 void display_draw_rectangle(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
@@ -144,17 +535,16 @@ void display_draw_rectangle(uint16_t x_start, uint16_t y_start, uint16_t x_end,
     // printf("sLCD_DIS.LCD_Dis_Column = %d\r\n",sLCD_DIS.LCD_Dis_Column);
     // printf("sLCD_DIS.LCD_Dis_Page = %d\r\n",sLCD_DIS.LCD_Dis_Page);
     if (x_start > x_end) {
-        swap(x_start, x_end);
+        swap(&x_start, &x_end);
     }
     if (y_start > y_end) {
-        swap(y_start, y_end);
+        swap(&y_start, &y_end);
     }
 
-    uint16_t y_point;
     if (filled) {
-        for (y_point = y_start; y_point < y_end; y_point++) {
-            display_draw_line(x_start, y_point, x_end, y_point, color, 1);
-        }
+        // One fill covering the rows y_start up to (not including) y_end, placed the same way a
+        // 1 pixel line would be
+        fb_fill_rect((int32_t)x_start - 1, (int32_t)y_start - 1, x_end, (int32_t)y_end - 1, color);
     } else {
         display_draw_line(x_start, y_start, x_end, y_start, color, line_weight);
         display_draw_line(x_start, y_start, x_start, y_end, color, line_weight);
@@ -163,6 +553,41 @@ void display_draw_rectangle(uint16_t x_start, uint16_t y_start, uint16_t x_end,
     }
 }
 
+// Fills a disk as a set of horizontal spans, one per row. The midpoint walk is the same one the
+// outline uses; each step widens the spans of the rows it touches in all eight octants.
+static void fill_circle(int32_t x_center, int32_t y_center, int32_t radius, uint16_t color) {
+    span_set spans;
+    spans_init(&spans);
+
+    int32_t XCurrent = 0;
+    int32_t YCurrent = radius;
+    int32_t Esp = 3 - (radius << 1);
+
+    while (XCurrent <= YCurrent) {
+        // Rows XCurrent away from the center reach out YCurrent pixels and rows YCurrent away
+        // reach out XCurrent pixels. Everything is offset by one to match display_draw_point.
+        int32_t left = x_center - YCurrent - 1;
+        int32_t right = x_center + YCurrent - 1;
+        spans_add(&spans, y_center + XCurrent - 1, left, right);
+        spans_add(&spans, y_center - XCurrent - 1, left, right);
+
+        left = x_center - XCurrent - 1;
+        right = x_center + XCurrent - 1;
+        spans_add(&spans, y_center + YCurrent - 1, left, right);
+        spans_add(&spans, y_center - YCurrent - 1, left, right);
+
+        if (Esp < 0) {
+            Esp += 4 * XCurrent + 6;
+        } else {
+            Esp += 10 + 4 * (XCurrent - YCurrent);
+            YCurrent--;
+        }
+        XCurrent++;
+    }
+
+    spans_fill(&spans, color);
+}
+
 void display_draw_circle(uint16_t x_center, uint16_t y_center, uint16_t radius, uint16_t color,
                          bool filled, uint8_t line_weight) {
     if (x_center > sLCD_DIS.LCD_Dis_Column || y_center >= sLCD_DIS.LCD_Dis_Page) {
@@ -177,27 +602,8 @@ void display_draw_circle(uint16_t x_center, uint16_t y_center, uint16_t radius,
     // Cumulative error,judge the next point of the logo
     int16_t Esp = 3 - (radius << 1);
 
-    int16_t sCountY;
     if (filled) {
-        while (XCurrent <= YCurrent) { // Realistic circles
-            for (sCountY = XCurrent; sCountY <= YCurrent; sCountY++) {
-                display_draw_point(x_center + XCurrent, y_center + sCountY, color, 1); // 1
-                display_draw_point(x_center - XCurrent, y_center + sCountY, color, 1); // 2
-                display_draw_point(x_center - sCountY, y_center + XCurrent, color, 1); // 3
-                display_draw_point(x_center - sCountY, y_center - XCurrent, color, 1); // 4
-                display_draw_point(x_center - XCurrent, y_center - sCountY, color, 1); // 5
-                display_draw_point(x_center + XCurrent, y_center - sCountY, color, 1); // 6
-                display_draw_point(x_center + sCountY, y_center - XCurrent, color, 1); // 7
-                display_draw_point(x_center + sCountY, y_center + XCurrent, color, 1);
-            }
-            if (Esp < 0) {
-                Esp += 4 * XCurrent + 6;
-            } else {
-                Esp += 10 + 4 * (XCurrent - YCurrent);
-                YCurrent--;
-            }
-            XCurrent++;
-        }
+        fill_circle(x_center, y_center, radius, color);
     } else { // Draw a hollow circle
         while (XCurrent <= YCurrent) {
             display_draw_point(x_center + XCurrent, y_center + YCurrent, color, line_weight); // 1
@@ -220,13 +626,14 @@ void display_draw_circle(uint16_t x_center, uint16_t y_center, uint16_t radius,
     }
 }
 
-void display_draw_char(uint16_t x_point, uint16_t y_point, const char character, sFONT *font,
-                       uint16_t background_color, uint16_t foreground_color) {
-    uint16_t Page, Column;
+// Draws a glyph as a 1x1 display_draw_point would, one pixel up and to the left of the given point
+#define GLYPH_OFFSET 1
 
-    if (x_point >= sLCD_DIS.LCD_Dis_Column || y_point >= sLCD_DIS.LCD_Dis_Page) {
-        return;
-    }
+static void render_glyph(uint16_t *pixels, const char character, const sFONT *font,
+                         uint16_t background_color, uint16_t foreground_color) {
+    uint16_t Page, Column;
+    uint16_t foreground = WIRE_COLOR(foreground_color);
+    uint16_t background = WIRE_COLOR(background_color);
 
     uint32_t Char_Offset =
         (character - ' ') * font->Height * (font->Width / 8 + (font->Width % 8 ? 1 : 0));
@@ -234,12 +641,7 @@ void display_draw_char(uint16_t x_point, uint16_t y_point, const char character,
 
     for (Page = 0; Page < font->Height; Page++) {
         for (Column = 0; Column < font->Width; Column++) {
-
-            if (*ptr & (0x80 >> (Column % 8))) {
-                display_draw_point(x_point + Column, y_point + Page, foreground_color, 1);
-            } else {
-                display_draw_point(x_point + Column, y_point + Page, background_color, 1);
-            }
+            *pixels++ = (*ptr & (0x80 >> (Column % 8))) ? foreground : background;
 
             // One pixel is 8 bits
             if (Column % 8 == 7) {
@@ -252,6 +654,65 @@ void display_draw_char(uint16_t x_point, uint16_t y_point, const char character,
     } /* Write all */
 }
 
+#if GLYPH_CACHE_SIZE > 0
+static uint32_t glyph_hash(const char character, const sFONT *font, uint16_t background_color,
+                           uint16_t foreground_color) {
+    uint32_t hash = (uint32_t)(uintptr_t)font * 2654435761u;
+    hash ^= (uint8_t)character * 40503u;
+    hash ^= ((uint32_t)foreground_color << 16 | background_color) * 2246822519u;
+    return hash ^ (hash >> 15);
+}
+
+// Returns the pixels for a glyph, rendering it into the least recently used slot of its set if it
+// is not cached yet
+static const uint16_t *lookup_glyph(const char character, const sFONT *font,
+                                    uint16_t background_color, uint16_t foreground_color) {
+    uint32_t set = glyph_hash(character, font, background_color, foreground_color) %
+                   (GLYPH_CACHE_SIZE / GLYPH_CACHE_WAYS);
+    cached_glyph *slots = &glyph_cache[set * GLYPH_CACHE_WAYS];
+    cached_glyph *victim = &slots[0];
+
+    glyph_clock++;
+    for (int i = 0; i < GLYPH_CACHE_WAYS; i++) {
+        cached_glyph *glyph = &slots[i];
+        if (glyph->last_used != 0 && glyph->font == font && glyph->character == character &&
+            glyph->background_color == background_color &&
+            glyph->foreground_color == foreground_color) {
+            glyph->last_used = glyph_clock;
+            return glyph->pixels;
+        }
+        if (glyph->last_used < victim->last_used) {
+            victim = glyph;
+        }
+    }
+
+    render_glyph(victim->pixels, character, font, background_color, foreground_color);
+    victim->font = font;
+    victim->character = character;
+    victim->background_color = background_color;
+    victim->foreground_color = foreground_color;
+    victim->last_used = glyph_clock;
+    return victim->pixels;
+}
+#endif
+
+void display_draw_char(uint16_t x_point, uint16_t y_point, const char character, sFONT *font,
+                       uint16_t background_color, uint16_t foreground_color) {
+    if (x_point >= sLCD_DIS.LCD_Dis_Column || y_point >= sLCD_DIS.LCD_Dis_Page) {
+        return;
+    }
+
+#if GLYPH_CACHE_SIZE > 0
+    const uint16_t *pixels = lookup_glyph(character, font, background_color, foreground_color);
+#else
+    uint16_t pixels[MAX_HEIGHT_FONT * MAX_WIDTH_FONT];
+    render_glyph(pixels, character, font, background_color, foreground_color);
+#endif
+
+    fb_blit((int32_t)x_point - GLYPH_OFFSET, (int32_t)y_point - GLYPH_OFFSET, pixels, font->Width,
+            font->Height);
+}
+
 void display_draw_string(uint16_t x_start, uint16_t y_start, const char *str, sFONT *font,
                          uint16_t background_color, uint16_t foreground_color) {
 
@@ -348,6 +809,8 @@ void display_demo(void) {
     display_draw_char(start + spacing * 2, 115, 'E', &Font16, WHITE, BYU_ORANGE);
     display_draw_char(start + spacing * 3, 115, 'n', &Font16, WHITE, BYU_GREEN);
     display_draw_number(start + spacing * 5, 115, 224, &Font16, WHITE, BYU_ROYAL);
+
+    display_flush();
 }
 
 uint8_t display_draw_image(char *file_path) {
@@ -402,19 +865,43 @@ uint8_t display_draw_image(char *file_path) {
     // Just to image part of file
     fseek(fp, header.offset, SEEK_SET);
 
-    LCD_SetWindows(0, 0, sLCD_DIS.LCD_Dis_Column, sLCD_DIS.LCD_Dis_Page);
+    // Pixels fill the screen in order, the same way they would stream into a full-screen window
+    uint16_t *pixel = &framebuffer[0][0];
+    uint16_t *pixel_end = pixel + DISPLAY_WIDTH * DISPLAY_HEIGHT;
+    uint8_t *row_data = malloc(info.width * len);
+    if (row_data == NULL) {
+        fclose(fp);
+        return 1;
+    }
+
     for (row = 0; row < info.height; row++) {
-        for (col = 0; col < info.width; col++) {
-            if (fread((char *)&rgb, 1, len, fp) != len) {
-                perror("get bmpdata:\r\n");
-                return -1;
-                break;
+        if (fread(row_data, len, info.width, fp) != info.width) {
+            perror("get bmpdata:\r\n");
+            free(row_data);
+            fclose(fp);
+            mark_dirty(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+            return -1;
+        }
+
+        uint32_t count = info.width;
+        if (count > (uint32_t)(pixel_end - pixel)) {
+            count = pixel_end - pixel;
+        }
+
+        if (len == 3) {
+            convert_bgr888_to_rgb565(row_data, pixel, count);
+        } else {
+            for (col = 0; col < count; col++) {
+                memcpy(&rgb, row_data + col * len, sizeof(rgb) < len ? sizeof(rgb) : len);
+                data = RGB((rgb.rgbRed), (rgb.rgbGreen), (rgb.rgbBlue));
+                pixel[col] = WIRE_COLOR((uint16_t)data);
             }
-            data = RGB((rgb.rgbRed), (rgb.rgbGreen), (rgb.rgbBlue));
-            LCD_SetColor(data, 1, 1);
         }
+        pixel += count;
     }
+    free(row_data);
     fclose(fp);
+    mark_dirty(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
     return 0;
 }
 
@@ -425,15 +912,13 @@ uint8_t display_draw_image_data(const uint8_t *data, int width, int height) {
         height *= -1;
     }
 
-    LCD_SetWindows(0, 0, sLCD_DIS.LCD_Dis_Column, sLCD_DIS.LCD_Dis_Page);
-    for (long i = 0; i < height * width; i++) {
-        uint8_t blue = data[i * 3];
-        uint8_t green = data[i * 3 + 1];
-        uint8_t red = data[i * 3 + 2];
-        short pixel = RGB(red, green, blue);
-
-        LCD_SetColor(pixel, 1, 1);
+    // Pixels fill the screen in order, the same way they would stream into a full-screen window
+    long count = (long)height * width;
+    if (count > DISPLAY_WIDTH * DISPLAY_HEIGHT) {
+        count = DISPLAY_WIDTH * DISPLAY_HEIGHT;
     }
+    convert_bgr888_to_rgb565(data, &framebuffer[0][0], count);
+    mark_dirty(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
 
     return 0;
 }
@@ -9,6 +9,12 @@
 #define DISPLAY_WIDTH 128
 #define DISPLAY_HEIGHT DISPLAY_WIDTH
 
+// A point for the polyline and polygon functions. Coordinates may be off the screen.
+typedef struct {
+    int16_t x;
+    int16_t y;
+} DisplayPoint;
+
 /**
  * Description:
  *  Sets up display. Should be called before any display_* functions are called.
@@ -27,6 +33,17 @@ void display_init();
  */
 void display_exit();
 
+/**
+ * Description:
+ *  Sends everything drawn since the last flush to the screen. All of the display_draw_* functions
+ *  (and display_clear) draw into an off-screen framebuffer, so nothing shows up until this is
+ *  called. Only the regions that changed are sent.
+ *
+ * Arguments:
+ *  None
+ */
+void display_flush();
+
 /**
  * Description:
  *  Clears the screen with one color.
@@ -60,7 +77,9 @@ void display_draw_point(uint16_t x_point, uint16_t y_point, uint16_t color, uint
 
 /**
  * Description:
- *  Draws a line. The line can be various weights.
+ *  Draws a line. The line can be various weights. Lines that run off the screen are clipped to it,
+ *  and coordinates past 32767 are treated as negative so a line can start above or left of the
+ *  screen.
  *
  * Arguments:
  *  x_start: The start x-coordinate of the line.
@@ -73,6 +92,36 @@ void display_draw_point(uint16_t x_point, uint16_t y_point, uint16_t color, uint
 void display_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
                        uint16_t color, uint8_t line_weight);
 
+/**
+ * Description:
+ *  Draws connected lines through a list of points. The last point is not joined back to the first;
+ *  use display_draw_polygon for that.
+ *
+ * Arguments:
+ *  points: The points to connect, in order.
+ *  num_points: The number of points.
+ *  color: The color of the lines.
+ *  line_weight: The thickness of the lines.
+ */
+void display_draw_polyline(const DisplayPoint *points, int num_points, uint16_t color,
+                           uint8_t line_weight);
+
+/**
+ * Description:
+ *  Draws a closed polygon. The polygon can be filled in, in which case points inside are found
+ *  with the even-odd rule. A self-intersecting shape, like a five point star drawn point to point,
+ *  leaves its middle empty.
+ *
+ * Arguments:
+ *  points: The corners of the polygon, in order.
+ *  num_points: The number of corners.
+ *  color: The color of the polygon.
+ *  filled: Whether the polygon should be filled in or not.
+ *  line_weight: The thickness of the outline. Ignored when filled is true.
+ */
+void display_draw_polygon(const DisplayPoint *points, int num_points, uint16_t color, bool filled,
+                          uint8_t line_weight);
+
 /**
  * Description:
  *  Draws a rectangle. The rectangle's line can be various weights and the recetangle can be filled
@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "log.h"
+
+// Handlers called per wakeup at most. Anything else ready is picked up on the next one.
+#define EVLOOP_BATCH 8
+
+typedef enum {
+    SOURCE_FD,
+    SOURCE_TIMER,
+    SOURCE_EVENT,
+    SOURCE_WATCH,
+} source_type;
+
+typedef struct {
+    int fd; // -1 if the slot is free
+    source_type type;
+    EvloopHandler handler;
+    void *arg;
+} source;
+
+static source sources[EVLOOP_MAX_SOURCES];
+static int epoll_fd = -1;
+static int stop_fd = -1;
+static volatile bool stopping = false;
+
+static source *find_source(int fd) {
+    for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+        if (sources[i].fd == fd) {
+            return &sources[i];
+        }
+    }
+    return NULL;
+}
+
+static int add_source(int fd, source_type type, EvloopHandler handler, void *arg) {
+    source *slot = find_source(-1);
+    if (!slot) {
+        log_error("Event loop is full (%d sources)", EVLOOP_MAX_SOURCES);
+        return -1;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = slot};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        log_error("Failed to watch fd %d: %s", fd, strerror(errno));
+        return -1;
+    }
+    slot->fd = fd;
+    slot->type = type;
+    slot->handler = handler;
+    slot->arg = arg;
+    return 0;
+}
+
+// Adds a file descriptor the loop created itself, closing it if it cannot be added
+static int add_owned_source(int fd, source_type type, EvloopHandler handler, void *arg) {
+    if (fd < 0) {
+        log_error("Failed to create an event loop source: %s", strerror(errno));
+        return -1;
+    }
+    if (add_source(fd, type, handler, arg) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int evloop_init() {
+    for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+        sources[i].fd = -1;
+    }
+    stopping = false;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || stop_fd < 0) {
+        log_error("Failed to create the event loop: %s", strerror(errno));
+        evloop_exit();
+        return -1;
+    }
+
+    // The stop event has no slot, so it is recognised by its NULL pointer
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) != 0) {
+        evloop_exit();
+        return -1;
+    }
+    return 0;
+}
+
+void evloop_exit() {
+    for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+        if (sources[i].fd >= 0) {
+            evloop_remove(sources[i].fd);
+        }
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+int evloop_add(int fd, EvloopHandler handler, void *arg) {
+    return add_source(fd, SOURCE_FD, handler, arg);
+}
+
+void evloop_remove(int fd) {
+    source *slot = find_source(fd);
+    if (!slot || fd < 0) {
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    if (slot->type != SOURCE_FD) {
+        close(fd);
+    }
+    slot->fd = -1;
+}
+
+int evloop_add_timer(EvloopHandler handler, void *arg) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return add_owned_source(fd, SOURCE_TIMER, handler, arg);
+}
+
+void evloop_set_timer(int fd, unsigned int ms) {
+    struct itimerspec spec = {
+        .it_value = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000},
+    };
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+        log_error("Failed to set timer %d: %s", fd, strerror(errno));
+    }
+}
+
+int evloop_add_event(EvloopHandler handler, void *arg) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return add_owned_source(fd, SOURCE_EVENT, handler, arg);
+}
+
+void evloop_notify(int fd, uint64_t value) {
+    if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+        log_error("Failed to notify event %d", fd);
+    }
+}
+
+int evloop_add_watch(const char *path, EvloopHandler handler, void *arg) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, path,
+                                     IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                         IN_CLOSE_WRITE) < 0) {
+        log_error("Failed to watch %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return add_owned_source(fd, SOURCE_WATCH, handler, arg);
+}
+
+// Reads what a loop-owned source has to say. Returns false if there was nothing to read.
+static bool drain(const source *slot, uint64_t *count) {
+    if (slot->type == SOURCE_FD) {
+        *count = 0;
+        return true;
+    }
+    if (slot->type != SOURCE_WATCH) {
+        // Timers and eventfds both hand back a single 8 byte counter
+        return read(slot->fd, count, sizeof(*count)) == sizeof(*count);
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    *count = 0;
+    while ((len = read(slot->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(*event) + event->len;
+            (*count)++;
+        }
+    }
+    return *count > 0;
+}
+
+int evloop_run() {
+    struct epoll_event ready[EVLOOP_BATCH];
+
+    while (!stopping) {
+        int n = epoll_wait(epoll_fd, ready, EVLOOP_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Event loop wait failed: %s", strerror(errno));
+            return -1;
+        }
+
+        for (int i = 0; i < n && !stopping; i++) {
+            source *slot = ready[i].data.ptr;
+            uint64_t count;
+            // A handler earlier in this batch may have removed the source
+            if (!slot || slot->fd < 0 || !drain(slot, &count)) {
+                continue;
+            }
+            slot->handler(slot->fd, count, slot->arg);
+        }
+    }
+    return 0;
+}
+
+void evloop_stop() {
+    stopping = true;
+    if (stop_fd >= 0) {
+        // If this fails the loop still sees stopping on its next wakeup
+        uint64_t one = 1;
+        ssize_t written = write(stop_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
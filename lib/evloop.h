@@ -0,0 +1,149 @@
+#ifndef __EVLOOP_H
+#define __EVLOOP_H
+
+#include <stdint.h>
+
+// Most file descriptors the loop can watch at once
+#define EVLOOP_MAX_SOURCES 16
+
+/*
+ * Called from evloop_run when a source is ready.
+ *
+ * fd: The source's file descriptor.
+ * count: For timers, how many times the timer expired. For events, the sum of the values passed
+ *        to evloop_notify. For watches, how many inotify events arrived. 0 for plain fds, which
+ *        the handler has to read itself.
+ * arg: The arg the source was added with.
+ */
+typedef void (*EvloopHandler)(int fd, uint64_t count, void *arg);
+
+/**
+ * Description:
+ *  Creates the event loop. Call this before adding any sources.
+ *
+ * Arguments:
+ *  None
+ *
+ * Return:
+ *  0 on success, -1 on failure.
+ */
+int evloop_init();
+
+/**
+ * Description:
+ *  Closes every timer, event and watch the loop created, then the loop itself. Plain fds added
+ *  with evloop_add are left open.
+ *
+ * Arguments:
+ *  None
+ */
+void evloop_exit();
+
+/**
+ * Description:
+ *  Calls handler whenever fd is readable.
+ *
+ * Arguments:
+ *  fd: The file descriptor to watch.
+ *  handler: Called when fd is readable. It must read from fd, or it will be called again.
+ *  arg: Passed to handler.
+ *
+ * Return:
+ *  0 on success, -1 on failure.
+ */
+int evloop_add(int fd, EvloopHandler handler, void *arg);
+
+/**
+ * Description:
+ *  Stops watching a file descriptor. Sources created by the loop are closed as well.
+ *
+ * Arguments:
+ *  fd: The file descriptor.
+ */
+void evloop_remove(int fd);
+
+/**
+ * Description:
+ *  Creates a one-shot timer (a timerfd). It does nothing until started with evloop_set_timer.
+ *
+ * Arguments:
+ *  handler: Called when the timer expires.
+ *  arg: Passed to handler.
+ *
+ * Return:
+ *  The timer's file descriptor, or -1 on failure.
+ */
+int evloop_add_timer(EvloopHandler handler, void *arg);
+
+/**
+ * Description:
+ *  Starts or restarts a timer. A timer that is already running is pushed back.
+ *
+ * Arguments:
+ *  fd: A timer from evloop_add_timer.
+ *  ms: Milliseconds until the timer expires. 0 stops the timer.
+ */
+void evloop_set_timer(int fd, unsigned int ms);
+
+/**
+ * Description:
+ *  Creates an event (an eventfd) that other threads can use to wake the loop with
+ *  evloop_notify.
+ *
+ * Arguments:
+ *  handler: Called on the loop's thread after the event is notified.
+ *  arg: Passed to handler.
+ *
+ * Return:
+ *  The event's file descriptor, or -1 on failure.
+ */
+int evloop_add_event(EvloopHandler handler, void *arg);
+
+/**
+ * Description:
+ *  Wakes the loop and has it call the event's handler. Safe to call from any thread.
+ *  Notifications that arrive before the handler runs are added together.
+ *
+ * Arguments:
+ *  fd: An event from evloop_add_event.
+ *  value: Added to the count the handler receives. Must not be 0.
+ */
+void evloop_notify(int fd, uint64_t value);
+
+/**
+ * Description:
+ *  Watches a directory for files being added, removed, renamed or rewritten (using inotify).
+ *
+ * Arguments:
+ *  path: The directory.
+ *  handler: Called once for every batch of changes.
+ *  arg: Passed to handler.
+ *
+ * Return:
+ *  The watch's file descriptor, or -1 on failure.
+ */
+int evloop_add_watch(const char *path, EvloopHandler handler, void *arg);
+
+/**
+ * Description:
+ *  Sleeps until sources are ready and calls their handlers, until evloop_stop is called.
+ *
+ * Arguments:
+ *  None
+ *
+ * Return:
+ *  0 when stopped with evloop_stop, -1 if waiting failed.
+ */
+int evloop_run();
+
+/**
+ * Description:
+ *  Makes evloop_run return after the handler it is running, if any. Safe to call from any
+ *  thread and from signal handlers.
+ *
+ * Arguments:
+ *  None
+ */
+void evloop_stop();
+
+#endif
@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "frame.h"
+
+// Slicing-by-8: crc_table[k][b] is the CRC of byte b followed by k zero bytes, so eight bytes are
+// folded in per step instead of one
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc_table[k - 1][i];
+            crc_table[k][i] = crc_table[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+}
+
+static void put_u16(uint8_t *out, uint16_t v) {
+    out[0] = v >> 8;
+    out[1] = v;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+    return (uint16_t)(in[0] << 8 | in[1]);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return (uint32_t)in[0] << 24 | in[1] << 16 | in[2] << 8 | in[3];
+}
+
+void frame_encode_header(const FrameHeader *header, uint8_t *out) {
+    memset(out, 0, FRAME_HEADER_SIZE);
+    put_u32(out, FRAME_MAGIC);
+    put_u32(out + 4, header->seq);
+    put_u32(out + 8, header->length);
+    put_u16(out + 12, header->content_type);
+    put_u32(out + 16, header->timestamp_ms >> 32);
+    put_u32(out + 20, header->timestamp_ms);
+    put_u32(out + 24, header->crc32);
+    memcpy(out + 28, header->hw_id, strnlen(header->hw_id, FRAME_HW_ID_MAX));
+}
+
+int frame_decode_header(const uint8_t *in, FrameHeader *header) {
+    if (!frame_is_magic(in)) {
+        return -1;
+    }
+    header->seq = get_u32(in + 4);
+    header->length = get_u32(in + 8);
+    header->content_type = get_u16(in + 12);
+    header->timestamp_ms = (uint64_t)get_u32(in + 16) << 32 | get_u32(in + 20);
+    header->crc32 = get_u32(in + 24);
+    memcpy(header->hw_id, in + 28, FRAME_HW_ID_MAX);
+    header->hw_id[FRAME_HW_ID_MAX] = '\0';
+    return 0;
+}
+
+void frame_encode_ack(const FrameAck *ack, uint8_t *out) {
+    put_u32(out, FRAME_MAGIC);
+    put_u32(out + 4, ack->seq);
+    put_u16(out + 8, ack->status);
+    put_u16(out + 10, 0);
+}
+
+int frame_decode_ack(const uint8_t *in, FrameAck *ack) {
+    if (!frame_is_magic(in)) {
+        return -1;
+    }
+    ack->seq = get_u32(in + 4);
+    ack->status = get_u16(in + 8);
+    return 0;
+}
+
+bool frame_is_magic(const uint8_t *in) {
+    return get_u32(in) == FRAME_MAGIC;
+}
+
+uint32_t frame_crc32(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, build_crc_table);
+
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len >= 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
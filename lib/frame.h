@@ -0,0 +1,138 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire format of the framed upload protocol. Every field is big-endian.
+//
+// Frame header, followed by length bytes of payload:
+//   0  magic         u32  FRAME_MAGIC
+//   4  seq           u32  Chosen by the sender, echoed in the ack
+//   8  length        u32  Payload bytes that follow the header
+//   12 content_type  u16  FrameContent
+//   14 reserved      u16  0
+//   16 timestamp_ms  u64  When the payload was made, milliseconds since the Unix epoch
+//   24 crc32         u32  CRC-32 (IEEE) of the payload
+//   28 hw_id         16   Homework ID, zero padded
+//
+// Ack, sent back for every frame:
+//   0  magic         u32  FRAME_MAGIC
+//   4  seq           u32  The frame's seq
+//   8  status        u16  FrameStatus
+//   10 reserved      u16  0
+//
+// A legacy message starts with the homework ID itself, so a server can tell the two apart by the
+// first four bytes and take both on the same connection.
+
+#define FRAME_MAGIC 0x44424631 // "DBF1"
+#define FRAME_HEADER_SIZE 44
+#define FRAME_ACK_SIZE 12
+#define FRAME_HW_ID_MAX 16
+
+// Largest payload a frame may carry
+#define FRAME_MAX_LENGTH (16 * 1024 * 1024)
+
+// Largest payload lib/client puts in a frame. The checksum goes in the header, so the sender
+// reads the whole payload before any of it goes out, and lib/client does that with blocking reads
+// on the thread that runs every other upload. This bounds that stall to a few milliseconds, at
+// the cost of larger files not being sent framed at all. A doorbell picture is far smaller.
+#define FRAME_SEND_MAX (1024 * 1024)
+
+typedef enum {
+    FRAME_CONTENT_BINARY,
+    FRAME_CONTENT_BMP,
+    FRAME_CONTENT_TEXT,
+} FrameContent;
+
+typedef enum {
+    FRAME_STATUS_OK,
+    FRAME_STATUS_BAD_CRC,   // The payload did not match its checksum
+    FRAME_STATUS_TOO_LARGE, // length was over the server's limit
+} FrameStatus;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t length;
+    uint16_t content_type;
+    uint64_t timestamp_ms;
+    uint32_t crc32;
+    char hw_id[FRAME_HW_ID_MAX + 1]; // Always null terminated
+} FrameHeader;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t status;
+} FrameAck;
+
+/**
+ * Description:
+ *  Writes a frame header in wire format. hw_id is cut off at FRAME_HW_ID_MAX bytes.
+ *
+ * Arguments:
+ *  header: The header to write.
+ *  out: FRAME_HEADER_SIZE bytes.
+ */
+void frame_encode_header(const FrameHeader *header, uint8_t *out);
+
+/**
+ * Description:
+ *  Reads a frame header in wire format.
+ *
+ * Arguments:
+ *  in: FRAME_HEADER_SIZE bytes.
+ *  header: Where the fields are written.
+ *
+ * Return:
+ *  0 on success, -1 if the bytes do not start with FRAME_MAGIC.
+ */
+int frame_decode_header(const uint8_t *in, FrameHeader *header);
+
+/**
+ * Description:
+ *  Writes an ack in wire format.
+ *
+ * Arguments:
+ *  ack: The ack to write.
+ *  out: FRAME_ACK_SIZE bytes.
+ */
+void frame_encode_ack(const FrameAck *ack, uint8_t *out);
+
+/**
+ * Description:
+ *  Reads an ack in wire format.
+ *
+ * Arguments:
+ *  in: FRAME_ACK_SIZE bytes.
+ *  ack: Where the fields are written.
+ *
+ * Return:
+ *  0 on success, -1 if the bytes do not start with FRAME_MAGIC.
+ */
+int frame_decode_ack(const uint8_t *in, FrameAck *ack);
+
+/**
+ * Description:
+ *  Returns true if the bytes start with FRAME_MAGIC.
+ *
+ * Arguments:
+ *  in: At least 4 bytes.
+ */
+bool frame_is_magic(const uint8_t *in);
+
+/**
+ * Description:
+ *  Continues a CRC-32 (IEEE 802.3, as used by zlib) over more data. Start with crc 0.
+ *
+ * Arguments:
+ *  crc: The CRC of the data so far.
+ *  data: The next bytes.
+ *  len: The number of bytes.
+ *
+ * Return:
+ *  The CRC of everything so far.
+ */
+uint32_t frame_crc32(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "log.h"
+
+// BCM2835_SIM comes from lib/sim/bcm2835.h, pulled in by input.h
+#ifndef BCM2835_SIM
+#include <linux/gpio.h>
+#endif
+
+#define INPUT_GPIOCHIP "/dev/gpiochip0"
+
+// Line events read from the GPIO character device at a time
+#define LINE_EVENT_BATCH 16
+
+typedef struct {
+    bool pressed;          // Debounced state
+    uint64_t settle_until; // Edges are ignored until then, 0 when settled
+    uint64_t pressed_at;   // When the current press started
+    uint64_t next_repeat;  // When the next INPUT_REPEAT is due
+    bool long_press_sent;  // INPUT_LONG_PRESS has been reported for the current press
+} key_state;
+
+static key_state keys[BUTTON_COUNT];
+static ButtonScanner scanner;
+
+static InputEvent queue[INPUT_QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_count = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t input_thread;
+static bool running = false;
+static int line_fd = -1;  // GPIO line request, -1 when sampling
+static int event_fd = -1; // Counts queued events
+static int stop_fd = -1;  // Written by input_exit to wake the input thread
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t held_mask(void) {
+    uint8_t mask = 0;
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        if (keys[i].pressed) {
+            mask |= BUTTON_MASK(i);
+        }
+    }
+    return mask;
+}
+
+static void push_event(Button button, InputEventType type, uint64_t timestamp_us) {
+    InputEvent event = {
+        .button = button,
+        .type = type,
+        .timestamp_us = timestamp_us,
+        .held = held_mask(),
+    };
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_count == INPUT_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue_lock);
+        log_warn("Input queue full, dropping an event");
+        return;
+    }
+    queue[(queue_head + queue_count) % INPUT_QUEUE_SIZE] = event;
+    queue_count++;
+    pthread_mutex_unlock(&queue_lock);
+
+    uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) != sizeof(one)) {
+        log_error("Failed to signal an input event");
+    }
+}
+
+// Moves a button to a new debounced state and reports it
+static void commit(Button button, bool pressed, uint64_t timestamp_us) {
+    key_state *key = &keys[button];
+
+    key->pressed = pressed;
+    key->settle_until = timestamp_us + INPUT_DEBOUNCE_MS * 1000;
+    if (pressed) {
+        key->pressed_at = timestamp_us;
+        key->long_press_sent = false;
+    }
+    push_event(button, pressed ? INPUT_PRESS : INPUT_RELEASE, timestamp_us);
+}
+
+static void handle_edge(Button button, bool pressed, uint64_t timestamp_us) {
+    const key_state *key = &keys[button];
+
+    // Bounces land here. The level is checked again once the button settles.
+    if (key->settle_until != 0 || pressed == key->pressed) {
+        return;
+    }
+    commit(button, pressed, timestamp_us);
+}
+
+static void handle_timers(uint64_t now) {
+    // Read lazily, most calls have no button settling
+    int held = -1;
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        key_state *key = &keys[i];
+
+        if (key->settle_until != 0 && now >= key->settle_until) {
+            key->settle_until = 0;
+            if (held < 0) {
+                held = buttons_read_all();
+            }
+            // The contacts may have settled the other way, for example on a very short tap
+            bool pressed = (held & BUTTON_MASK(i)) != 0;
+            if (pressed != key->pressed) {
+                commit(i, pressed, now);
+            }
+        }
+
+        if (!key->pressed) {
+            continue;
+        }
+        if (!key->long_press_sent && now >= key->pressed_at + INPUT_LONG_PRESS_MS * 1000) {
+            key->long_press_sent = true;
+            key->next_repeat = key->pressed_at + (INPUT_LONG_PRESS_MS + INPUT_REPEAT_MS) * 1000;
+            push_event(i, INPUT_LONG_PRESS, now);
+        } else if (key->long_press_sent && now >= key->next_repeat) {
+            key->next_repeat += INPUT_REPEAT_MS * 1000;
+            // Skip repeats the thread slept through instead of sending them all at once
+            if (key->next_repeat <= now) {
+                key->next_repeat = now + INPUT_REPEAT_MS * 1000;
+            }
+            push_event(i, INPUT_REPEAT, now);
+        }
+    }
+}
+
+// Milliseconds until the next debounce or hold timer is due, or -1 if none are running
+static int next_timeout(uint64_t now) {
+    uint64_t deadline = UINT64_MAX;
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        const key_state *key = &keys[i];
+        if (key->settle_until != 0 && key->settle_until < deadline) {
+            deadline = key->settle_until;
+        }
+        if (key->pressed) {
+            uint64_t hold = key->long_press_sent ? key->next_repeat
+                                                 : key->pressed_at + INPUT_LONG_PRESS_MS * 1000;
+            if (hold < deadline) {
+                deadline = hold;
+            }
+        }
+    }
+
+    if (deadline == UINT64_MAX) {
+        return -1;
+    }
+    if (deadline <= now) {
+        return 0;
+    }
+    // Round up so the timer has expired when poll returns
+    return (int)((deadline - now + 999) / 1000);
+}
+
+#ifndef BCM2835_SIM
+static int request_lines(void) {
+    int chip = open(INPUT_GPIOCHIP, O_RDONLY | O_CLOEXEC);
+    if (chip < 0) {
+        return -1;
+    }
+
+    struct gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        request.offsets[i] = button_pin(i);
+    }
+    request.num_lines = BUTTON_COUNT;
+    request.event_buffer_size = LINE_EVENT_BATCH * BUTTON_COUNT;
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+                           GPIO_V2_LINE_FLAG_EDGE_FALLING | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    strncpy(request.consumer, "doorbell", sizeof(request.consumer) - 1);
+
+    int result = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request);
+    close(chip);
+    if (result < 0) {
+        return -1;
+    }
+    return request.fd;
+}
+
+static void read_line_events(void) {
+    struct gpio_v2_line_event events[LINE_EVENT_BATCH];
+    ssize_t len = read(line_fd, events, sizeof(events));
+    if (len <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < (size_t)len / sizeof(events[0]); i++) {
+        for (int b = 0; b < BUTTON_COUNT; b++) {
+            if (events[i].offset == button_pin(b)) {
+                // The buttons pull the line low
+                bool pressed = events[i].id == GPIO_V2_LINE_EVENT_FALLING_EDGE;
+                handle_edge(b, pressed, events[i].timestamp_ns / 1000);
+                break;
+            }
+        }
+    }
+}
+#else
+// The simulator has no GPIO character device, so it is always sampled
+static int request_lines(void) { return -1; }
+
+static void read_line_events(void) {}
+#endif
+
+static void *input_loop(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        int timeout = next_timeout(now_us());
+        if (line_fd < 0 && (timeout < 0 || timeout > INPUT_POLL_MS)) {
+            timeout = INPUT_POLL_MS;
+        }
+
+        struct pollfd fds[2] = {
+            {.fd = stop_fd, .events = POLLIN},
+            {.fd = line_fd, .events = POLLIN},
+        };
+        int ready = poll(fds, line_fd < 0 ? 1 : 2, timeout);
+        if (ready < 0 && errno != EINTR) {
+            log_error("Input poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+
+        if (line_fd >= 0) {
+            if (fds[1].revents & POLLIN) {
+                read_line_events();
+            }
+        } else {
+            uint64_t now = now_us();
+            uint8_t pressed;
+            uint8_t released;
+            buttons_scan(&scanner, &pressed, &released);
+            for (int i = 0; i < BUTTON_COUNT; i++) {
+                if ((pressed | released) & BUTTON_MASK(i)) {
+                    handle_edge(i, (pressed & BUTTON_MASK(i)) != 0, now);
+                }
+            }
+        }
+        handle_timers(now_us());
+    }
+    return NULL;
+}
+
+int input_init() {
+    if (running) {
+        return 0;
+    }
+
+    memset(keys, 0, sizeof(keys));
+    buttons_scanner_init(&scanner);
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        keys[i].pressed = (scanner.held & BUTTON_MASK(i)) != 0;
+        keys[i].pressed_at = now_us();
+        // Something already held at startup does not count as a long press or repeat
+        keys[i].long_press_sent = keys[i].pressed;
+        keys[i].next_repeat = UINT64_MAX;
+    }
+    queue_head = 0;
+    queue_count = 0;
+
+    event_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (event_fd < 0 || stop_fd < 0) {
+        log_error("Failed to create input eventfds: %s", strerror(errno));
+        input_exit();
+        return -1;
+    }
+
+    line_fd = request_lines();
+    if (line_fd < 0) {
+        log_info("GPIO line events unavailable, sampling buttons every %d ms", INPUT_POLL_MS);
+    }
+
+    if (pthread_create(&input_thread, NULL, input_loop, NULL) != 0) {
+        log_error("Failed to start the input thread");
+        input_exit();
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void input_exit() {
+    if (running) {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(input_thread, NULL);
+        }
+        running = false;
+    }
+
+    if (line_fd >= 0) {
+        close(line_fd);
+        line_fd = -1;
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+        event_fd = -1;
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+}
+
+bool input_next(InputEvent *event, int timeout_ms) {
+    if (event_fd < 0) {
+        return false;
+    }
+
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) != sizeof(count)) {
+        if (errno != EAGAIN && errno != EINTR) {
+            return false;
+        }
+        if (errno == EAGAIN) {
+            struct pollfd fd = {.fd = event_fd, .events = POLLIN};
+            int ready = poll(&fd, 1, timeout_ms);
+            if (ready == 0) {
+                return false;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    *event = queue[queue_head];
+    queue_head = (queue_head + 1) % INPUT_QUEUE_SIZE;
+    queue_count--;
+    pthread_mutex_unlock(&queue_lock);
+    return true;
+}
+
+int input_fd() { return event_fd; }
+
+bool input_edge_triggered() { return line_fd >= 0; }
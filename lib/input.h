@@ -0,0 +1,96 @@
+#ifndef __INPUT_H
+#define __INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buttons.h"
+
+// A press is reported on the first edge, then further edges on that button are ignored for this
+// long while the contacts settle
+#define INPUT_DEBOUNCE_MS 8
+
+// How long a button has to be held before INPUT_LONG_PRESS is reported
+#define INPUT_LONG_PRESS_MS 500
+
+// How often INPUT_REPEAT is reported while a button stays held after a long press
+#define INPUT_REPEAT_MS 120
+
+// How often the buttons are sampled when edge events are not available
+#define INPUT_POLL_MS 2
+
+// How many events can be waiting. When it is full new events are dropped.
+#define INPUT_QUEUE_SIZE 64
+
+typedef enum {
+    INPUT_PRESS,
+    INPUT_RELEASE,
+    INPUT_LONG_PRESS,
+    INPUT_REPEAT,
+} InputEventType;
+
+typedef struct {
+    Button button;
+    InputEventType type;
+    uint64_t timestamp_us; // CLOCK_MONOTONIC time of the edge (or timer) that caused the event
+    uint8_t held;          // Buttons held after this event, bit (1 << Button) per button
+} InputEvent;
+
+/**
+ * Description:
+ *  Starts watching the buttons. buttons_init must be called first.
+ *
+ *  Edges come from the GPIO character device (/dev/gpiochip0), so the input thread sleeps until
+ *  a button changes. If the lines cannot be requested the buttons are sampled every
+ *  INPUT_POLL_MS instead.
+ *
+ * Arguments:
+ *  None
+ *
+ * Return:
+ *  0 on success, -1 if the input thread could not be started.
+ */
+int input_init();
+
+/**
+ * Description:
+ *  Stops watching the buttons and drops any events still queued.
+ *
+ * Arguments:
+ *  None
+ */
+void input_exit();
+
+/**
+ * Description:
+ *  Takes the oldest queued event.
+ *
+ * Arguments:
+ *  event: Where the event is written.
+ *  timeout_ms: How long to wait for an event. 0 returns right away and -1 waits forever.
+ *
+ * Return:
+ *  true if an event was taken, false if the wait timed out.
+ */
+bool input_next(InputEvent *event, int timeout_ms);
+
+/**
+ * Description:
+ *  Returns a file descriptor that is readable while events are queued, for use with poll or
+ *  epoll. Do not read from it, call input_next instead.
+ *
+ * Arguments:
+ *  None
+ */
+int input_fd();
+
+/**
+ * Description:
+ *  Returns whether INPUT_PRESS events come from edge interrupts (true) or from sampling (false).
+ *
+ * Arguments:
+ *  None
+ */
+bool input_edge_triggered();
+
+#endif
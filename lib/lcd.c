@@ -1,8 +1,16 @@
+#include <string.h>
+
 #include "lcd.h"
 #include "device.h"
 
+// Size of the buffer used to batch pixel data into bulk SPI transfers
+#define LCD_STAGING_SIZE 4096
+
 extern LCD_DIS sLCD_DIS;
 
+static uint8_t staging[LCD_STAGING_SIZE];
+static uint32_t staged = 0;
+
 static void LCD_WriteReg(uint8_t Reg) {
     DEV_Digital_Write(LCD_DC, 0);
     DEV_SPI_WriteByte(Reg);
@@ -13,12 +21,28 @@ static void LCD_WriteData_8Bit(uint8_t Data) {
     DEV_SPI_WriteByte(Data);
 }
 
+static void LCD_FlushStaging(void) {
+    if (staged > 0) {
+        DEV_SPI_Write_nByte(staging, staged);
+        staged = 0;
+    }
+}
+
 static void LCD_WriteData_NLen16Bit(uint16_t Data, uint32_t DataLen) {
     uint32_t i;
+    LCD_FlushStaging();
     DEV_Digital_Write(LCD_DC, 1);
-    for (i = 0; i < DataLen; i++) {
-        DEV_SPI_WriteByte((uint8_t)(Data >> 8));
-        DEV_SPI_WriteByte((uint8_t)(Data & 0XFF));
+
+    // Every chunk is the same color, so the staging buffer only needs to be filled once
+    uint32_t chunk = DataLen < LCD_STAGING_SIZE / 2 ? DataLen : LCD_STAGING_SIZE / 2;
+    for (i = 0; i < chunk; i++) {
+        staging[2 * i] = (uint8_t)(Data >> 8);
+        staging[2 * i + 1] = (uint8_t)(Data & 0XFF);
+    }
+    while (DataLen > 0) {
+        uint32_t len = DataLen < chunk ? DataLen : chunk;
+        DEV_SPI_Write_nByte(staging, len * 2);
+        DataLen -= len;
     }
 }
 
@@ -264,11 +288,69 @@ parameter:
 void LCD_SetArealColor(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
                        uint16_t color) {
     if ((x_end > x_start) && (y_end > y_start)) {
-        LCD_SetWindows(x_start, y_start, x_end, y_end);
-        LCD_SetColor(color, x_end - x_start, y_end - y_start);
+        LCD_BeginPixels(x_start, y_start, x_end, y_end);
+        LCD_FillPixels(color, (uint32_t)(x_end - x_start) * (uint32_t)(y_end - y_start));
+        LCD_EndPixels();
+    }
+}
+
+/********************************************************************************
+function:	Open a window and get ready to stream pixels into it
+parameter:
+        x_start :   Start point x coordinate
+        y_start :   Start point y coordinate
+        x_end   :   End point coordinates
+        y_end   :   End point coordinates
+********************************************************************************/
+void LCD_BeginPixels(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end) {
+    LCD_SetWindows(x_start, y_start, x_end, y_end);
+    DEV_Digital_Write(LCD_DC, 1);
+    staged = 0;
+}
+
+/********************************************************************************
+function:	Stream a run of pixels into the window opened by LCD_BeginPixels. Short runs
+            are batched in the staging buffer, long runs go straight to the SPI bus.
+parameter:
+        pixels :   RGB565 pixels, already in wire order (high byte first)
+        len    :   Number of pixels
+********************************************************************************/
+void LCD_WritePixels(const uint16_t *pixels, uint32_t len) {
+    const uint8_t *data = (const uint8_t *)pixels;
+    uint32_t bytes = len * 2;
+
+    if (staged == 0 && bytes >= LCD_STAGING_SIZE) {
+        DEV_SPI_Write_nByte(data, bytes);
+        return;
+    }
+
+    while (bytes > 0) {
+        uint32_t room = LCD_STAGING_SIZE - staged;
+        uint32_t n = bytes < room ? bytes : room;
+        memcpy(staging + staged, data, n);
+        staged += n;
+        data += n;
+        bytes -= n;
+        if (staged == LCD_STAGING_SIZE) {
+            LCD_FlushStaging();
+        }
     }
 }
 
+/********************************************************************************
+function:	Stream len pixels of a single color into the window opened by
+            LCD_BeginPixels
+parameter:
+        color  :   RGB565 color
+        len    :   Number of pixels
+********************************************************************************/
+void LCD_FillPixels(uint16_t color, uint32_t len) { LCD_WriteData_NLen16Bit(color, len); }
+
+/********************************************************************************
+function:	Finish a pixel stream, sending anything still in the staging buffer
+********************************************************************************/
+void LCD_EndPixels(void) { LCD_FlushStaging(); }
+
 void lcd_init() {
     if (DEV_ModuleInit()) {
         exit(0);
@@ -42,6 +42,12 @@ void LCD_SetPointlColor(uint16_t x_point, uint16_t y_point, uint16_t color);
 void LCD_SetArealColor(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
                        uint16_t color);
 
+// LCD pixel streaming. Pixels passed to LCD_WritePixels are RGB565 in wire order (high byte first)
+void LCD_BeginPixels(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end);
+void LCD_WritePixels(const uint16_t *pixels, uint32_t len);
+void LCD_FillPixels(uint16_t color, uint32_t len);
+void LCD_EndPixels(void);
+
 void lcd_init();
 
 #endif
@@ -0,0 +1,327 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "display.h"
+#include "log.h"
+#include "render.h"
+
+#if RENDER_QUEUE_SIZE & (RENDER_QUEUE_SIZE - 1)
+#error "RENDER_QUEUE_SIZE must be a power of two"
+#endif
+
+typedef enum {
+    RENDER_CLEAR,
+    RENDER_LINE,
+    RENDER_RECTANGLE,
+    RENDER_STRING,
+    RENDER_IMAGE,
+    RENDER_PRESENT,
+    RENDER_SYNC,
+} render_op;
+
+typedef struct {
+    render_op op;
+    uint16_t x_start;
+    uint16_t y_start;
+    uint16_t x_end;
+    uint16_t y_end;
+    uint16_t color;
+    uint16_t background_color;
+    bool filled;
+    uint8_t line_weight;
+    sFONT *font;
+    const uint8_t *data;
+    int width;
+    int height;
+    sem_t *done; // Posted once a RENDER_SYNC has been flushed
+    char text[RENDER_TEXT_MAX];
+} render_command;
+
+// Bounded multi-producer queue (Dmitry Vyukov's design). Each slot's sequence number says whose
+// turn it is: a producer may fill slot i when sequence == position, and the render thread may
+// take it when sequence == position + 1. Producers claim positions with a CAS on tail; only the
+// render thread moves head, so it needs no atomics of its own.
+typedef struct {
+    atomic_size_t sequence;
+    render_command command;
+} render_slot;
+
+static render_slot queue[RENDER_QUEUE_SIZE];
+static atomic_size_t tail;
+static size_t head;
+
+static pthread_t render_thread;
+static sem_t wake;
+static atomic_bool running = false;
+static long frame_interval_ns;
+
+// Sleeps until interval_ns after since, on CLOCK_MONOTONIC
+static void sleep_until(const struct timespec *since, long interval_ns) {
+    struct timespec deadline = *since;
+    deadline.tv_nsec += interval_ns;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+static void flush(struct timespec *last_flush) {
+    display_flush();
+    clock_gettime(CLOCK_MONOTONIC, last_flush);
+}
+
+// Dropped when the render thread is not running, since nothing would ever take it
+static void enqueue(const render_command *command) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    size_t position = atomic_load_explicit(&tail, memory_order_relaxed);
+
+    for (;;) {
+        render_slot *slot = &queue[position & (RENDER_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&tail, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                slot->command = *command;
+                atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+                sem_post(&wake);
+                return;
+            }
+        } else if (diff < 0) {
+            // Full, so let the render thread catch up, unless render_exit stopped it
+            if (!atomic_load(&running)) {
+                return;
+            }
+            sem_post(&wake);
+            sched_yield();
+            position = atomic_load_explicit(&tail, memory_order_relaxed);
+        } else {
+            position = atomic_load_explicit(&tail, memory_order_relaxed);
+        }
+    }
+}
+
+static bool dequeue(render_command *command) {
+    render_slot *slot = &queue[head & (RENDER_QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+    if (sequence != head + 1) {
+        return false;
+    }
+
+    *command = slot->command;
+    atomic_store_explicit(&slot->sequence, head + RENDER_QUEUE_SIZE, memory_order_release);
+    head++;
+    return true;
+}
+
+static void execute(const render_command *command) {
+    switch (command->op) {
+    case RENDER_CLEAR:
+        display_clear(command->color);
+        break;
+    case RENDER_LINE:
+        display_draw_line(command->x_start, command->y_start, command->x_end, command->y_end,
+                          command->color, command->line_weight);
+        break;
+    case RENDER_RECTANGLE:
+        display_draw_rectangle(command->x_start, command->y_start, command->x_end, command->y_end,
+                               command->color, command->filled, command->line_weight);
+        break;
+    case RENDER_STRING:
+        display_draw_string(command->x_start, command->y_start, command->text, command->font,
+                            command->background_color, command->color);
+        break;
+    case RENDER_IMAGE:
+        display_draw_image_data(command->data, command->width, command->height);
+        break;
+    case RENDER_PRESENT:
+    case RENDER_SYNC:
+        break;
+    }
+}
+
+static void *render_loop(void *arg) {
+    (void)arg;
+    static render_command batch[RENDER_QUEUE_SIZE];
+    int count = 0;
+    int next = 0;       // The first command in batch not handled yet
+    int drawn_from = 0; // Anything in batch before the last clear would be drawn over, so skipped
+    struct timespec last_flush = {0};
+    bool dirty = false;     // Something is drawn that is not on the screen
+    bool presented = false; // ...and it is a whole frame, waiting only for its turn
+
+    for (;;) {
+        if (presented) {
+            // The commands after the present stay in batch until the frame is out, so none of
+            // the next frame is flushed with it
+            sleep_until(&last_flush, frame_interval_ns);
+            flush(&last_flush);
+            dirty = false;
+            presented = false;
+        }
+
+        if (next == count) {
+            if (!atomic_load(&running) && atomic_load(&tail) == head) {
+                break;
+            }
+            if (atomic_load(&running)) {
+                while (sem_wait(&wake) == -1 && errno == EINTR) {
+                }
+            }
+            // Take everything that is queued
+            count = 0;
+            next = 0;
+            drawn_from = 0;
+            while (count < RENDER_QUEUE_SIZE && dequeue(&batch[count])) {
+                if (batch[count].op == RENDER_CLEAR) {
+                    drawn_from = count;
+                }
+                count++;
+            }
+        }
+
+        // Draw up to the end of the next frame
+        for (; next < count && !presented; next++) {
+            const render_command *command = &batch[next];
+            if (command->op == RENDER_SYNC) {
+                if (dirty) {
+                    flush(&last_flush);
+                    dirty = false;
+                }
+                sem_post(command->done);
+            } else if (next < drawn_from) {
+                continue;
+            } else if (command->op == RENDER_PRESENT) {
+                presented = dirty;
+            } else {
+                execute(command);
+                dirty = true;
+            }
+        }
+    }
+
+    if (dirty) {
+        display_flush();
+    }
+    return NULL;
+}
+
+int render_init(unsigned int max_fps) {
+    if (atomic_load(&running)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < RENDER_QUEUE_SIZE; i++) {
+        atomic_init(&queue[i].sequence, i);
+    }
+    atomic_store(&tail, 0);
+    head = 0;
+    frame_interval_ns = max_fps > 0 ? 1000000000L / max_fps : 0;
+
+    sem_init(&wake, 0, 0);
+    atomic_store(&running, true);
+    if (pthread_create(&render_thread, NULL, render_loop, NULL) != 0) {
+        log_error("Failed to start the render thread");
+        atomic_store(&running, false);
+        sem_destroy(&wake);
+        return -1;
+    }
+    return 0;
+}
+
+void render_exit() {
+    if (!atomic_exchange(&running, false)) {
+        return;
+    }
+    sem_post(&wake);
+    pthread_join(render_thread, NULL);
+    sem_destroy(&wake);
+}
+
+void render_sync() {
+    if (!atomic_load(&running)) {
+        return;
+    }
+
+    sem_t done;
+    sem_init(&done, 0, 0);
+    render_command command = {.op = RENDER_SYNC, .done = &done};
+    enqueue(&command);
+    while (sem_wait(&done) == -1 && errno == EINTR) {
+    }
+    sem_destroy(&done);
+}
+
+void render_present() {
+    render_command command = {.op = RENDER_PRESENT};
+    enqueue(&command);
+}
+
+void render_clear(uint16_t color) {
+    render_command command = {.op = RENDER_CLEAR, .color = color};
+    enqueue(&command);
+}
+
+void render_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
+                      uint16_t color, uint8_t line_weight) {
+    render_command command = {
+        .op = RENDER_LINE,
+        .x_start = x_start,
+        .y_start = y_start,
+        .x_end = x_end,
+        .y_end = y_end,
+        .color = color,
+        .line_weight = line_weight,
+    };
+    enqueue(&command);
+}
+
+void render_draw_rectangle(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
+                           uint16_t color, bool filled, uint8_t line_weight) {
+    render_command command = {
+        .op = RENDER_RECTANGLE,
+        .x_start = x_start,
+        .y_start = y_start,
+        .x_end = x_end,
+        .y_end = y_end,
+        .color = color,
+        .filled = filled,
+        .line_weight = line_weight,
+    };
+    enqueue(&command);
+}
+
+void render_draw_string(uint16_t x_start, uint16_t y_start, const char *str, sFONT *font,
+                        uint16_t background_color, uint16_t foreground_color) {
+    render_command command = {
+        .op = RENDER_STRING,
+        .x_start = x_start,
+        .y_start = y_start,
+        .color = foreground_color,
+        .background_color = background_color,
+        .font = font,
+    };
+    strncpy(command.text, str, RENDER_TEXT_MAX - 1);
+    command.text[RENDER_TEXT_MAX - 1] = '\0';
+    enqueue(&command);
+}
+
+void render_draw_image_data(const uint8_t *data, int width, int height) {
+    render_command command = {
+        .op = RENDER_IMAGE,
+        .data = data,
+        .width = width,
+        .height = height,
+    };
+    enqueue(&command);
+}
@@ -0,0 +1,103 @@
+#ifndef __RENDER_H
+#define __RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fonts/fonts.h"
+
+// How many commands can be waiting for the render thread before producers have to wait
+#define RENDER_QUEUE_SIZE 256
+
+// Longest string render_draw_string will copy. Longer strings are cut off.
+#define RENDER_TEXT_MAX 64
+
+/**
+ * Description:
+ *  Starts the render thread. After this is called the render thread owns the display and the SPI
+ *  bus, so use the render_* functions below instead of the display_* functions. display_init must
+ *  be called first.
+ *
+ *  The render_* functions only queue a command and return right away. They are safe to call from
+ *  any thread. The render thread draws queued commands into the framebuffer, and each time a
+ *  render_present ends a frame it flushes the frame to the screen, at most max_fps times a second.
+ *  Nothing drawn after the last render_present is shown until the next one. If a clear is queued,
+ *  anything queued before it that has not been drawn yet is skipped. Commands queued while the
+ *  render thread is not running are dropped.
+ *
+ * Arguments:
+ *  max_fps: The most times per second the screen will be updated.
+ *
+ * Return:
+ *  0 on success, -1 if the render thread could not be started.
+ */
+int render_init(unsigned int max_fps);
+
+/**
+ * Description:
+ *  Draws everything still queued, then stops the render thread. Call this before display_exit.
+ *
+ * Arguments:
+ *  None
+ */
+void render_exit();
+
+/**
+ * Description:
+ *  Ends a frame. Everything queued before it goes to the screen together, once the frame before
+ *  it has been up for 1 / max_fps seconds.
+ *
+ * Arguments:
+ *  None
+ */
+void render_present();
+
+/**
+ * Description:
+ *  Waits until everything queued before this call is on the screen. It is flushed straight away,
+ *  whether or not the frame has been presented.
+ *
+ * Arguments:
+ *  None
+ */
+void render_sync();
+
+/**
+ * Description:
+ *  Queues a display_clear.
+ *
+ * Arguments:
+ *  color: The color you would like the screen to be cleared to.
+ */
+void render_clear(uint16_t color);
+
+/**
+ * Description:
+ *  Queues a display_draw_line. See display_draw_line for the arguments.
+ */
+void render_draw_line(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
+                      uint16_t color, uint8_t line_weight);
+
+/**
+ * Description:
+ *  Queues a display_draw_rectangle. See display_draw_rectangle for the arguments.
+ */
+void render_draw_rectangle(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end,
+                           uint16_t color, bool filled, uint8_t line_weight);
+
+/**
+ * Description:
+ *  Queues a display_draw_string. The string is copied, so it does not need to outlive the call.
+ *  See display_draw_string for the arguments.
+ */
+void render_draw_string(uint16_t x_start, uint16_t y_start, const char *str, sFONT *font,
+                        uint16_t background_color, uint16_t foreground_color);
+
+/**
+ * Description:
+ *  Queues a display_draw_image_data. The data is *not* copied, so it must stay valid until
+ *  render_sync returns. See display_draw_image_data for the arguments.
+ */
+void render_draw_image_data(const uint8_t *data, int width, int height);
+
+#endif
@@ -0,0 +1,216 @@
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "resolver.h"
+
+typedef struct {
+    bool used;
+    bool refreshing; // A background refresh is running
+    char host[64];
+    char port[8];
+    uint64_t resolved_at; // Seconds on CLOCK_MONOTONIC
+    ResolvedAddrs addrs;
+} cache_entry;
+
+typedef struct {
+    char host[64];
+    char port[8];
+} refresh_arg;
+
+static cache_entry cache[RESOLVER_CACHE_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Runs getaddrinfo and interleaves the address families, so a dead route on one family only
+// costs one connect attempt before the other family gets a turn
+static int resolve(const char *host, const char *port, ResolvedAddrs *out) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    int status = getaddrinfo(host, port, &hints, &result);
+    if (status != 0) {
+        log_error("getaddrinfo %s: %s", host, gai_strerror(status));
+        return -1;
+    }
+
+    ResolvedAddr first[RESOLVER_MAX_ADDRS];
+    ResolvedAddr other[RESOLVER_MAX_ADDRS];
+    int num_first = 0;
+    int num_other = 0;
+    int first_family = result->ai_family;
+
+    for (const struct addrinfo *rp = result; rp != NULL; rp = rp->ai_next) {
+        if (rp->ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+        }
+        bool is_first = rp->ai_family == first_family;
+        ResolvedAddr *slot;
+        if (is_first && num_first < RESOLVER_MAX_ADDRS) {
+            slot = &first[num_first++];
+        } else if (!is_first && num_other < RESOLVER_MAX_ADDRS) {
+            slot = &other[num_other++];
+        } else {
+            continue;
+        }
+        slot->family = rp->ai_family;
+        slot->len = rp->ai_addrlen;
+        memcpy(&slot->addr, rp->ai_addr, rp->ai_addrlen);
+    }
+    freeaddrinfo(result);
+
+    out->count = 0;
+    for (int i = 0; out->count < RESOLVER_MAX_ADDRS && (i < num_first || i < num_other); i++) {
+        if (i < num_first) {
+            out->addrs[out->count++] = first[i];
+        }
+        if (i < num_other && out->count < RESOLVER_MAX_ADDRS) {
+            out->addrs[out->count++] = other[i];
+        }
+    }
+    return out->count > 0 ? 0 : -1;
+}
+
+// Call with cache_lock held
+static cache_entry *find_entry(const char *host, const char *port) {
+    for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+        if (cache[i].used && strcmp(cache[i].host, host) == 0 &&
+            strcmp(cache[i].port, port) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Call with cache_lock held. Reuses the entry for host, a free one, or the oldest one.
+static void store(const char *host, const char *port, const ResolvedAddrs *addrs) {
+    cache_entry *entry = find_entry(host, port);
+    for (int i = 0; !entry && i < RESOLVER_CACHE_SIZE; i++) {
+        if (!cache[i].used) {
+            entry = &cache[i];
+        }
+    }
+    if (!entry) {
+        entry = &cache[0];
+        for (int i = 1; i < RESOLVER_CACHE_SIZE; i++) {
+            if (cache[i].resolved_at < entry->resolved_at) {
+                entry = &cache[i];
+            }
+        }
+    }
+
+    entry->used = true;
+    entry->refreshing = false;
+    strcpy(entry->host, host);
+    strcpy(entry->port, port);
+    entry->resolved_at = now_s();
+    entry->addrs = *addrs;
+}
+
+static void *refresh_thread(void *varg) {
+    refresh_arg *arg = varg;
+    ResolvedAddrs addrs;
+    bool ok = resolve(arg->host, arg->port, &addrs) == 0;
+
+    pthread_mutex_lock(&cache_lock);
+    cache_entry *entry = find_entry(arg->host, arg->port);
+    if (ok) {
+        store(arg->host, arg->port, &addrs);
+    } else if (entry) {
+        // The old answer stays until it expires, the next lookup tries again
+        entry->refreshing = false;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    free(arg);
+    return NULL;
+}
+
+// Call with cache_lock held
+static void start_refresh(cache_entry *entry) {
+    refresh_arg *arg = malloc(sizeof(refresh_arg));
+    if (!arg) {
+        return;
+    }
+    strcpy(arg->host, entry->host);
+    strcpy(arg->port, entry->port);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, refresh_thread, arg) != 0) {
+        free(arg);
+        return;
+    }
+    pthread_detach(tid);
+    entry->refreshing = true;
+}
+
+int resolver_lookup(const char *host, const char *port, ResolvedAddrs *out) {
+    if (strlen(host) >= sizeof(cache[0].host) || strlen(port) >= sizeof(cache[0].port)) {
+        return resolve(host, port, out);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    cache_entry *entry = find_entry(host, port);
+    if (entry) {
+        uint64_t age = now_s() - entry->resolved_at;
+        if (age < RESOLVER_TTL_S) {
+            if (age >= RESOLVER_REFRESH_S && !entry->refreshing) {
+                start_refresh(entry);
+            }
+            *out = entry->addrs;
+            pthread_mutex_unlock(&cache_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    ResolvedAddrs addrs;
+    if (resolve(host, port, &addrs) != 0) {
+        pthread_mutex_lock(&cache_lock);
+        entry = find_entry(host, port);
+        if (entry) {
+            log_warn("Using an expired address for %s", host);
+            *out = entry->addrs;
+        }
+        pthread_mutex_unlock(&cache_lock);
+        return entry ? 0 : -1;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    store(host, port, &addrs);
+    pthread_mutex_unlock(&cache_lock);
+    *out = addrs;
+    return 0;
+}
+
+void resolver_invalidate(const char *host, const char *port) {
+    pthread_mutex_lock(&cache_lock);
+    cache_entry *entry = find_entry(host, port);
+    if (entry) {
+        entry->used = false;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void resolver_prefer(const char *host, const char *port, const ResolvedAddr *addr) {
+    pthread_mutex_lock(&cache_lock);
+    cache_entry *entry = find_entry(host, port);
+    for (int i = 1; entry && i < entry->addrs.count; i++) {
+        ResolvedAddr *cached = &entry->addrs.addrs[i];
+        if (cached->len == addr->len && memcmp(&cached->addr, &addr->addr, addr->len) == 0) {
+            ResolvedAddr preferred = *cached;
+            memmove(&entry->addrs.addrs[1], &entry->addrs.addrs[0], i * sizeof(ResolvedAddr));
+            entry->addrs.addrs[0] = preferred;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
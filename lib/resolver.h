@@ -0,0 +1,70 @@
+#ifndef __RESOLVER_H
+#define __RESOLVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// How many host and port pairs are cached
+#define RESOLVER_CACHE_SIZE 4
+
+// getaddrinfo does not say how long an answer is good for, so every answer gets this long
+#define RESOLVER_TTL_S 300
+
+// Answers older than this are still used, but refreshed on a background thread
+#define RESOLVER_REFRESH_S 240
+
+// Most addresses kept per host
+#define RESOLVER_MAX_ADDRS 8
+
+typedef struct {
+    int family;
+    socklen_t len;
+    struct sockaddr_storage addr;
+} ResolvedAddr;
+
+typedef struct {
+    int count;
+    // IPv6 and IPv4 alternate, starting with the family getaddrinfo preferred
+    ResolvedAddr addrs[RESOLVER_MAX_ADDRS];
+} ResolvedAddrs;
+
+/**
+ * Description:
+ *  Looks up the TCP addresses of a host. A cached answer is returned without touching the
+ *  network. Once it is older than RESOLVER_REFRESH_S a background refresh is started, and once it
+ *  is older than RESOLVER_TTL_S the lookup blocks on getaddrinfo. If that fails, the expired
+ *  answer is used rather than nothing.
+ *
+ * Arguments:
+ *  host: The host name or address.
+ *  port: The port, as a string.
+ *  out: Where the addresses are written.
+ *
+ * Return:
+ *  0 on success, -1 if the host could not be resolved.
+ */
+int resolver_lookup(const char *host, const char *port, ResolvedAddrs *out);
+
+/**
+ * Description:
+ *  Drops the cached answer for a host, for example after none of its addresses worked.
+ *
+ * Arguments:
+ *  host: The host name or address.
+ *  port: The port, as a string.
+ */
+void resolver_invalidate(const char *host, const char *port);
+
+/**
+ * Description:
+ *  Moves an address to the front of a host's cached answer, so the address that last connected
+ *  is tried first next time instead of waiting behind one that is dead.
+ *
+ * Arguments:
+ *  host: The host name or address.
+ *  port: The port, as a string.
+ *  addr: The address that worked, as returned by resolver_lookup.
+ */
+void resolver_prefer(const char *host, const char *port, const ResolvedAddr *addr);
+
+#endif
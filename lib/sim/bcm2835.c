@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../device.h"
+#include "../log.h"
+#include "../st7735_emu.h"
+#include "bcm2835.h"
+
+#define SIM_SCRIPT_ENV "DOORBELL_SIM_SCRIPT"
+#define SIM_FRAMES_ENV "DOORBELL_SIM_FRAMES"
+#define SIM_SCREEN_ENV "DOORBELL_SIM_SCREEN"
+#define SIM_SPEED_ENV "DOORBELL_SIM_SPEED"
+
+#define SIM_PINS 54
+#define SIM_SCRIPT_MAX 1024
+
+typedef enum { EVENT_PRESS, EVENT_RELEASE, EVENT_QUIT } sim_event_type;
+
+typedef struct {
+    uint64_t at_us; // Virtual time
+    sim_event_type type;
+    uint8_t pin;
+} sim_event;
+
+typedef struct {
+    const char *name;
+    uint8_t pin;
+} sim_key;
+
+// Labels on the HAT and the GPIO they are wired to, matching lib/buttons.c
+static const sim_key keys[] = {
+    {"up", 6},     {"down", 19}, {"left", 5},  {"right", 26},
+    {"press", 13}, {"key1", 21}, {"key2", 20}, {"key3", 16},
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inputs_ready = PTHREAD_COND_INITIALIZER;
+static bool inputs_read = false; // The button levels have been read, so the script can start
+
+static uint8_t pin_mode[SIM_PINS];
+static uint8_t pin_pud[SIM_PINS];
+static uint8_t pin_output[SIM_PINS];
+static bool pin_pressed[SIM_PINS];
+
+// Stands in for the GPIO register block. Reads are decoded by address in bcm2835_peri_read.
+static uint32_t gpio_registers[0xB4 / 4];
+
+static st7735_emu emu;
+static uint16_t spi_divider = BCM2835_SPI_CLOCK_DIVIDER_8;
+static const char *frames_prefix = NULL;
+
+static struct timespec start;
+static double speed = 1.0;
+
+static sim_event script[SIM_SCRIPT_MAX];
+static int script_len = 0;
+static pthread_t script_thread;
+static bool initialized = false;
+
+static uint64_t virtual_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double real_us = (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+    return (uint64_t)(real_us * speed);
+}
+
+// Sleeps for a stretch of virtual time
+static void sleep_virtual_us(uint64_t micros) {
+    double real_ns = micros * 1000.0 / speed;
+    struct timespec ts = {
+        .tv_sec = (time_t)(real_ns / 1e9),
+        .tv_nsec = (long)(real_ns - (double)(time_t)(real_ns / 1e9) * 1e9),
+    };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+static int parse_pin(const char *name) {
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strcasecmp(name, keys[i].name) == 0) {
+            return keys[i].pin;
+        }
+    }
+
+    char *end;
+    long pin = strtol(name, &end, 10);
+    if (*name == '\0' || *end != '\0' || pin < 0 || pin >= SIM_PINS) {
+        return -1;
+    }
+    return (int)pin;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const sim_event *x = a;
+    const sim_event *y = b;
+    return (x->at_us > y->at_us) - (x->at_us < y->at_us);
+}
+
+static void load_script(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        log_error("Failed to open sim script %s", path);
+        return;
+    }
+
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), fp) && script_len < SIM_SCRIPT_MAX) {
+        line_number++;
+
+        char first = line[strspn(line, " \t\r\n")];
+        if (first == '#' || first == '\0') {
+            continue;
+        }
+
+        char action[32] = "";
+        char key[32] = "";
+        unsigned long ms;
+        int fields = sscanf(line, "%lu %31s %31s", &ms, action, key);
+
+        sim_event *event = &script[script_len];
+        event->at_us = (uint64_t)ms * 1000;
+        event->pin = 0;
+        if (fields >= 2 && strcmp(action, "quit") == 0) {
+            event->type = EVENT_QUIT;
+        } else if (fields == 3 &&
+                   (strcmp(action, "press") == 0 || strcmp(action, "release") == 0)) {
+            int pin = parse_pin(key);
+            if (pin < 0) {
+                log_warn("%s:%d: unknown key '%s'", path, line_number, key);
+                continue;
+            }
+            event->type = action[0] == 'p' ? EVENT_PRESS : EVENT_RELEASE;
+            event->pin = (uint8_t)pin;
+        } else {
+            log_warn("%s:%d: cannot parse '%s'", path, line_number, strtok(line, "\r\n"));
+            continue;
+        }
+        script_len++;
+    }
+    fclose(fp);
+
+    qsort(script, script_len, sizeof(script[0]), compare_events);
+    log_info("Loaded %d sim events from %s", script_len, path);
+    for (int i = 0; i < script_len && speed != 1.0; i++) {
+        if (script[i].type != EVENT_QUIT) {
+            log_warn("%s: key events need %s=1, input debounce and timers keep real time", path,
+                     SIM_SPEED_ENV);
+            break;
+        }
+    }
+}
+
+// Call with lock held
+static void note_inputs_read(void) {
+    if (!inputs_read) {
+        inputs_read = true;
+        pthread_cond_broadcast(&inputs_ready);
+    }
+}
+
+static void *run_script(void *arg) {
+    (void)arg;
+    // Presses before anything samples the buttons would be lost, so time starts there
+    pthread_mutex_lock(&lock);
+    while (!inputs_read) {
+        pthread_cond_wait(&inputs_ready, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    uint64_t started = virtual_now_us();
+
+    for (int i = 0; i < script_len; i++) {
+        const sim_event *event = &script[i];
+        uint64_t now = virtual_now_us() - started;
+        if (event->at_us > now) {
+            sleep_virtual_us(event->at_us - now);
+        }
+
+        if (event->type == EVENT_QUIT) {
+            kill(getpid(), SIGINT);
+            break;
+        }
+        pthread_mutex_lock(&lock);
+        pin_pressed[event->pin] = event->type == EVENT_PRESS;
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+int bcm2835_init(void) {
+    // main.c and DEV_ModuleInit both call this
+    if (initialized) {
+        return 1;
+    }
+    initialized = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char *speed_env = getenv(SIM_SPEED_ENV);
+    if (speed_env && atof(speed_env) > 0) {
+        speed = atof(speed_env);
+    }
+    frames_prefix = getenv(SIM_FRAMES_ENV);
+    st7735_emu_init(&emu);
+
+    const char *script_path = getenv(SIM_SCRIPT_ENV);
+    if (script_path && *script_path) {
+        load_script(script_path);
+    }
+    if (script_len > 0 && pthread_create(&script_thread, NULL, run_script, NULL) == 0) {
+        pthread_detach(script_thread);
+    }
+    return 1;
+}
+
+int bcm2835_close(void) {
+    pthread_mutex_lock(&lock);
+    // Anything sent after the last frame mark
+    if (emu.frame.commands > 0 || emu.frame.data_bytes > 0) {
+        st7735_emu_end_frame(&emu, NULL);
+    }
+    const st7735_stats *total = &emu.total;
+    log_info("sim: %u frames in %.1f ms virtual time", emu.frames, virtual_now_us() / 1000.0);
+    log_info("sim: %u commands, %u windows, %u data bytes, %u pixels", total->commands,
+             total->windows, total->data_bytes, total->pixels);
+    log_info("sim: %.1f ms on the wire at divider %u",
+             st7735_wire_time_us(total, spi_divider) / 1000, spi_divider);
+
+    const char *screen = getenv(SIM_SCREEN_ENV);
+    if (screen && *screen && st7735_emu_write_bmp(&emu, screen) != 0) {
+        log_error("Failed to write %s", screen);
+    }
+    pthread_mutex_unlock(&lock);
+    return 1;
+}
+
+void bcm2835_gpio_fsel(uint8_t pin, uint8_t mode) {
+    if (pin < SIM_PINS) {
+        pin_mode[pin] = mode;
+    }
+}
+
+void bcm2835_gpio_set_pud(uint8_t pin, uint8_t pud) {
+    if (pin < SIM_PINS) {
+        pin_pud[pin] = pud;
+    }
+}
+
+void bcm2835_gpio_write(uint8_t pin, uint8_t on) {
+    if (pin < SIM_PINS) {
+        pthread_mutex_lock(&lock);
+        pin_output[pin] = on;
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+// Call with lock held
+static uint8_t pin_level(uint8_t pin) {
+    if (pin_mode[pin] == BCM2835_GPIO_FSEL_OUTP) {
+        return pin_output[pin];
+    }
+    if (pin_pressed[pin]) {
+        // The buttons short the pin to ground
+        return LOW;
+    }
+    return pin_pud[pin] == BCM2835_GPIO_PUD_UP ? HIGH : LOW;
+}
+
+uint8_t bcm2835_gpio_lev(uint8_t pin) {
+    if (pin >= SIM_PINS) {
+        return LOW;
+    }
+
+    pthread_mutex_lock(&lock);
+    uint8_t level = pin_level(pin);
+    if (pin_mode[pin] != BCM2835_GPIO_FSEL_OUTP) {
+        note_inputs_read();
+    }
+    pthread_mutex_unlock(&lock);
+    return level;
+}
+
+uint32_t *bcm2835_regbase(uint8_t regbase) {
+    return regbase == BCM2835_REGBASE_GPIO ? gpio_registers : NULL;
+}
+
+uint32_t bcm2835_peri_read(volatile uint32_t *paddr) {
+    if (paddr != &gpio_registers[BCM2835_GPLEV0 / 4]) {
+        return 0;
+    }
+
+    uint32_t levels = 0;
+    pthread_mutex_lock(&lock);
+    for (uint8_t pin = 0; pin < 32; pin++) {
+        levels |= (uint32_t)pin_level(pin) << pin;
+    }
+    note_inputs_read();
+    pthread_mutex_unlock(&lock);
+    return levels;
+}
+
+int bcm2835_spi_begin(void) { return 1; }
+
+void bcm2835_spi_end(void) {}
+
+void bcm2835_spi_setBitOrder(uint8_t order) { (void)order; }
+
+void bcm2835_spi_setDataMode(uint8_t mode) { (void)mode; }
+
+void bcm2835_spi_setClockDivider(uint16_t divider) { spi_divider = divider; }
+
+void bcm2835_spi_chipSelect(uint8_t cs) { (void)cs; }
+
+void bcm2835_spi_setChipSelectPolarity(uint8_t cs, uint8_t active) {
+    (void)cs;
+    (void)active;
+}
+
+void bcm2835_spi_writenb(const char *buf, uint32_t len) {
+    pthread_mutex_lock(&lock);
+    st7735_emu_write(&emu, pin_output[LCD_DC], (const uint8_t *)buf, len);
+    pthread_mutex_unlock(&lock);
+}
+
+void bcm2835_spi_transfernb(char *tbuf, char *rbuf, uint32_t len) {
+    bcm2835_spi_writenb(tbuf, len);
+    // The ST7735 never drives MISO
+    if (rbuf) {
+        memset(rbuf, 0, len);
+    }
+}
+
+uint8_t bcm2835_spi_transfer(uint8_t value) {
+    bcm2835_spi_writenb((const char *)&value, 1);
+    return 0;
+}
+
+void bcm2835_delay(unsigned int millis) { sleep_virtual_us((uint64_t)millis * 1000); }
+
+void bcm2835_delayMicroseconds(uint64_t micros) { sleep_virtual_us(micros); }
+
+uint64_t bcm2835_st_read(void) { return virtual_now_us(); }
+
+void bcm2835_sim_frame(void) {
+    pthread_mutex_lock(&lock);
+    uint32_t frame = emu.frames;
+    st7735_emu_end_frame(&emu, NULL);
+    if (frames_prefix && *frames_prefix) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s%u.bmp", frames_prefix, frame);
+        if (st7735_emu_write_bmp(&emu, path) != 0) {
+            log_error("Failed to write %s", path);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,112 @@
+// Stand-in for the bcm2835 library used by `make sim`. It declares the part of the bcm2835 API
+// this tree calls, and lib/sim/bcm2835.c implements it on a Linux host:
+//
+//  - GPIO inputs are released (pulled up) unless a script says otherwise. Set DOORBELL_SIM_SCRIPT
+//    to a file with one event per line:
+//        <ms> press <key>
+//        <ms> release <key>
+//        <ms> quit
+//    <ms> is virtual time since the buttons were first read, so no event is lost while the
+//    program starts up, and a script does nothing in one that never reads them. <key> is a GPIO
+//    number or one of the joystick and key names printed on the HAT (up, down, left, right,
+//    press, key1, key2, key3). The HAT is mounted rotated, so button_up() reads "right". quit
+//    raises SIGINT. Lines starting with # are ignored.
+//  - SPI goes to the ST7735 emulator in lib/st7735_emu.c. Set DOORBELL_SIM_FRAMES to a prefix to
+//    save every frame as <prefix><frame>.bmp, and DOORBELL_SIM_SCREEN to a file to save the last
+//    frame on exit. A summary of the SPI traffic is printed when bcm2835_close is called.
+//  - Delays run on a virtual clock that advances DOORBELL_SIM_SPEED times faster than real time
+//    (default 1). bcm2835_st_read returns the virtual clock in microseconds. Nothing else is
+//    scaled: lib/input debounces and lib/evloop times out on the real clock, so a script with key
+//    events is only supported at speed 1.
+
+#ifndef BCM2835_H
+#define BCM2835_H
+
+#include <stdint.h>
+// The real header pulls these in, and parts of the tree rely on it
+#include <stdio.h>
+#include <stdlib.h>
+
+// Lets code that needs to know it is running in the simulator check for it
+#define BCM2835_SIM 1
+
+#define HIGH 0x1
+#define LOW 0x0
+
+typedef enum {
+    BCM2835_REGBASE_ST = 1,
+    BCM2835_REGBASE_GPIO = 2,
+} bcm2835RegisterBase;
+
+// Offset of the pin level register for GPIO 0-31 from the GPIO base, in bytes
+#define BCM2835_GPLEV0 0x0034
+
+typedef enum {
+    BCM2835_GPIO_FSEL_INPT = 0x00,
+    BCM2835_GPIO_FSEL_OUTP = 0x01,
+} bcm2835FunctionSelect;
+
+typedef enum {
+    BCM2835_GPIO_PUD_OFF = 0x00,
+    BCM2835_GPIO_PUD_DOWN = 0x01,
+    BCM2835_GPIO_PUD_UP = 0x02,
+} bcm2835PUDControl;
+
+typedef enum {
+    BCM2835_SPI_BIT_ORDER_LSBFIRST = 0,
+    BCM2835_SPI_BIT_ORDER_MSBFIRST = 1,
+} bcm2835SPIBitOrder;
+
+typedef enum {
+    BCM2835_SPI_MODE0 = 0,
+    BCM2835_SPI_MODE1 = 1,
+    BCM2835_SPI_MODE2 = 2,
+    BCM2835_SPI_MODE3 = 3,
+} bcm2835SPIMode;
+
+typedef enum {
+    BCM2835_SPI_CS0 = 0,
+    BCM2835_SPI_CS1 = 1,
+    BCM2835_SPI_CS2 = 2,
+    BCM2835_SPI_CS_NONE = 3,
+} bcm2835SPIChipSelect;
+
+typedef enum {
+    BCM2835_SPI_CLOCK_DIVIDER_4 = 4,
+    BCM2835_SPI_CLOCK_DIVIDER_8 = 8,
+    BCM2835_SPI_CLOCK_DIVIDER_16 = 16,
+    BCM2835_SPI_CLOCK_DIVIDER_32 = 32,
+    BCM2835_SPI_CLOCK_DIVIDER_64 = 64,
+} bcm2835SPIClockDivider;
+
+int bcm2835_init(void);
+int bcm2835_close(void);
+
+// Only GPLEV0 is modelled. Other registers read as 0.
+uint32_t *bcm2835_regbase(uint8_t regbase);
+uint32_t bcm2835_peri_read(volatile uint32_t *paddr);
+
+void bcm2835_gpio_fsel(uint8_t pin, uint8_t mode);
+void bcm2835_gpio_set_pud(uint8_t pin, uint8_t pud);
+void bcm2835_gpio_write(uint8_t pin, uint8_t on);
+uint8_t bcm2835_gpio_lev(uint8_t pin);
+
+int bcm2835_spi_begin(void);
+void bcm2835_spi_end(void);
+void bcm2835_spi_setBitOrder(uint8_t order);
+void bcm2835_spi_setDataMode(uint8_t mode);
+void bcm2835_spi_setClockDivider(uint16_t divider);
+void bcm2835_spi_chipSelect(uint8_t cs);
+void bcm2835_spi_setChipSelectPolarity(uint8_t cs, uint8_t active);
+uint8_t bcm2835_spi_transfer(uint8_t value);
+void bcm2835_spi_transfernb(char *tbuf, char *rbuf, uint32_t len);
+void bcm2835_spi_writenb(const char *buf, uint32_t len);
+
+void bcm2835_delay(unsigned int millis);
+void bcm2835_delayMicroseconds(uint64_t micros);
+uint64_t bcm2835_st_read(void);
+
+// Not part of bcm2835. Marks the end of a frame so the emulator can report on it.
+void bcm2835_sim_frame(void);
+
+#endif
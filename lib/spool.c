@@ -0,0 +1,537 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "spool.h"
+#include "upload.h"
+
+// Longest file name kept inside the spool directory
+#define SPOOL_NAME_MAX 96
+
+typedef struct {
+    uint32_t seq;
+    char name[SPOOL_NAME_MAX];
+    uint64_t size;
+    bool in_flight; // Handed to lib/upload and not back yet
+    // The file it was copied from, so spooling it again can be skipped. Zero for entries loaded
+    // from the manifest.
+    dev_t src_dev;
+    ino_t src_ino;
+    struct timespec src_mtime;
+} entry;
+
+static SpoolConfig cfg;
+
+// Pending entries, oldest first
+static entry *entries = NULL;
+static int num_entries = 0;
+static int max_entries = 0;
+static uint64_t spooled_bytes = 0;
+static uint32_t next_seq = 1;
+
+static int manifest_fd = -1;
+static int dir_fd = -1;
+static int finished_records = 0; // "done" lines in the manifest since it was last compacted
+
+static int batch_outstanding = 0;
+static int batch_failures = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static pthread_t drain_thread;
+static bool running = false;
+static bool stopping = false;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void spool_path(char *buf, size_t len, const char *name) {
+    snprintf(buf, len, "%s/%s", cfg.dir, name);
+}
+
+// Appends one line to the manifest and waits for it to reach the disk
+static int append_record(const char *line) {
+    size_t len = strlen(line);
+    if (write(manifest_fd, line, len) != (ssize_t)len || fdatasync(manifest_fd) != 0) {
+        log_error("Failed to write the spool manifest: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int find_entry(uint32_t seq) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].seq == seq) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Finds the pending entry copied from the file st describes, unchanged since. Call with lock held.
+static int find_source(const struct stat *st) {
+    for (int i = 0; i < num_entries; i++) {
+        const entry *e = &entries[i];
+        if (e->src_ino != 0 && e->src_dev == st->st_dev && e->src_ino == st->st_ino &&
+            e->size == (uint64_t)st->st_size && e->src_mtime.tv_sec == st->st_mtim.tv_sec &&
+            e->src_mtime.tv_nsec == st->st_mtim.tv_nsec) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// src is the file the entry was copied from, or NULL if not known
+static int add_entry(uint32_t seq, const char *name, uint64_t size, const struct stat *src) {
+    if (num_entries == max_entries) {
+        int grown_max = max_entries ? max_entries * 2 : 32;
+        entry *grown = realloc(entries, grown_max * sizeof(entry));
+        if (!grown) {
+            return -1;
+        }
+        entries = grown;
+        max_entries = grown_max;
+    }
+    entry *e = &entries[num_entries++];
+    e->seq = seq;
+    strncpy(e->name, name, SPOOL_NAME_MAX - 1);
+    e->name[SPOOL_NAME_MAX - 1] = '\0';
+    e->size = size;
+    e->in_flight = false;
+    e->src_dev = src ? src->st_dev : 0;
+    e->src_ino = src ? src->st_ino : 0;
+    e->src_mtime = src ? src->st_mtim : (struct timespec){0};
+    spooled_bytes += size;
+    return 0;
+}
+
+static void drop_entry(int i) {
+    spooled_bytes -= entries[i].size;
+    memmove(&entries[i], &entries[i + 1], (num_entries - i - 1) * sizeof(entry));
+    num_entries--;
+}
+
+// Rewrites the manifest with only the pending entries. Call with lock held.
+static int compact(void) {
+    char tmp[256];
+    char path[256];
+    spool_path(tmp, sizeof(tmp), SPOOL_MANIFEST ".tmp");
+    spool_path(path, sizeof(path), SPOOL_MANIFEST);
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        log_error("Failed to create %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < num_entries; i++) {
+        fprintf(fp, "add %" PRIu32 " %s %" PRIu64 "\n", entries[i].seq, entries[i].name,
+                entries[i].size);
+    }
+    // The new manifest has to be on disk before it replaces the old one
+    bool ok = fflush(fp) == 0 && fdatasync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        log_error("Failed to rewrite the spool manifest: %s", strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    fsync(dir_fd);
+
+    if (manifest_fd >= 0) {
+        close(manifest_fd);
+    }
+    manifest_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    finished_records = 0;
+    return manifest_fd >= 0 ? 0 : -1;
+}
+
+// Records that an entry left the spool, then deletes its file. Call with lock held.
+static void finish_entry(int i) {
+    char line[32];
+    snprintf(line, sizeof(line), "done %" PRIu32 "\n", entries[i].seq);
+    if (append_record(line) != 0) {
+        // Leaving the file means it is sent again next run, which beats losing it
+        drop_entry(i);
+        return;
+    }
+
+    char path[256];
+    spool_path(path, sizeof(path), entries[i].name);
+    unlink(path);
+    drop_entry(i);
+
+    if (++finished_records >= SPOOL_COMPACT_RECORDS) {
+        compact();
+    }
+}
+
+// Drops the oldest entries not being sent until incoming more bytes fit. Call with lock held.
+static void enforce_budget(uint64_t incoming) {
+    while (spooled_bytes + incoming > cfg.max_bytes) {
+        int oldest = -1;
+        for (int i = 0; i < num_entries && oldest < 0; i++) {
+            if (!entries[i].in_flight) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0) {
+            return;
+        }
+        log_warn("Spool over %" PRIu64 " bytes, dropping %s", cfg.max_bytes,
+                 entries[oldest].name);
+        finish_entry(oldest);
+    }
+}
+
+// Replays the manifest into entries
+static void load_manifest(void) {
+    char path[256];
+    spool_path(path, sizeof(path), SPOOL_MANIFEST);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        uint32_t seq;
+        uint64_t size;
+        char name[SPOOL_NAME_MAX];
+
+        // A line cut short by a crash does not parse and is skipped
+        if (sscanf(line, "add %" SCNu32 " %95s %" SCNu64, &seq, name, &size) == 3 &&
+            strchr(line, '\n')) {
+            char file[256];
+            struct stat st;
+            spool_path(file, sizeof(file), name);
+            if (stat(file, &st) == 0 && find_entry(seq) < 0) {
+                add_entry(seq, name, st.st_size, NULL);
+            }
+        } else if (sscanf(line, "done %" SCNu32, &seq) == 1 && strchr(line, '\n')) {
+            int i = find_entry(seq);
+            if (i >= 0) {
+                drop_entry(i);
+            }
+        } else {
+            continue;
+        }
+        if (seq >= next_seq) {
+            next_seq = seq + 1;
+        }
+    }
+    fclose(fp);
+}
+
+// Deletes files the manifest does not list: sent ones whose unlink was cut short, and copies
+// whose "add" line never made it
+static void remove_orphans(void) {
+    DIR *dp = opendir(cfg.dir);
+    if (!dp) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(dp)) != NULL) {
+        if (e->d_name[0] == '.' || strcmp(e->d_name, SPOOL_MANIFEST) == 0) {
+            continue;
+        }
+        bool listed = false;
+        for (int i = 0; i < num_entries && !listed; i++) {
+            listed = strcmp(entries[i].name, e->d_name) == 0;
+        }
+        if (!listed) {
+            unlinkat(dir_fd, e->d_name, 0);
+        }
+    }
+    closedir(dp);
+}
+
+// Copies src to dst with the data on disk before returning
+static int copy_file(const char *src, const char *dst, uint64_t size) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    // sendfile copies between files too, without the data passing through user space
+    uint64_t copied = 0;
+    while (copied < size) {
+        ssize_t n = sendfile(out, in, NULL, size - copied);
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+    int result = (copied == size && fsync(out) == 0) ? 0 : -1;
+    close(in);
+    close(out);
+    if (result != 0) {
+        unlink(dst);
+    }
+    return result;
+}
+
+// Called on the upload thread when a file from the current batch is done
+static void on_uploaded(uint32_t job_id, UploadResult result, void *arg) {
+    (void)job_id;
+    uint32_t seq = (uint32_t)(uintptr_t)arg;
+    bool sent = result == UPLOAD_OK;
+
+    pthread_mutex_lock(&lock);
+    int i = find_entry(seq);
+    if (i >= 0) {
+        entries[i].in_flight = false;
+        if (sent) {
+            finish_entry(i);
+        }
+    }
+    if (!sent) {
+        batch_failures++;
+    }
+    batch_outstanding--;
+    // Cancelled by spool_exit, which is not a delivery attempt
+    bool report = !(result == UPLOAD_DROPPED && stopping);
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    if (report && cfg.callback) {
+        cfg.callback(seq, sent, cfg.arg);
+    }
+}
+
+static void wait_until(uint64_t deadline_ms) {
+    struct timespec ts = {
+        .tv_sec = deadline_ms / 1000,
+        .tv_nsec = (deadline_ms % 1000) * 1000000,
+    };
+    pthread_cond_timedwait(&changed, &lock, &ts);
+}
+
+static void *drain_loop(void *arg) {
+    (void)arg;
+    uint64_t backoff = 0;
+    uint64_t retry_at = 0;
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        if (num_entries == 0) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        if (now_ms() < retry_at) {
+            wait_until(retry_at);
+            continue;
+        }
+
+        // The oldest files go out together. They share a connection only if lib/upload is framed
+        // or reuses connections.
+        uint32_t batch[SPOOL_BATCH];
+        int batch_size = 0;
+        for (int i = 0; i < num_entries && batch_size < SPOOL_BATCH; i++) {
+            entries[i].in_flight = true;
+            batch[batch_size++] = entries[i].seq;
+        }
+        batch_outstanding = batch_size;
+        batch_failures = 0;
+
+        for (int k = 0; k < batch_size; k++) {
+            uint32_t id = 0;
+            if (!stopping) {
+                char path[UPLOAD_PATH_MAX];
+                spool_path(path, sizeof(path), entries[find_entry(batch[k])].name);
+                // Unlocked so on_uploaded can run for the files already submitted
+                pthread_mutex_unlock(&lock);
+                id = upload_submit(path, on_uploaded, (void *)(uintptr_t)batch[k]);
+                pthread_mutex_lock(&lock);
+            }
+            if (id == 0) {
+                int i = find_entry(batch[k]);
+                if (i >= 0) {
+                    entries[i].in_flight = false;
+                }
+                batch_failures++;
+                batch_outstanding--;
+            }
+        }
+        // spool_exit cancels what is left of the batch once this thread is out of the way
+        while (batch_outstanding > 0 && !stopping) {
+            pthread_cond_wait(&changed, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+
+        if (batch_failures > 0) {
+            backoff = backoff ? backoff * 2 : SPOOL_BACKOFF_MIN_MS;
+            if (backoff > SPOOL_BACKOFF_MAX_MS) {
+                backoff = SPOOL_BACKOFF_MAX_MS;
+            }
+            retry_at = now_ms() + backoff;
+            log_warn("%d of %d spooled uploads failed, retrying in %" PRIu64 " ms",
+                     batch_failures, batch_size, backoff);
+        } else {
+            backoff = 0;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int spool_init(const SpoolConfig *config) {
+    if (running) {
+        return 0;
+    }
+    cfg = *config;
+    num_entries = 0;
+    spooled_bytes = 0;
+    next_seq = 1;
+    stopping = false;
+
+    if (mkdir(cfg.dir, 0755) != 0 && errno != EEXIST) {
+        log_error("Failed to create %s: %s", cfg.dir, strerror(errno));
+        return -1;
+    }
+    dir_fd = open(cfg.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        log_error("Failed to open %s: %s", cfg.dir, strerror(errno));
+        return -1;
+    }
+
+    load_manifest();
+    if (compact() != 0) {
+        close(dir_fd);
+        dir_fd = -1;
+        return -1;
+    }
+    remove_orphans();
+    if (num_entries > 0) {
+        log_info("Spool has %d files (%" PRIu64 " bytes) left from last time", num_entries,
+                 spooled_bytes);
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&drain_thread, NULL, drain_loop, NULL) != 0) {
+        log_error("Failed to start the spool thread");
+        spool_exit();
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void spool_exit() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+        pthread_join(drain_thread, NULL);
+        // The rest of the batch stays spooled for the next run instead of holding up the exit
+        // until its deadlines pass
+        upload_cancel_all();
+        pthread_cond_destroy(&changed);
+        running = false;
+    }
+
+    if (manifest_fd >= 0) {
+        close(manifest_fd);
+        manifest_fd = -1;
+    }
+    if (dir_fd >= 0) {
+        close(dir_fd);
+        dir_fd = -1;
+    }
+    free(entries);
+    entries = NULL;
+    num_entries = 0;
+    max_entries = 0;
+}
+
+uint32_t spool_enqueue(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        log_error("Cannot spool %s", path);
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    // The same picture sent again before the last copy went out is only spooled once
+    int pending = find_source(&st);
+    if (pending >= 0) {
+        uint32_t seq = entries[pending].seq;
+        pthread_mutex_unlock(&lock);
+        log_debug("%s is already spooled as %" PRIu32, path, seq);
+        return seq;
+    }
+    uint32_t seq = next_seq++;
+    pthread_mutex_unlock(&lock);
+
+    // The sequence number keeps names unique. Anything odd in the base name becomes '_' so the
+    // manifest stays one word per field.
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char name[SPOOL_NAME_MAX];
+    int len = snprintf(name, sizeof(name), "%08" PRIu32 "-%s", seq, base);
+    for (int i = 9; i < len && i < SPOOL_NAME_MAX - 1; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '.' && name[i] != '-') {
+            name[i] = '_';
+        }
+    }
+
+    // A copy, not a link, so rewriting the original cannot change what gets sent
+    char dst[256];
+    spool_path(dst, sizeof(dst), name);
+    if (copy_file(path, dst, st.st_size) != 0) {
+        log_error("Failed to copy %s into the spool: %s", path, strerror(errno));
+        return 0;
+    }
+    fsync(dir_fd);
+
+    char line[160];
+    snprintf(line, sizeof(line), "add %" PRIu32 " %s %" PRIu64 "\n", seq, name,
+             (uint64_t)st.st_size);
+
+    pthread_mutex_lock(&lock);
+    enforce_budget(st.st_size);
+    if (append_record(line) != 0 || add_entry(seq, name, st.st_size, &st) != 0) {
+        pthread_mutex_unlock(&lock);
+        unlink(dst);
+        return 0;
+    }
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return seq;
+}
+
+int spool_pending() {
+    pthread_mutex_lock(&lock);
+    int pending = num_entries;
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
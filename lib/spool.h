@@ -0,0 +1,90 @@
+#ifndef __SPOOL_H
+#define __SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Name of the manifest inside the spool directory
+#define SPOOL_MANIFEST "manifest"
+
+// Most files handed to lib/upload per drain batch. Matches the upload queue so none are turned
+// away. A batch only saves handshakes when UploadConfig.framed or reuse_connections is set.
+// Without them every file still opens its own connection, though max_in_flight of them overlap.
+#define SPOOL_BATCH 8
+
+// Backoff after a batch with failures, doubling up to the maximum
+#define SPOOL_BACKOFF_MIN_MS 1000
+#define SPOOL_BACKOFF_MAX_MS 300000
+
+// Finished records in the manifest before it is rewritten with only the pending ones
+#define SPOOL_COMPACT_RECORDS 256
+
+/*
+ * Called after every delivery attempt. Runs on the upload thread, so it should be quick.
+ *
+ * seq: The spool entry's sequence number, as returned by spool_enqueue.
+ * sent: true if the file was delivered and left the spool, false if it stays for a retry.
+ *
+ * Not called for uploads spool_exit cancels.
+ * arg: SpoolConfig.arg.
+ */
+typedef void (*SpoolCallback)(uint32_t seq, bool sent, void *arg);
+
+typedef struct {
+    const char *dir;        // Created if missing. Files are copied in here.
+    uint64_t max_bytes;     // Once the spool holds more than this the oldest files are dropped
+    SpoolCallback callback; // Can be NULL
+    void *arg;
+} SpoolConfig;
+
+/**
+ * Description:
+ *  Opens the spool, picks up whatever a previous run left pending and starts draining it through
+ *  lib/upload, which must already be running.
+ *
+ *  The manifest is append-only: a line is written and fdatasync'd when a file enters the spool
+ *  and when it leaves. A crash at any point leaves either the file pending or gone, never a
+ *  manifest line for a file that is not there.
+ *
+ * Arguments:
+ *  config: The spool directory and budget. dir must stay valid until spool_exit.
+ *
+ * Return:
+ *  0 on success, -1 on failure.
+ */
+int spool_init(const SpoolConfig *config);
+
+/**
+ * Description:
+ *  Stops draining and cancels the uploads of the batch being sent with upload_cancel_all, so call
+ *  it before upload_exit. Anything not delivered stays on disk for the next run.
+ *
+ * Arguments:
+ *  None
+ */
+void spool_exit();
+
+/**
+ * Description:
+ *  Durably adds a file to the spool. It is copied into the spool directory and is safe on disk
+ *  before this returns, so the original can be changed or deleted right away. A file spooled
+ *  earlier in this run and not changed since is not copied again while that entry is pending.
+ *
+ * Arguments:
+ *  path: The file to deliver.
+ *
+ * Return:
+ *  The entry's sequence number, the pending entry's if there already is one, or 0 on failure.
+ */
+uint32_t spool_enqueue(const char *path);
+
+/**
+ * Description:
+ *  Returns how many files are waiting to be delivered.
+ *
+ * Arguments:
+ *  None
+ */
+int spool_pending();
+
+#endif
@@ -0,0 +1,277 @@
+#include <string.h>
+
+#include "st7735_emu.h"
+
+// The commands the emulator models. Everything else is counted and its parameters ignored.
+#define ST7735_NOP 0x00
+#define ST7735_SWRESET 0x01
+#define ST7735_SLPIN 0x10
+#define ST7735_SLPOUT 0x11
+#define ST7735_PTLON 0x12
+#define ST7735_NORON 0x13
+#define ST7735_INVOFF 0x20
+#define ST7735_INVON 0x21
+#define ST7735_DISPOFF 0x28
+#define ST7735_DISPON 0x29
+#define ST7735_CASET 0x2A
+#define ST7735_RASET 0x2B
+#define ST7735_RAMWR 0x2C
+#define ST7735_MADCTL 0x36
+#define ST7735_COLMOD 0x3A
+
+// MADCTL bits
+#define MADCTL_MY 0x80
+#define MADCTL_MX 0x40
+#define MADCTL_MV 0x20
+
+static void reset_registers(st7735_emu *emu) {
+    emu->command = ST7735_NOP;
+    emu->param_index = 0;
+    emu->madctl = 0;
+    emu->colmod = 0x06;
+    emu->sleeping = true;
+    emu->display_on = false;
+    emu->inverted = false;
+    emu->col_start = 0;
+    emu->col_end = ST7735_GRAM_WIDTH - 1;
+    emu->row_start = 0;
+    emu->row_end = ST7735_GRAM_HEIGHT - 1;
+    emu->col = 0;
+    emu->row = 0;
+    emu->high_byte = -1;
+}
+
+void st7735_emu_init(st7735_emu *emu) {
+    memset(emu, 0, sizeof(*emu));
+    reset_registers(emu);
+}
+
+static void add_stats(st7735_stats *into, const st7735_stats *from) {
+    into->commands += from->commands;
+    into->windows += from->windows;
+    into->data_bytes += from->data_bytes;
+    into->pixels += from->pixels;
+    into->stray_bytes += from->stray_bytes;
+}
+
+// Stores a pixel at the address counter, then moves the counter through the window
+static void write_pixel(st7735_emu *emu, uint16_t color) {
+    uint16_t x = emu->col;
+    uint16_t y = emu->row;
+
+    if (emu->madctl & MADCTL_MV) {
+        uint16_t t = x;
+        x = y;
+        y = t;
+    }
+    if (emu->madctl & MADCTL_MX) {
+        x = ST7735_GRAM_WIDTH - 1 - x;
+    }
+    if (emu->madctl & MADCTL_MY) {
+        y = ST7735_GRAM_HEIGHT - 1 - y;
+    }
+    // Out of range addresses are dropped, like on the chip
+    if (x < ST7735_GRAM_WIDTH && y < ST7735_GRAM_HEIGHT) {
+        emu->gram[y][x] = color;
+    }
+    emu->frame.pixels++;
+
+    if (emu->col >= emu->col_end) {
+        emu->col = emu->col_start;
+        emu->row = emu->row >= emu->row_end ? emu->row_start : emu->row + 1;
+    } else {
+        emu->col++;
+    }
+}
+
+static void command(st7735_emu *emu, uint8_t byte) {
+    emu->frame.commands++;
+    emu->command = byte;
+    emu->param_index = 0;
+    emu->high_byte = -1;
+
+    switch (byte) {
+    case ST7735_SWRESET:
+        reset_registers(emu);
+        emu->command = byte;
+        break;
+    case ST7735_SLPIN:
+        emu->sleeping = true;
+        break;
+    case ST7735_SLPOUT:
+        emu->sleeping = false;
+        break;
+    case ST7735_INVOFF:
+        emu->inverted = false;
+        break;
+    case ST7735_INVON:
+        emu->inverted = true;
+        break;
+    case ST7735_DISPOFF:
+        emu->display_on = false;
+        break;
+    case ST7735_DISPON:
+        emu->display_on = true;
+        break;
+    case ST7735_RAMWR:
+        emu->col = emu->col_start;
+        emu->row = emu->row_start;
+        emu->frame.windows++;
+        break;
+    }
+}
+
+static void data(st7735_emu *emu, uint8_t byte) {
+    emu->frame.data_bytes++;
+
+    switch (emu->command) {
+    case ST7735_CASET:
+    case ST7735_RASET:
+        if (emu->param_index < 4) {
+            emu->params[emu->param_index] = byte;
+        }
+        if (++emu->param_index == 4) {
+            uint16_t start = (uint16_t)(emu->params[0] << 8 | emu->params[1]);
+            uint16_t end = (uint16_t)(emu->params[2] << 8 | emu->params[3]);
+            if (emu->command == ST7735_CASET) {
+                emu->col_start = start;
+                emu->col_end = end;
+            } else {
+                emu->row_start = start;
+                emu->row_end = end;
+            }
+        }
+        break;
+    case ST7735_RAMWR:
+        // Pixels are decoded as RGB565 (COLMOD 0x05), the only format lcd.c uses
+        if (emu->high_byte < 0) {
+            emu->high_byte = byte;
+        } else {
+            write_pixel(emu, (uint16_t)(emu->high_byte << 8 | byte));
+            emu->high_byte = -1;
+        }
+        break;
+    case ST7735_MADCTL:
+        if (emu->param_index++ == 0) {
+            emu->madctl = byte;
+        }
+        break;
+    case ST7735_COLMOD:
+        if (emu->param_index++ == 0) {
+            emu->colmod = byte & 0x07;
+        }
+        break;
+    case ST7735_NOP:
+    case ST7735_SWRESET:
+    case ST7735_SLPIN:
+    case ST7735_SLPOUT:
+    case ST7735_PTLON:
+    case ST7735_NORON:
+    case ST7735_INVOFF:
+    case ST7735_INVON:
+    case ST7735_DISPOFF:
+    case ST7735_DISPON:
+        emu->frame.stray_bytes++;
+        break;
+    default:
+        emu->param_index++;
+        break;
+    }
+}
+
+void st7735_emu_write(st7735_emu *emu, bool dc, const uint8_t *bytes, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (dc) {
+            data(emu, bytes[i]);
+        } else {
+            command(emu, bytes[i]);
+        }
+    }
+}
+
+void st7735_emu_end_frame(st7735_emu *emu, st7735_stats *stats) {
+    if (stats) {
+        *stats = emu->frame;
+    }
+    add_stats(&emu->total, &emu->frame);
+    memset(&emu->frame, 0, sizeof(emu->frame));
+    emu->frames++;
+}
+
+double st7735_wire_time_us(const st7735_stats *stats, uint32_t divider) {
+    double bits = 8.0 * ((double)stats->commands + (double)stats->data_bytes);
+    return bits * divider / ST7735_SPI_CORE_HZ * 1e6;
+}
+
+uint16_t st7735_emu_panel_pixel(const st7735_emu *emu, int x, int y) {
+    // The panel is mounted rotated 180 degrees relative to frame memory
+    int gram_x = ST7735_PANEL_X + (ST7735_PANEL_WIDTH - 1 - x);
+    int gram_y = ST7735_PANEL_Y + (ST7735_PANEL_HEIGHT - 1 - y);
+    return emu->gram[gram_y][gram_x];
+}
+
+static void put_le(uint8_t *p, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+int st7735_emu_write_bmp(const st7735_emu *emu, const char *path) {
+    const uint32_t row_size = ST7735_PANEL_WIDTH * 3; // Already a multiple of 4
+    const uint32_t image_size = row_size * ST7735_PANEL_HEIGHT;
+    uint8_t header[54] = {'B', 'M'};
+
+    put_le(header + 2, sizeof(header) + image_size, 4);
+    put_le(header + 10, sizeof(header), 4);
+    put_le(header + 14, 40, 4);
+    put_le(header + 18, ST7735_PANEL_WIDTH, 4);
+    put_le(header + 22, ST7735_PANEL_HEIGHT, 4);
+    put_le(header + 26, 1, 2);
+    put_le(header + 28, 24, 2);
+    put_le(header + 34, image_size, 4);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return -1;
+    }
+    fwrite(header, 1, sizeof(header), fp);
+
+    // BMP rows go bottom to top, each pixel blue, green, red
+    uint8_t row[ST7735_PANEL_WIDTH * 3];
+    for (int y = ST7735_PANEL_HEIGHT - 1; y >= 0; y--) {
+        for (int x = 0; x < ST7735_PANEL_WIDTH; x++) {
+            uint16_t color = st7735_emu_panel_pixel(emu, x, y);
+            if (emu->inverted) {
+                color = ~color;
+            }
+            uint8_t red = (color >> 11) & 0x1F;
+            uint8_t green = (color >> 5) & 0x3F;
+            uint8_t blue = color & 0x1F;
+            row[x * 3] = (uint8_t)(blue << 3 | blue >> 2);
+            row[x * 3 + 1] = (uint8_t)(green << 2 | green >> 4);
+            row[x * 3 + 2] = (uint8_t)(red << 3 | red >> 2);
+        }
+        fwrite(row, 1, row_size, fp);
+    }
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int st7735_trace_read(FILE *fp, uint8_t *type, uint8_t *buf, uint32_t *len, uint32_t cap) {
+    uint8_t header[5];
+    size_t got = fread(header, 1, sizeof(header), fp);
+    if (got == 0) {
+        return 0;
+    }
+    if (got != sizeof(header)) {
+        return -1;
+    }
+
+    *type = header[0];
+    *len = (uint32_t)header[1] | (uint32_t)header[2] << 8 | (uint32_t)header[3] << 16 |
+           (uint32_t)header[4] << 24;
+    if (*len > cap || fread(buf, 1, *len, fp) != *len) {
+        return -1;
+    }
+    return 1;
+}
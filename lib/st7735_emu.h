@@ -0,0 +1,146 @@
+#ifndef __ST7735_EMU_H
+#define __ST7735_EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Size of the ST7735 frame memory
+#define ST7735_GRAM_WIDTH 132
+#define ST7735_GRAM_HEIGHT 162
+
+// Where the 128x128 panel sits in frame memory and how it is mounted. With these, the pixels
+// lcd.c writes to (x, y) show up at (x, y) in the panel view.
+#define ST7735_PANEL_WIDTH 128
+#define ST7735_PANEL_HEIGHT 128
+#define ST7735_PANEL_X 3
+#define ST7735_PANEL_Y 32
+
+// Clock the SPI divider is applied to. This is the core clock on a Raspberry Pi 3.
+#define ST7735_SPI_CORE_HZ 250000000.0
+
+// SPI trace file records. Each record is a one byte type, a four byte little-endian length and
+// then that many bytes. Command and data records hold the bytes sent while the DC line was low or
+// high. Frame records have no payload and mark the end of a display_flush.
+#define ST7735_TRACE_COMMAND 'C'
+#define ST7735_TRACE_DATA 'D'
+#define ST7735_TRACE_FRAME 'F'
+
+typedef struct {
+    uint32_t commands;    // Command bytes (DC low)
+    uint32_t windows;     // Memory writes started (0x2C)
+    uint32_t data_bytes;  // Data bytes (DC high), including command parameters
+    uint32_t pixels;      // Pixels written to frame memory
+    uint32_t stray_bytes; // Data bytes that came without a command expecting them
+} st7735_stats;
+
+typedef struct {
+    uint16_t gram[ST7735_GRAM_HEIGHT][ST7735_GRAM_WIDTH]; // RGB565, host byte order
+
+    // Register state
+    uint8_t command;
+    uint32_t param_index;
+    uint8_t params[4];
+    uint8_t madctl;
+    uint8_t colmod;
+    bool sleeping;
+    bool display_on;
+    bool inverted;
+
+    // Address window and counter, in the coordinates set by 0x2A/0x2B
+    uint16_t col_start;
+    uint16_t col_end;
+    uint16_t row_start;
+    uint16_t row_end;
+    uint16_t col;
+    uint16_t row;
+    int16_t high_byte; // First byte of a pixel waiting for its second, or -1
+
+    st7735_stats frame; // Since the last st7735_emu_end_frame
+    st7735_stats total; // Since st7735_emu_init
+    uint32_t frames;
+} st7735_emu;
+
+/**
+ * Description:
+ *  Puts the emulator into its power-on state: frame memory cleared to black, a full address
+ *  window and zeroed counters.
+ *
+ * Arguments:
+ *  emu: The emulator to set up.
+ */
+void st7735_emu_init(st7735_emu *emu);
+
+/**
+ * Description:
+ *  Feeds bytes sent over SPI into the emulator.
+ *
+ * Arguments:
+ *  emu: The emulator.
+ *  dc: The level of the DC line while the bytes were sent. Low is a command, high is data.
+ *  data: The bytes.
+ *  len: How many bytes there are.
+ */
+void st7735_emu_write(st7735_emu *emu, bool dc, const uint8_t *data, uint32_t len);
+
+/**
+ * Description:
+ *  Ends the current frame. The counters for the frame are copied out and reset.
+ *
+ * Arguments:
+ *  emu: The emulator.
+ *  stats: Where the frame's counters are written. Can be NULL.
+ */
+void st7735_emu_end_frame(st7735_emu *emu, st7735_stats *stats);
+
+/**
+ * Description:
+ *  Returns how long the bytes counted in stats take on the wire at the given SPI clock divider.
+ *
+ * Arguments:
+ *  stats: Counters from st7735_emu_end_frame or the emulator's running total.
+ *  divider: The bcm2835 SPI clock divider, such as BCM2835_SPI_CLOCK_DIVIDER_8.
+ */
+double st7735_wire_time_us(const st7735_stats *stats, uint32_t divider);
+
+/**
+ * Description:
+ *  Returns the pixel shown at (x, y) on the panel, in host byte order RGB565.
+ *
+ * Arguments:
+ *  emu: The emulator.
+ *  x: Column on the panel, 0 to ST7735_PANEL_WIDTH - 1.
+ *  y: Row on the panel, 0 to ST7735_PANEL_HEIGHT - 1.
+ */
+uint16_t st7735_emu_panel_pixel(const st7735_emu *emu, int x, int y);
+
+/**
+ * Description:
+ *  Saves what the panel is showing as a 24-bit BMP.
+ *
+ * Arguments:
+ *  emu: The emulator.
+ *  path: The file to write.
+ *
+ * Return:
+ *  0 on success, -1 if the file could not be written.
+ */
+int st7735_emu_write_bmp(const st7735_emu *emu, const char *path);
+
+/**
+ * Description:
+ *  Reads the next record from an SPI trace file.
+ *
+ * Arguments:
+ *  fp: The trace file.
+ *  type: Where the record type is written.
+ *  buf: Where the payload is written.
+ *  len: Where the payload length is written.
+ *  cap: How many bytes buf can hold. Longer payloads are an error.
+ *
+ * Return:
+ *  1 if a record was read, 0 at the end of the file and -1 if the file is malformed.
+ */
+int st7735_trace_read(FILE *fp, uint8_t *type, uint8_t *buf, uint32_t *len, uint32_t cap);
+
+#endif
@@ -0,0 +1,460 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "log.h"
+#include "upload.h"
+
+typedef struct {
+    uint32_t id;
+    char path[UPLOAD_PATH_MAX];
+    UploadCallback callback;
+    void *arg;
+} job;
+
+typedef struct {
+    bool busy;
+    job job;
+    ClientUpload upload;
+    uint64_t started_ms;
+} active_upload;
+
+static UploadConfig cfg;
+
+static job queue[UPLOAD_QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_count = 0;
+static int running_jobs = 0;
+static uint32_t next_id = 1;
+static bool stopping = false;
+static bool cancelling = false; // upload_cancel_all is waiting for the upload thread
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cancelled = PTHREAD_COND_INITIALIZER;
+
+// Only touched by the upload thread
+static active_upload active[UPLOAD_MAX_IN_FLIGHT];
+
+// Framed mode only, also only touched by the upload thread. Jobs on the stream are found by seq.
+static ClientStream stream;
+static bool stream_open = false;
+static active_upload framed[CLIENT_STREAM_WINDOW];
+static uint32_t framed_seq[CLIENT_STREAM_WINDOW];
+
+static pthread_t upload_thread;
+static bool running = false;
+static int wake_fd = -1; // Written when a job is queued or the thread should stop
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void wake(void) {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        log_error("Failed to wake the upload thread");
+    }
+}
+
+static void end_job(active_upload *slot, UploadResult result) {
+    slot->busy = false;
+
+    pthread_mutex_lock(&lock);
+    running_jobs--;
+    pthread_mutex_unlock(&lock);
+
+    if (slot->job.callback) {
+        slot->job.callback(slot->job.id, result, slot->job.arg);
+    }
+}
+
+// Reports how a job ended and frees its slot
+static void finish_job(active_upload *slot, ClientError error, const char *how) {
+    UploadResult result = error == CLIENT_OK ? UPLOAD_OK : UPLOAD_FAILED;
+    if (result == UPLOAD_OK) {
+        log_info("Upload %u: sent %s in %llu ms (%s)", slot->job.id, slot->job.path,
+                 (unsigned long long)(now_ms() - slot->started_ms), how);
+    } else {
+        log_error("Upload %u: %s: %s", slot->job.id, slot->job.path, client_strerror(error));
+    }
+    end_job(slot, result);
+}
+
+// Calls the callbacks of jobs taken out of the queue, outside the lock so they can submit again
+static void report_dropped(const job *jobs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].callback) {
+            jobs[i].callback(jobs[i].id, UPLOAD_DROPPED, jobs[i].arg);
+        }
+    }
+}
+
+// Takes every queued job out of the queue into out. Call with lock held.
+static int take_all_jobs(job *out) {
+    int count = queue_count;
+    for (int i = 0; i < count; i++) {
+        out[i] = queue[(queue_head + i) % UPLOAD_QUEUE_SIZE];
+    }
+    queue_head = 0;
+    queue_count = 0;
+    return count;
+}
+
+// Abandons every upload in flight for upload_cancel_all
+static void cancel_active(void) {
+    for (int i = 0; i < UPLOAD_MAX_IN_FLIGHT; i++) {
+        if (active[i].busy) {
+            client_upload_finish(&active[i].upload);
+            log_warn("Upload %u: %s: cancelled", active[i].job.id, active[i].job.path);
+            end_job(&active[i], UPLOAD_DROPPED);
+        }
+    }
+    if (stream_open) {
+        client_stream_close(&stream);
+        stream_open = false;
+    }
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        if (framed[i].busy) {
+            log_warn("Upload %u: %s: cancelled", framed[i].job.id, framed[i].job.path);
+            end_job(&framed[i], UPLOAD_DROPPED);
+        }
+    }
+}
+
+static void complete(active_upload *slot) {
+    ClientError error = slot->upload.error;
+    const char *how = slot->upload.reused ? "reused connection" : "new connection";
+    client_upload_finish(&slot->upload);
+    finish_job(slot, error, how);
+}
+
+// Takes the next queued job, or returns false if there is none
+static bool take_job(job *out) {
+    pthread_mutex_lock(&lock);
+    if (queue_count == 0 || stopping) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    *out = queue[queue_head];
+    queue_head = (queue_head + 1) % UPLOAD_QUEUE_SIZE;
+    queue_count--;
+    running_jobs++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+// Moves queued jobs onto the stream until the queue runs out or the window is full. The stream is
+// opened when there is work and handed back to the connection pool once nothing is outstanding.
+static void start_frames(void) {
+    const Config config = {.host = cfg.host, .port = cfg.port, .hw_id = cfg.hw_id};
+
+    if (stream_open && (stream.phase == CLIENT_DONE || client_stream_outstanding(&stream) == 0)) {
+        client_stream_close(&stream);
+        stream_open = false;
+    }
+
+    for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+        active_upload *slot = &framed[i];
+        if (slot->busy) {
+            continue;
+        }
+        if (stream_open && client_stream_space(&stream) == 0) {
+            return;
+        }
+        if (!take_job(&slot->job)) {
+            return;
+        }
+        slot->busy = true;
+        slot->started_ms = now_ms();
+
+        if (!stream_open && client_stream_open(&stream, &config, NULL) != 0) {
+            finish_job(slot, stream.error, "");
+            client_stream_close(&stream);
+            continue;
+        }
+        stream_open = true;
+        framed_seq[i] = client_stream_push(&stream, slot->job.path);
+        if (framed_seq[i] == 0) {
+            finish_job(slot, CLIENT_ERR_FILE, "");
+        }
+    }
+}
+
+static void complete_frames(const ClientAck *acks, int num_acks) {
+    for (int a = 0; a < num_acks; a++) {
+        for (int i = 0; i < CLIENT_STREAM_WINDOW; i++) {
+            if (framed[i].busy && framed_seq[i] == acks[a].seq) {
+                finish_job(&framed[i], acks[a].error,
+                           stream.reused ? "framed, reused connection" : "framed, new connection");
+                break;
+            }
+        }
+    }
+}
+
+// Moves queued jobs into free slots until either runs out
+static void start_jobs(void) {
+    const Config config = {
+        .host = cfg.host,
+        .port = cfg.port,
+        .hw_id = cfg.hw_id,
+        .reuse_connection = cfg.reuse_connections,
+    };
+
+    for (int i = 0; i < cfg.max_in_flight; i++) {
+        active_upload *slot = &active[i];
+        if (slot->busy) {
+            continue;
+        }
+        if (!take_job(&slot->job)) {
+            return;
+        }
+        slot->busy = true;
+        slot->started_ms = now_ms();
+        if (client_upload_start(&slot->upload, &config, slot->job.path, NULL) != 0) {
+            complete(slot);
+        }
+    }
+}
+
+// Drives every upload in flight from this one thread, each socket waiting in the same poll
+static void *upload_loop(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        bool cancel = cancelling;
+        pthread_mutex_unlock(&lock);
+        if (cancel) {
+            cancel_active();
+            pthread_mutex_lock(&lock);
+            cancelling = false;
+            pthread_cond_broadcast(&cancelled);
+            pthread_mutex_unlock(&lock);
+        }
+
+        if (cfg.framed) {
+            start_frames();
+        } else {
+            start_jobs();
+        }
+
+        // Each upload, and the stream in framed mode, gets a run of pollfds, one per connection
+        // attempt while it is connecting
+        struct pollfd fds[1 + (UPLOAD_MAX_IN_FLIGHT + 1) * CLIENT_MAX_ATTEMPTS] = {
+            {.fd = wake_fd, .events = POLLIN},
+        };
+        int first_fd[UPLOAD_MAX_IN_FLIGHT];
+        int num_fds[UPLOAD_MAX_IN_FLIGHT];
+        int nfds = 1;
+        int timeout = -1;
+        bool busy = false;
+        for (int i = 0; i < cfg.max_in_flight; i++) {
+            if (!active[i].busy) {
+                continue;
+            }
+            busy = true;
+            int t = client_upload_timeout(&active[i].upload);
+            if (timeout < 0 || t < timeout) {
+                timeout = t;
+            }
+            first_fd[i] = nfds;
+            num_fds[i] = client_upload_pollfds(&active[i].upload, &fds[nfds]);
+            nfds += num_fds[i];
+        }
+        int stream_first_fd = nfds;
+        int stream_num_fds = 0;
+        if (stream_open) {
+            busy = true;
+            int t = client_stream_timeout(&stream);
+            if (t >= 0 && (timeout < 0 || t < timeout)) {
+                timeout = t;
+            }
+            stream_num_fds = client_stream_pollfds(&stream, &fds[nfds]);
+            nfds += stream_num_fds;
+        }
+
+        pthread_mutex_lock(&lock);
+        bool done = stopping && !busy;
+        pthread_mutex_unlock(&lock);
+        if (done) {
+            break;
+        }
+
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR) {
+            log_error("Upload poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                log_error("Failed to read the upload wake event");
+            }
+        }
+
+        // Every upload is stepped, not just the ready ones, so deadlines are checked too
+        for (int i = 0; i < cfg.max_in_flight; i++) {
+            active_upload *slot = &active[i];
+            if (slot->busy && client_upload_step(&slot->upload, &fds[first_fd[i]], num_fds[i])) {
+                complete(slot);
+            }
+        }
+        if (stream_open) {
+            ClientAck acks[CLIENT_STREAM_WINDOW];
+            int num_acks =
+                client_stream_step(&stream, &fds[stream_first_fd], stream_num_fds, acks);
+            complete_frames(acks, num_acks);
+        }
+    }
+    if (stream_open) {
+        client_stream_close(&stream);
+        stream_open = false;
+    }
+    return NULL;
+}
+
+int upload_init(const UploadConfig *config) {
+    if (running) {
+        return 0;
+    }
+    if (config->max_in_flight < 1 || config->max_in_flight > UPLOAD_MAX_IN_FLIGHT) {
+        log_error("Uploads in flight must be between 1 and %d", UPLOAD_MAX_IN_FLIGHT);
+        return -1;
+    }
+
+    cfg = *config;
+    queue_head = 0;
+    queue_count = 0;
+    running_jobs = 0;
+    stopping = false;
+    memset(active, 0, sizeof(active));
+    memset(framed, 0, sizeof(framed));
+    stream_open = false;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        log_error("Failed to create the upload wake event: %s", strerror(errno));
+        return -1;
+    }
+    if (pthread_create(&upload_thread, NULL, upload_loop, NULL) != 0) {
+        log_error("Failed to start the upload thread");
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void upload_exit() {
+    if (!running) {
+        return;
+    }
+
+    job dropped[UPLOAD_QUEUE_SIZE];
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    int num_dropped = take_all_jobs(dropped);
+    pthread_mutex_unlock(&lock);
+    if (num_dropped > 0) {
+        log_warn("Dropping %d queued uploads", num_dropped);
+    }
+    report_dropped(dropped, num_dropped);
+
+    wake();
+    pthread_join(upload_thread, NULL);
+    running = false;
+    close(wake_fd);
+    wake_fd = -1;
+    client_pool_close_all();
+}
+
+void upload_cancel_all() {
+    job dropped[UPLOAD_QUEUE_SIZE];
+    pthread_mutex_lock(&lock);
+    if (!running || stopping) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    int num_dropped = take_all_jobs(dropped);
+    cancelling = true;
+    pthread_mutex_unlock(&lock);
+    report_dropped(dropped, num_dropped);
+
+    wake();
+    pthread_mutex_lock(&lock);
+    while (cancelling) {
+        pthread_cond_wait(&cancelled, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+uint32_t upload_submit(const char *path, UploadCallback callback, void *arg) {
+    if (strlen(path) >= UPLOAD_PATH_MAX) {
+        log_error("Upload path too long: %s", path);
+        return 0;
+    }
+
+    job dropped = {0};
+    uint32_t id = 0;
+
+    pthread_mutex_lock(&lock);
+    if (!running || stopping) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    if (cfg.coalesce) {
+        for (int i = 0; i < queue_count; i++) {
+            const job *waiting = &queue[(queue_head + i) % UPLOAD_QUEUE_SIZE];
+            if (strcmp(waiting->path, path) == 0) {
+                id = waiting->id;
+                pthread_mutex_unlock(&lock);
+                return id;
+            }
+        }
+    }
+
+    if (queue_count == UPLOAD_QUEUE_SIZE) {
+        if (cfg.policy == UPLOAD_DROP_NEWEST) {
+            pthread_mutex_unlock(&lock);
+            log_warn("Upload queue full, turning away %s", path);
+            return 0;
+        }
+        dropped = queue[queue_head];
+        queue_head = (queue_head + 1) % UPLOAD_QUEUE_SIZE;
+        queue_count--;
+    }
+
+    job *slot = &queue[(queue_head + queue_count) % UPLOAD_QUEUE_SIZE];
+    id = next_id++;
+    if (next_id == 0) {
+        next_id = 1;
+    }
+    slot->id = id;
+    strcpy(slot->path, path);
+    slot->callback = callback;
+    slot->arg = arg;
+    queue_count++;
+    pthread_mutex_unlock(&lock);
+    wake();
+
+    if (dropped.id != 0) {
+        log_warn("Upload queue full, dropping upload %u (%s)", dropped.id, dropped.path);
+        report_dropped(&dropped, 1);
+    }
+    return id;
+}
+
+int upload_pending() {
+    pthread_mutex_lock(&lock);
+    int pending = queue_count + running_jobs;
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
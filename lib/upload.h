@@ -0,0 +1,119 @@
+#ifndef __UPLOAD_H
+#define __UPLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most uploads that can be in flight at once
+#define UPLOAD_MAX_IN_FLIGHT 4
+
+// How many jobs can wait for a free upload slot. What happens when it is full depends on
+// UploadPolicy.
+#define UPLOAD_QUEUE_SIZE 8
+
+// Longest file path a job can carry, including the terminating null
+#define UPLOAD_PATH_MAX 256
+
+typedef enum {
+    UPLOAD_DROP_NEWEST, // A full queue turns new jobs away
+    UPLOAD_DROP_OLDEST, // A full queue drops its oldest waiting job to make room
+} UploadPolicy;
+
+typedef enum {
+    UPLOAD_OK,      // The file was sent and the server answered
+    UPLOAD_FAILED,  // The file could not be read or sent, or a deadline passed
+    UPLOAD_DROPPED, // Pushed out of a full queue, or cancelled before it finished
+} UploadResult;
+
+/*
+ * Called once for every job upload_submit accepted. Runs on the upload thread, or on the thread
+ * calling upload_submit, upload_cancel_all or upload_exit for jobs those drop from the queue.
+ * Every upload in flight waits on it, so it should be quick.
+ *
+ * job_id: The ID upload_submit returned.
+ * result: How the job ended.
+ * arg: The arg the job was submitted with.
+ */
+typedef void (*UploadCallback)(uint32_t job_id, UploadResult result, void *arg);
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *hw_id; // Sent ahead of every file
+    int max_in_flight; // 1 to UPLOAD_MAX_IN_FLIGHT
+    UploadPolicy policy;
+    bool coalesce; // A file that is already waiting in the queue is not queued a second time
+    // Plain uploads keep their connection open for the next one. See Config.reuse_connection.
+    bool reuse_connections;
+    // Send files as frames of the protocol in lib/frame.h, all on one connection with up to
+    // CLIENT_STREAM_WINDOW awaiting acks, instead of one file per round trip. max_in_flight is
+    // not used. The server has to speak the protocol, as tools/upload_server does. Files over
+    // FRAME_SEND_MAX bytes fail.
+    bool framed;
+} UploadConfig;
+
+/**
+ * Description:
+ *  Starts the upload thread. It runs up to max_in_flight uploads at once on non-blocking
+ *  sockets, each phase under the CLIENT_*_TIMEOUT_MS deadlines, so a stuck server costs a
+ *  slot for a bounded time rather than a thread forever. Files are sent straight from disk,
+ *  so memory and thread count stay the same however many jobs are submitted.
+ *
+ * Arguments:
+ *  config: Where to send files and how to queue them. The strings must stay valid until
+ *          upload_exit.
+ *
+ * Return:
+ *  0 on success, -1 on failure.
+ */
+int upload_init(const UploadConfig *config);
+
+/**
+ * Description:
+ *  Waits for the uploads in flight to finish (or hit their deadlines) and stops the thread.
+ *  Jobs still waiting in the queue are dropped, their callbacks called with UPLOAD_DROPPED, and
+ *  pooled connections are closed.
+ *
+ * Arguments:
+ *  None
+ */
+void upload_exit();
+
+/**
+ * Description:
+ *  Ends every job submitted so far without waiting for the server. Queued jobs are dropped and
+ *  uploads in flight abandoned, and each one's callback is called with UPLOAD_DROPPED before this
+ *  returns. The server may already have part or all of an abandoned file. Must not be called from
+ *  an UploadCallback.
+ *
+ * Arguments:
+ *  None
+ */
+void upload_cancel_all();
+
+/**
+ * Description:
+ *  Queues a file to be sent to the server.
+ *
+ * Arguments:
+ *  path: The file to send. It is opened when the job starts, not now.
+ *  callback: Called when the job ends. Can be NULL.
+ *  arg: Passed to callback.
+ *
+ * Return:
+ *  The job's ID. If coalescing is on and path is already waiting, the ID of the waiting job is
+ *  returned and its callback is the one that is called. 0 if the job was turned away.
+ */
+uint32_t upload_submit(const char *path, UploadCallback callback, void *arg);
+
+/**
+ * Description:
+ *  Returns how many jobs are waiting or being sent. A job no longer counts by the time its
+ *  callback runs.
+ *
+ * Arguments:
+ *  None
+ */
+int upload_pending();
+
+#endif
@@ -1,6 +1,6 @@
 #include <dirent.h>
-#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,9 +12,14 @@
 #include "lib/colors.h"
 #include "lib/device.h"
 #include "lib/display.h"
+#include "lib/evloop.h"
 #include "lib/fonts/fonts.h"
 #include "lib/image.h"
+#include "lib/input.h"
 #include "lib/log.h"
+#include "lib/render.h"
+#include "lib/spool.h"
+#include "lib/upload.h"
 
 #define VIEWER_FOLDER "viewer/"
 #define MAX_ENTRIES 8
@@ -26,18 +31,49 @@
 #define SELECTED_BG_COLOR BYU_BLUE
 #define SELECTED_FONT_COLOR BYU_LIGHT_SAND
 
-enum StatusState { STATUS_NONE, STATUS_SENDING, STATUS_SENT };
-volatile enum StatusState status_state = STATUS_NONE;
+// How often the render thread may push a frame to the screen
+#define RENDER_MAX_FPS 30
 
-typedef struct {
-    char filename[MAX_FILE_NAME];
-} ThreadArg;
+// How many uploads may be in flight at once
+#define UPLOADS_IN_FLIGHT 2
+
+// Send uploads as frames on one pipelined connection (see lib/frame.h). The course server only
+// takes the plain hw_id and file, tools/upload_server takes both.
+#define UPLOADS_FRAMED false
+
+// Keep plain upload connections open for the next upload. The course server takes one file per
+// connection, so only turn this on against a server that reads more, like tools/upload_server.
+// With this and UPLOADS_FRAMED both off, the spool drains a backlog one connection per file,
+// UPLOADS_IN_FLIGHT at a time.
+#define UPLOADS_REUSE false
+
+// Presses are copied here first, so they survive the server being down or the doorbell
+// restarting, and are sent from here
+#define SPOOL_FOLDER "spool"
+#define SPOOL_MAX_BYTES (64 * 1024 * 1024)
+
+// How long an opened image and the "Sent!" status stay up
+#define IMAGE_VIEW_MS 2000
+#define STATUS_SENT_MS 2000
+
+enum StatusState { STATUS_NONE, STATUS_SENDING, STATUS_SENT, STATUS_QUEUED };
+
+// Everything below is only touched on the event loop's thread, except upload_failures
+static enum StatusState status_state = STATUS_NONE;
+static char entries[MAX_ENTRIES][MAX_FILE_NAME];
+static int num_entries = 0;
+static int sel = 0;
+static bool viewing = false; // An image is on screen instead of the menu
+static int uploads_sent = 0; // Delivered since the last time the spool was empty
+static atomic_int upload_failures = 0;
+
+static int upload_event = -1;
+static int status_timer = -1;
+static int view_timer = -1;
 
 void intHandler(int sig) {
     (void)sig;
-    log_info("Exiting...");
-    display_exit();
-    exit(0);
+    evloop_stop();
 }
 
 static int get_entries(const char *folder, char entries[MAX_ENTRIES][MAX_FILE_NAME]) {
@@ -61,93 +97,193 @@ static int get_entries(const char *folder, char entries[MAX_ENTRIES][MAX_FILE_NA
     return count;
 }
 
+// Queues the status line, without ending the frame
+static void queue_status() {
+    const enum StatusState state = status_state;
+    const char *msg = (state == STATUS_SENDING)  ? "Sending..."
+                      : (state == STATUS_SENT)   ? "Sent!"
+                      : (state == STATUS_QUEUED) ? "Queued"
+                                                 : "";
+    render_draw_rectangle(0, DISPLAY_HEIGHT - 20, DISPLAY_WIDTH, DISPLAY_HEIGHT, BACKGROUND_COLOR,
+                          true, 1);
+    render_draw_string(10, DISPLAY_HEIGHT - 20, msg, &Font12, BACKGROUND_COLOR, FONT_COLOR);
+}
+
+static void draw_status() {
+    queue_status();
+    render_present();
+}
+
+static void set_status(enum StatusState state) {
+    status_state = state;
+    if (!viewing) {
+        draw_status();
+    }
+}
+
 static void draw_menu(char entries[MAX_ENTRIES][MAX_FILE_NAME], int num, int selected) {
-    display_clear(BACKGROUND_COLOR);
+    render_clear(BACKGROUND_COLOR);
 
     for (int i = 0; i < num; ++i) {
         const uint16_t fg = (i == selected) ? SELECTED_FONT_COLOR : FONT_COLOR;
         const uint16_t bg = (i == selected) ? SELECTED_BG_COLOR : BACKGROUND_COLOR;
-        display_draw_string(10, i * 20, entries[i], &Font20, bg, fg);
+        render_draw_string(10, i * 20, entries[i], &Font20, bg, fg);
     }
 
-    const char *msg = (status_state == STATUS_SENDING) ? "Sending..."
-                      : (status_state == STATUS_SENT)  ? "Sent!"
-                                                       : "";
-    display_draw_string(10, DISPLAY_HEIGHT - 20, msg, &Font12, BACKGROUND_COLOR, FONT_COLOR);
+    queue_status();
+    render_present();
+}
+
+// Runs on the upload thread after every delivery attempt, hands the result over to the event
+// loop through upload_event
+static void upload_done(uint32_t seq, bool sent, void *arg) {
+    (void)seq;
+    (void)arg;
+
+    if (!sent) {
+        atomic_fetch_add(&upload_failures, 1);
+    }
+    evloop_notify(upload_event, 1);
 }
 
-static void *send_image_thread(void *varg) {
-    ThreadArg *arg = (ThreadArg *)varg;
-    status_state = STATUS_SENDING;
+static void start_upload(const char *filename) {
+    char path[UPLOAD_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", VIEWER_FOLDER, filename);
+
+    // Pressing the bell again while the picture is still waiting to go out does not spool it twice
+    if (spool_enqueue(path) == 0) {
+        return;
+    }
+    evloop_set_timer(status_timer, 0);
+    set_status(STATUS_SENDING);
+}
 
-    char path[256];
-    snprintf(path, sizeof(path), "%s%s", VIEWER_FOLDER, arg->filename);
-    log_info("Thread started, pushing %s", path);
+// Draws a BMP from the viewer folder. Returns true if it is on screen.
+static bool show_image(const char *filename) {
+    char pth[256];
+    snprintf(pth, sizeof(pth), "%s%s", VIEWER_FOLDER, filename);
 
-    FILE *fp = fopen(path, "rb");
+    FILE *fp = fopen(pth, "rb");
     if (!fp) {
-        log_error("Failed to open %s", path);
-        status_state = STATUS_NONE;
-        free(arg);
-        return NULL;
+        return false;
     }
-
     fseek(fp, 0, SEEK_END);
     size_t fsize = ftell(fp);
     rewind(fp);
 
     uint8_t *buf = malloc(fsize);
     if (!buf) {
-        log_error("Out of memory (%zu bytes)", fsize);
         fclose(fp);
-        status_state = STATUS_NONE;
-        free(arg);
-        return NULL;
+        return false;
     }
-
     fread(buf, 1, fsize, fp);
     fclose(fp);
 
-    const char *hw_id = "7EA58328B";
-    size_t hwlen = strlen(hw_id);
+    bool shown = false;
+    Bitmap bmp;
+    if (create_bmp(&bmp, buf) == 0) {
+        render_draw_image_data(bmp.pxl_data, bmp.img_width, bmp.img_height);
+        // The render thread reads the pixels from buf, so wait for it
+        render_sync();
+        shown = true;
+    }
+    free(buf);
+    return shown;
+}
 
-    Config cfg = {
-        .host = "ecen224.byu.edu",
-        .port = "2240",
-        .hw_id = (const char *)hw_id,
-        .payload_size = hwlen + fsize,
-    };
+static void handle_input(const InputEvent *event) {
+    // Buttons do nothing while an image is up, it goes away on its own
+    if (viewing || num_entries == 0) {
+        return;
+    }
 
-    cfg.payload = malloc(cfg.payload_size);
-    if (!cfg.payload) {
-        log_error("Out of memory (payload)");
-        free(buf);
-        status_state = STATUS_NONE;
-        free(arg);
-        return NULL;
+    // Holding up or down keeps scrolling through the menu
+    bool scroll = event->type == INPUT_PRESS || event->type == INPUT_REPEAT;
+
+    if (scroll && event->button == BUTTON_UP) {
+        sel = (sel - 1 + num_entries) % num_entries;
+        draw_menu(entries, num_entries, sel);
+    } else if (scroll && event->button == BUTTON_DOWN) {
+        sel = (sel + 1) % num_entries;
+        draw_menu(entries, num_entries, sel);
+    } else if (event->type == INPUT_PRESS && event->button == BUTTON_CENTER) {
+        if (strstr(entries[sel], ".bmp") && show_image(entries[sel])) {
+            viewing = true;
+            evloop_set_timer(view_timer, IMAGE_VIEW_MS);
+        }
+        start_upload(entries[sel]);
     }
+}
 
-    memcpy(cfg.payload, hw_id, hwlen);
-    memcpy(cfg.payload + hwlen, buf, fsize);
+static void on_input(int fd, uint64_t count, void *arg) {
+    (void)fd;
+    (void)count;
+    (void)arg;
 
-    int sockfd = client_connect(&cfg);
-    client_send_image(sockfd, &cfg);
-    client_receive_response(sockfd);
-    client_close(sockfd);
+    InputEvent event;
+    while (input_next(&event, 0)) {
+        handle_input(&event);
+    }
+}
 
-    free(cfg.payload);
-    free(buf);
-    free(arg);
+static void on_upload_done(int fd, uint64_t count, void *arg) {
+    (void)fd;
+    (void)arg;
+
+    int failures = atomic_exchange(&upload_failures, 0);
+    uploads_sent += (int)count - failures;
+    if (failures > 0) {
+        // The spool keeps the files and retries with backoff
+        evloop_set_timer(status_timer, 0);
+        set_status(STATUS_QUEUED);
+        return;
+    }
+    if (spool_pending() > 0) {
+        return;
+    }
+
+    if (uploads_sent > 0) {
+        set_status(STATUS_SENT);
+        evloop_set_timer(status_timer, STATUS_SENT_MS);
+    } else {
+        set_status(STATUS_NONE);
+    }
+    uploads_sent = 0;
+}
+
+static void on_status_timeout(int fd, uint64_t count, void *arg) {
+    (void)fd;
+    (void)count;
+    (void)arg;
+    set_status(STATUS_NONE);
+}
+
+static void on_view_timeout(int fd, uint64_t count, void *arg) {
+    (void)fd;
+    (void)count;
+    (void)arg;
+    viewing = false;
+    draw_menu(entries, num_entries, sel);
+}
 
-    status_state = STATUS_SENT;
-    delay_ms(2000);
-    status_state = STATUS_NONE;
+static void on_viewer_changed(int fd, uint64_t count, void *arg) {
+    (void)fd;
+    (void)count;
+    (void)arg;
 
-    return NULL;
+    num_entries = get_entries(VIEWER_FOLDER, entries);
+    if (sel >= num_entries) {
+        sel = num_entries > 0 ? num_entries - 1 : 0;
+    }
+    if (!viewing) {
+        draw_menu(entries, num_entries, sel);
+    }
 }
 
 int main(void) {
     signal(SIGINT, intHandler);
+    // A server closing on an upload mid-file must fail the upload, not kill the doorbell
+    signal(SIGPIPE, SIG_IGN);
     log_info("Starting...");
 
     if (!bcm2835_init()) {
@@ -156,8 +292,41 @@ int main(void) {
     }
 
     display_init();
+    if (render_init(RENDER_MAX_FPS) != 0) {
+        return 1;
+    }
     buttons_init();
 
+    const UploadConfig upload_config = {
+        .host = "ecen224.byu.edu",
+        .port = "2240",
+        .hw_id = "7EA58328B",
+        .max_in_flight = UPLOADS_IN_FLIGHT,
+        .policy = UPLOAD_DROP_NEWEST,
+        .framed = UPLOADS_FRAMED,
+        .reuse_connections = UPLOADS_REUSE,
+    };
+    const SpoolConfig spool_config = {
+        .dir = SPOOL_FOLDER,
+        .max_bytes = SPOOL_MAX_BYTES,
+        .callback = upload_done,
+    };
+    if (input_init() != 0 || evloop_init() != 0 || upload_init(&upload_config) != 0) {
+        return 1;
+    }
+
+    upload_event = evloop_add_event(on_upload_done, NULL);
+    status_timer = evloop_add_timer(on_status_timeout, NULL);
+    view_timer = evloop_add_timer(on_view_timeout, NULL);
+    if (upload_event < 0 || status_timer < 0 || view_timer < 0 ||
+        evloop_add(input_fd(), on_input, NULL) != 0) {
+        return 1;
+    }
+    // Started after upload_event exists, a backlog from the last run starts draining right away
+    if (spool_init(&spool_config) != 0) {
+        return 1;
+    }
+
     DIR *dp = opendir(VIEWER_FOLDER);
     if (dp) {
         struct dirent *e;
@@ -171,62 +340,21 @@ int main(void) {
         closedir(dp);
     }
 
-    char entries[MAX_ENTRIES][MAX_FILE_NAME];
-    int num_entries = get_entries(VIEWER_FOLDER, entries);
-    int sel = 0;
+    // The menu still works without this, it just will not notice new files
+    evloop_add_watch(VIEWER_FOLDER, on_viewer_changed, NULL);
 
+    num_entries = get_entries(VIEWER_FOLDER, entries);
     draw_menu(entries, num_entries, sel);
 
-    while (1) {
-        delay_ms(200);
-
-        if (button_up() == 0) {
-            sel = (sel - 1 + num_entries) % num_entries;
-            draw_menu(entries, num_entries, sel);
-        } else if (button_down() == 0) {
-            sel = (sel + 1) % num_entries;
-            draw_menu(entries, num_entries, sel);
-        } else if (button_center() == 0) {
-            const char *fname = entries[sel];
-            if (strstr(fname, ".bmp")) {
-                char pth[256];
-                snprintf(pth, sizeof(pth), "%s%s", VIEWER_FOLDER, fname);
-
-                FILE *fp = fopen(pth, "rb");
-                if (fp) {
-                    fseek(fp, 0, SEEK_END);
-                    size_t fsize = ftell(fp);
-                    rewind(fp);
-
-                    uint8_t *buf = malloc(fsize);
-                    if (buf) {
-                        fread(buf, 1, fsize, fp);
-                        fclose(fp);
-
-                        Bitmap bmp;
-                        if (create_bmp(&bmp, buf) == 0) {
-                            display_draw_image_data(bmp.pxl_data, bmp.img_width, bmp.img_height);
-                            delay_ms(2000);
-                        }
-                        free(buf);
-                    } else {
-                        fclose(fp);
-                    }
-                }
-            }
-
-            ThreadArg *targ = malloc(sizeof(ThreadArg));
-            if (!targ) {
-                continue;
-            }
-            strncpy(targ->filename, entries[sel], MAX_FILE_NAME - 1);
-            targ->filename[MAX_FILE_NAME - 1] = '\0';
+    evloop_run();
 
-            pthread_t tid;
-            pthread_create(&tid, NULL, send_image_thread, targ);
-            draw_menu(entries, num_entries, sel);
-        }
-    }
+    log_info("Exiting...");
+    spool_exit();
+    upload_exit();
+    evloop_exit();
+    input_exit();
+    render_exit();
+    display_exit();
     return 0;
 }
 // another one
\ No newline at end of file
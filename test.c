@@ -10,6 +10,7 @@
 #include "lib/device.h"
 #include "lib/display.h"
 #include "lib/fonts/fonts.h"
+#include "lib/input.h"
 #include "lib/log.h"
 
 #define VIEWER_FOLDER "viewer/"
@@ -31,10 +32,12 @@ char entries[NUM_ENTRIES][MAX_ENTRY_LENGTH] = {"Clear", "Hello", "Chars", "Stars
 // Makes sure to deinitialize everything before program close
 void intHandler(int dummy) {
     log_info("Exiting...");
+    input_exit();
 
     // Resets the Screen
     display_clear(BLACK);
     display_draw_string(5, 5, "Goodbye!", &Font16, BLACK, WHITE);
+    display_flush();
 
     // Releases control of the display
     display_exit();
@@ -81,7 +84,7 @@ void drawChars() {
 }
 
 void draw_star(int x, int y, uint16_t color) {
-    int points[10][2] = {
+    DisplayPoint points[10] = {
         { x,     y - 5 },   // Top point
         { x + 2, y - 1 },   // Upper-right inner
         { x + 5, y - 1 },   // Right point
@@ -94,13 +97,8 @@ void draw_star(int x, int y, uint16_t color) {
         { x - 2, y - 1 }    // Upper-left inner
     };
 
-    // Draw lines between the 10 points to form the star
-    for (int i = 0; i < 10; i++) {
-        int next = (i + 1) % 10;
-        display_draw_line(points[i][0], points[i][1],
-                          points[next][0], points[next][1],
-                          color, 1);
-    }
+    // Draw the outline through the 10 points to form the star
+    display_draw_polygon(points, 10, color, false, 1);
 }
 
 // drawStars
@@ -158,6 +156,7 @@ void drawMenu(char entries[][MAX_ENTRY_LENGTH], int num_entries, int selected) {
         // Draw the text over it
         display_draw_string(5, i * 20, entries[i], &Font12, bg, fg);
     }
+    display_flush();
 }
 
 
@@ -174,26 +173,30 @@ int main(void) {
 
     display_init();
     buttons_init();
-    
+    if (input_init() != 0) {
+        return 1;
+    }
+
     int selected = 0;
     drawMenu(entries, NUM_ENTRIES, selected);
 
     while (true) {
-        delay_ms(200);
+        InputEvent event;
+        if (!input_next(&event, -1) || event.type != INPUT_PRESS) {
+            continue;
+        }
 
-        if (button_up() == 0) {
+        if (event.button == BUTTON_UP) {
             selected = (selected - 1 + NUM_ENTRIES) % NUM_ENTRIES;
             drawMenu(entries, NUM_ENTRIES, selected);
-            while (button_up() == 0) delay_ms(1);
         }
 
-        if (button_down() == 0) {
+        if (event.button == BUTTON_DOWN) {
             selected = (selected + 1) % NUM_ENTRIES;
             drawMenu(entries, NUM_ENTRIES, selected);
-            while (button_down() == 0) delay_ms(1);
         }
 
-        if (button_right() == 0) {
+        if (event.button == BUTTON_RIGHT) {
             switch (selected) {
                 case 0: clearScreen(); break;
                 case 1: drawHelloWorld(); break;
@@ -201,9 +204,9 @@ int main(void) {
                 case 3: drawStars(); break;
                 case 4: drawFlag(); break;
             }
+            display_flush();
             delay_ms(2000);
             drawMenu(entries, NUM_ENTRIES, selected);
-            while (button_right() == 0) delay_ms(1);
         }
 
     }
@@ -0,0 +1,229 @@
+// Runs lib/camera.c from a camera source and has a number of consumers take every frame the way
+// the doorbell would: wait for it, score its sharpness, turn it into a BMP and then into RGB565
+// for the LCD. Reports how many frames the source delivered, how many the consumers got and how
+// long each step took, so the pipeline can be pushed past the camera's 30 fps on a machine with no
+// camera. With -b it then takes one burst and shows which frame it kept.
+//
+// Usage: ./camera_bench [-s source] [-t seconds] [-c consumers] [-k hold_ms] [-p preroll]
+//                       [-H held] [-b burst]
+//   -s  Camera source, as DOORBELL_CAMERA_SOURCE takes it (default synthetic@0, as fast as
+//       frames can be made). See lib/camera_source.h.
+//   -t  How long to run (default 5)
+//   -c  Consumer threads (default 1)
+//   -k  How long each consumer holds a frame after converting it, like a slow upload (default 0)
+//   -p  Frames kept in the pre-roll ring (default CAMERA_PREROLL_FRAMES)
+//   -H  Frames consumers may hold outside the ring (default CAMERA_HELD_FRAMES)
+//   -b  Frames in a burst (default 0, no burst)
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/camera.h"
+#include "../lib/convert.h"
+#include "../lib/log.h"
+
+typedef struct {
+    pthread_t tid;
+    int frames;
+    int missed; // camera_next_frame came back empty
+    double *waits;
+    double sharpness_us;
+    double to_bmp_us;
+    double to_rgb565_us;
+} consumer;
+
+static volatile int stopping = 0;
+static int hold_ms = 0;
+static int max_frames;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *consume(void *arg) {
+    consumer *c = arg;
+    uint8_t *bmp = malloc(IMG_SIZE);
+    uint16_t *pixels = malloc(CAMERA_WIDTH * CAMERA_HEIGHT * sizeof(uint16_t));
+
+    while (!stopping && c->frames < max_frames) {
+        double started = now_us();
+        CameraFrame *frame = camera_next_frame();
+        double got = now_us();
+        if (frame == NULL) {
+            // The source has ended or stalled, and each try restarts it
+            c->missed++;
+            usleep(100000);
+            continue;
+        }
+        camera_frame_sharpness(frame);
+        double scored = now_us();
+        camera_frame_to_bmp(frame, bmp, IMG_SIZE);
+        double converted = now_us();
+        convert_bgr888_to_rgb565(bmp + IMG_SIZE - CAMERA_WIDTH * CAMERA_HEIGHT * 3, pixels,
+                                 CAMERA_WIDTH * CAMERA_HEIGHT);
+        double drawn = now_us();
+        if (hold_ms > 0) {
+            usleep(hold_ms * 1000);
+        }
+        camera_frame_release(frame);
+
+        c->waits[c->frames++] = (got - started) / 1e3;
+        c->sharpness_us += scored - got;
+        c->to_bmp_us += converted - scored;
+        c->to_rgb565_us += drawn - converted;
+    }
+
+    free(bmp);
+    free(pixels);
+    return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[(int)(p / 100 * (count - 1) + 0.5)];
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-s source] [-t seconds] [-c consumers] [-k hold_ms] [-p preroll] "
+            "[-H held] [-b burst]\n",
+            prog);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    const char *spec = "synthetic@0";
+    double seconds = 5;
+    int consumers = 1;
+    int burst = 0;
+    CameraConfig config = {0};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:c:k:p:H:b:")) != -1) {
+        switch (opt) {
+        case 's':
+            spec = optarg;
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'c':
+            consumers = atoi(optarg);
+            break;
+        case 'k':
+            hold_ms = atoi(optarg);
+            break;
+        case 'p':
+            config.preroll_frames = atoi(optarg);
+            break;
+        case 'H':
+            config.held_frames = atoi(optarg);
+            break;
+        case 'b':
+            burst = atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc || seconds <= 0 || consumers < 1) {
+        return usage(argv[0]);
+    }
+
+    log_set_level(LOG_WARN);
+    config.source = camera_source_parse(spec);
+    if (config.source == NULL || camera_init(&config) != 0) {
+        fprintf(stderr, "Could not start camera source %s\n", spec);
+        return 1;
+    }
+
+    // Room for one frame every 10 us, far past any source
+    max_frames = (int)(seconds * 100000) + 1;
+    consumer *all = calloc(consumers, sizeof(consumer));
+    double start = now_us();
+    for (int i = 0; i < consumers; i++) {
+        all[i].waits = malloc(max_frames * sizeof(double));
+        pthread_create(&all[i].tid, NULL, consume, &all[i]);
+    }
+    usleep((useconds_t)(seconds * 1e6));
+    stopping = 1;
+
+    int frames = 0;
+    int missed = 0;
+    double sharpness_us = 0;
+    double to_bmp_us = 0;
+    double to_rgb565_us = 0;
+    double *waits = malloc((size_t)consumers * max_frames * sizeof(double));
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(all[i].tid, NULL);
+        memcpy(waits + frames, all[i].waits, all[i].frames * sizeof(double));
+        frames += all[i].frames;
+        missed += all[i].missed;
+        sharpness_us += all[i].sharpness_us;
+        to_bmp_us += all[i].to_bmp_us;
+        to_rgb565_us += all[i].to_rgb565_us;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    // What a doorbell press would get right now
+    CameraFrame *ring[256];
+    double snap_start = now_us();
+    int in_ring = camera_snapshot(ring, 256);
+    double snap_us = now_us() - snap_start;
+    for (int i = 0; i < in_ring; i++) {
+        camera_frame_release(ring[i]);
+    }
+
+    CameraStats stats;
+    camera_get_stats(&stats);
+
+    CameraFrame *best = NULL;
+    double best_score = 0;
+    double burst_start = now_us();
+    int kept = burst > 0 ? camera_burst(burst, 1, &best, &best_score) : 0;
+    double burst_ms = (now_us() - burst_start) / 1e3;
+    uint64_t best_seq = kept ? best->seq : 0;
+    camera_frame_release(best);
+
+    camera_exit();
+    camera_source_destroy(config.source);
+    qsort(waits, frames, sizeof(double), compare);
+
+    printf("source %s: %llu frames in %.1f s (%.1f fps), %llu dropped\n", spec,
+           (unsigned long long)stats.frames, elapsed, stats.frames / elapsed,
+           (unsigned long long)stats.dropped);
+    printf("consumers    %d took %d frames (%.1f fps each), %d waits came back empty\n",
+           consumers, frames, frames / elapsed / consumers, missed);
+    printf("wait ms      p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", percentile(waits, frames, 50),
+           percentile(waits, frames, 90), percentile(waits, frames, 99),
+           frames > 0 ? waits[frames - 1] : 0);
+    printf("per frame us sharpness %.1f  to BMP %.1f  to RGB565 (%s) %.1f\n",
+           frames ? sharpness_us / frames : 0, frames ? to_bmp_us / frames : 0,
+           convert_kernel_name(), frames ? to_rgb565_us / frames : 0);
+    printf("snapshot     %d frames in %.1f us\n", in_ring, snap_us);
+    if (burst > 0) {
+        printf("burst        %d frames in %.1f ms, kept seq %llu (sharpness %.1f)\n", burst,
+               burst_ms, (unsigned long long)best_seq, best_score);
+    }
+
+    for (int i = 0; i < consumers; i++) {
+        free(all[i].waits);
+    }
+    free(all);
+    free(waits);
+    return 0;
+}
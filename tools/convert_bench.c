@@ -0,0 +1,155 @@
+// Checks that every RGB565 kernel this machine can run matches the RGB() macro bit for bit, then
+// times each one, and the one convert_bgr888_to_rgb565 picks, against the pixel-at-a-time loop
+// display_draw_image_data used to run.
+//
+// Usage: ./convert_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/colors.h"
+#include "../lib/convert.h"
+
+#define FRAME_WIDTH 128
+#define FRAME_HEIGHT 128
+#define FRAME_PIXELS (FRAME_WIDTH * FRAME_HEIGHT)
+
+// Every 24-bit color, checked this many pixels at a time
+#define CHUNK_PIXELS 4096
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The conversion display_draw_image_data did before the kernel existed
+static void convert_with_macro(const uint8_t *src, uint16_t *dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t blue = src[i * 3];
+        uint8_t green = src[i * 3 + 1];
+        uint8_t red = src[i * 3 + 2];
+        uint16_t pixel = RGB(red, green, blue);
+        dst[i] = (uint16_t)((pixel >> 8) | (pixel << 8));
+    }
+}
+
+typedef void (*convert_fn)(const uint8_t *, uint16_t *, size_t);
+
+static int check_exhaustive(convert_fn convert) {
+    // Extra room so the source and destination can be shifted off alignment
+    uint8_t *src = malloc(CHUNK_PIXELS * 3 + 16);
+    uint16_t *expected = malloc(CHUNK_PIXELS * sizeof(uint16_t));
+    uint16_t *actual = malloc(CHUNK_PIXELS * sizeof(uint16_t) + 16);
+    int failures = 0;
+
+    for (uint32_t base = 0; base < (1 << 24); base += CHUNK_PIXELS) {
+        size_t shift = (base / CHUNK_PIXELS) % 16;
+        uint8_t *chunk = src + shift;
+        uint16_t *out = (uint16_t *)((uint8_t *)actual + (shift & ~1u));
+
+        for (uint32_t i = 0; i < CHUNK_PIXELS; i++) {
+            uint32_t color = base + i;
+            chunk[i * 3] = color & 0xFF;
+            chunk[i * 3 + 1] = (color >> 8) & 0xFF;
+            chunk[i * 3 + 2] = (color >> 16) & 0xFF;
+        }
+
+        convert_with_macro(chunk, expected, CHUNK_PIXELS);
+        convert(chunk, out, CHUNK_PIXELS);
+        if (memcmp(expected, out, CHUNK_PIXELS * sizeof(uint16_t)) != 0) {
+            failures++;
+        }
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+    return failures;
+}
+
+// Short runs exercise the scalar tail behind each vector kernel
+static int check_lengths(convert_fn convert) {
+    uint8_t src[64 * 3];
+    uint16_t expected[64];
+    uint16_t actual[64 + 1];
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)(i * 37 + 11);
+    }
+    for (size_t count = 0; count <= 64; count++) {
+        // The kernel must not write past count pixels
+        actual[count] = 0xA5A5;
+        convert_with_macro(src, expected, count);
+        convert(src, actual, count);
+        if (memcmp(expected, actual, count * sizeof(uint16_t)) != 0 || actual[count] != 0xA5A5) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static double time_frames(convert_fn convert, const uint8_t *src, uint16_t *dst,
+                          int iterations) {
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        convert(src, dst, FRAME_PIXELS);
+    }
+    return (now_ns() - start) / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    if (iterations <= 0) {
+        iterations = 2000;
+    }
+
+    printf("Kernel: %s\n", convert_kernel_name());
+
+    ConvertKernel kernels[CONVERT_MAX_KERNELS];
+    int num_kernels = convert_kernels(kernels);
+    int failed = 0;
+    for (int k = 0; k < num_kernels; k++) {
+        int failures = check_exhaustive(kernels[k].convert) + check_lengths(kernels[k].convert);
+        if (failures) {
+            printf("FAIL: %s: %d mismatched runs\n", kernels[k].name, failures);
+            failed++;
+        } else {
+            printf("%s: all 2^24 colors and lengths 0-64 match RGB()\n", kernels[k].name);
+        }
+    }
+    // What the display calls, in case its dispatch mixes kernels differently
+    if (check_exhaustive(convert_bgr888_to_rgb565) + check_lengths(convert_bgr888_to_rgb565)) {
+        printf("FAIL: convert_bgr888_to_rgb565 does not match RGB()\n");
+        failed++;
+    }
+    if (failed) {
+        return 1;
+    }
+
+    uint8_t *src = malloc(FRAME_PIXELS * 3);
+    uint16_t *dst = malloc(FRAME_PIXELS * sizeof(uint16_t));
+    srand(224);
+    for (int i = 0; i < FRAME_PIXELS * 3; i++) {
+        src[i] = rand() & 0xFF;
+    }
+
+    double macro_ns = time_frames(convert_with_macro, src, dst, iterations);
+
+    printf("%dx%d frame, %d iterations\n", FRAME_WIDTH, FRAME_HEIGHT, iterations);
+    printf("  RGB() loop : %8.1f us/frame\n", macro_ns / 1000);
+    for (int k = 0; k < num_kernels; k++) {
+        double kernel_ns = time_frames(kernels[k].convert, src, dst, iterations);
+        printf("  %-10s : %8.1f us/frame (%.1fx)\n", kernels[k].name, kernel_ns / 1000,
+               macro_ns / kernel_ns);
+    }
+    double dispatch_ns = time_frames(convert_bgr888_to_rgb565, src, dst, iterations);
+    printf("  dispatched : %8.1f us/frame (%.1fx)\n", dispatch_ns / 1000, macro_ns / dispatch_ns);
+
+    free(src);
+    free(dst);
+    return 0;
+}
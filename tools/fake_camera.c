@@ -0,0 +1,123 @@
+// Stands in for libcamera-vid on a machine with no camera. Writes raw YUV420 (I420) frames to
+// stdout at a steady rate, the same way `libcamera-vid --codec yuv420 -o -` does, so lib/camera.c
+// can be run and timed anywhere:
+//
+//   DOORBELL_CAMERA_CMD="tools/fake_camera" ./main_sim
+//
+// Each frame is a color gradient with a bar moving across it and the frame number drawn in the
+// top left corner as binary blocks, so consecutive frames are easy to tell apart.
+//
+// Usage: ./fake_camera [-w width] [-h height] [-f fps] [-n frames] [-s startup_ms]
+//   -w  Frame width, even (default 128)
+//   -h  Frame height, even (default 128)
+//   -f  Frames per second (default 30)
+//   -n  Frames to send before exiting (default 0, forever)
+//   -s  Time before the first frame, like a real camera starting up (default 0)
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int width = 128;
+static int height = 128;
+
+static void fill_frame(uint8_t *frame, long n) {
+    uint8_t *y = frame;
+    uint8_t *u = frame + width * height;
+    uint8_t *v = u + (width / 2) * (height / 2);
+    int bar = n % width;
+
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            int luma = 16 + (col + row) * 219 / (width + height);
+            if (col >= bar && col < bar + 8) {
+                luma = 235;
+            }
+            y[row * width + col] = luma;
+        }
+    }
+    // 16 bits of the frame number, one 4x4 block each, black for 0 and white for 1
+    for (int bit = 0; bit < 16 && (bit + 1) * 4 <= width && height >= 4; bit++) {
+        uint8_t luma = (n >> (15 - bit)) & 1 ? 235 : 16;
+        for (int row = 0; row < 4; row++) {
+            memset(y + row * width + bit * 4, luma, 4);
+        }
+    }
+    for (int row = 0; row < height / 2; row++) {
+        for (int col = 0; col < width / 2; col++) {
+            u[row * (width / 2) + col] = 16 + col * 224 / (width / 2);
+            v[row * (width / 2) + col] = 16 + row * 224 / (height / 2);
+        }
+    }
+}
+
+static void add_ns(struct timespec *ts, long ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-w width] [-h height] [-f fps] [-n frames] [-s startup_ms]\n",
+            prog);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    double fps = 30;
+    long frames = 0;
+    long startup_ms = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h:f:n:s:")) != -1) {
+        switch (opt) {
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'h':
+            height = atoi(optarg);
+            break;
+        case 'f':
+            fps = atof(optarg);
+            break;
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 's':
+            startup_ms = atol(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc || width < 2 || height < 2 || width % 2 || height % 2 || fps <= 0) {
+        return usage(argv[0]);
+    }
+
+    size_t size = (size_t)width * height * 3 / 2;
+    uint8_t *frame = malloc(size);
+    long interval_ns = (long)(1e9 / fps);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    add_ns(&next, startup_ms * 1000000);
+
+    for (long n = 0; frames == 0 || n < frames; n++) {
+        fill_frame(frame, n);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+        if (fwrite(frame, 1, size, stdout) != size || fflush(stdout) != 0) {
+            // Whoever was reading went away
+            break;
+        }
+        add_ns(&next, interval_ns);
+    }
+
+    free(frame);
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Simulates many doorbells uploading to one server at once through lib/client.c, then reports
+// throughput and latency percentiles. Pair it with tools/upload_server to size a backend, or to
+// measure a client-side change without the network.
+//
+// Every doorbell is a thread that uploads the file a number of times, waiting between uploads if
+// asked to. Plain uploads go through client_upload_file, each on a new connection unless -r lets
+// them share lib/client's connection pool: past CLIENT_POOL_SIZE doorbells, uploads then mostly
+// open new connections anyway. With -f every doorbell keeps a ClientStream of its own, with up to
+// CLIENT_STREAM_WINDOW frames in flight.
+// Latency runs from the start of an upload until the server answers it.
+//
+// Usage: ./loadgen [-h host] [-p port] [-n doorbells] [-m uploads] [-t interval_ms] [-f] [-r] [-v]
+//                  file
+//   -h  Server host (default 127.0.0.1)
+//   -p  Server port (default 2240)
+//   -n  Doorbells uploading at once (default 8)
+//   -m  Uploads per doorbell (default 100)
+//   -t  Time from the start of one upload to the start of the next, per doorbell (default 0,
+//       back to back)
+//   -f  Use the framed protocol
+//   -r  Reuse connections between plain uploads
+//   -v  Keep lib/client's log output
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/client.h"
+#include "../lib/log.h"
+
+typedef struct {
+    pthread_t tid;
+    int uploads;
+    int ok;
+    int failed[CLIENT_ERR_PROTOCOL + 1]; // Count per ClientError
+    double *latencies;                   // Of the uploads that went through
+} doorbell;
+
+static Config config = {.host = "127.0.0.1", .port = "2240", .hw_id = "7EA58328B"};
+static const char *path;
+static int uploads_each = 100;
+static double interval_ms = 0;
+static bool framed = false;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void sleep_until(double at) {
+    double wait = at - now_ms();
+    if (wait > 0) {
+        usleep(wait * 1000);
+    }
+}
+
+static void record(doorbell *d, ClientError error, double started) {
+    if (error == CLIENT_OK) {
+        d->latencies[d->ok++] = now_ms() - started;
+    } else {
+        d->failed[error]++;
+    }
+}
+
+static void run_plain(doorbell *d) {
+    double next = now_ms();
+    for (int i = 0; i < uploads_each; i++) {
+        sleep_until(next);
+        double started = now_ms();
+        next = started + interval_ms;
+        record(d, client_upload_file(&config, path, NULL), started);
+    }
+}
+
+static void run_framed(doorbell *d) {
+    ClientStream stream;
+    bool open = false;
+    uint32_t seqs[CLIENT_STREAM_WINDOW];
+    double started[CLIENT_STREAM_WINDOW];
+    int pushed = 0;
+    int done = 0;
+    double next = now_ms();
+
+    while (done < uploads_each) {
+        if (open && stream.phase == CLIENT_DONE && client_stream_outstanding(&stream) == 0) {
+            client_stream_close(&stream);
+            open = false;
+        }
+        while (pushed < uploads_each && now_ms() >= next &&
+               (!open || client_stream_space(&stream) > 0)) {
+            if (!open) {
+                open = client_stream_open(&stream, &config, NULL) == 0;
+                if (!open) {
+                    d->failed[stream.error]++;
+                    client_stream_close(&stream);
+                    pushed++;
+                    done++;
+                    next = now_ms() + interval_ms;
+                    continue;
+                }
+            }
+            uint32_t seq = client_stream_push(&stream, path);
+            if (seq == 0) {
+                d->failed[CLIENT_ERR_FILE]++;
+                done++;
+            } else {
+                seqs[seq % CLIENT_STREAM_WINDOW] = seq;
+                started[seq % CLIENT_STREAM_WINDOW] = now_ms();
+            }
+            pushed++;
+            next = now_ms() + interval_ms;
+        }
+        if (!open) {
+            if (pushed < uploads_each) {
+                sleep_until(next);
+            }
+            continue;
+        }
+
+        struct pollfd fds[CLIENT_MAX_ATTEMPTS];
+        int nfds = client_stream_pollfds(&stream, fds);
+        int timeout = client_stream_timeout(&stream);
+        if (pushed < uploads_each) {
+            int until_next = next > now_ms() ? (int)(next - now_ms()) + 1 : 0;
+            timeout = (timeout < 0 || until_next < timeout) ? until_next : timeout;
+        }
+        if (poll(fds, nfds, timeout) <= 0) {
+            nfds = 0;
+        }
+
+        ClientAck acks[CLIENT_STREAM_WINDOW];
+        int num_acks = client_stream_step(&stream, fds, nfds, acks);
+        for (int i = 0; i < num_acks; i++) {
+            // Seqs count up by one per push and at most a window of them is out, so the slot is
+            // still the frame's own
+            int slot = acks[i].seq % CLIENT_STREAM_WINDOW;
+            if (seqs[slot] == acks[i].seq) {
+                record(d, acks[i].error, started[slot]);
+            }
+            done++;
+        }
+    }
+    if (open) {
+        client_stream_close(&stream);
+    }
+}
+
+static void *run(void *arg) {
+    doorbell *d = arg;
+    if (framed) {
+        run_framed(d);
+    } else {
+        run_plain(d);
+    }
+    return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    int index = (int)(p / 100 * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-n doorbells] [-m uploads] [-t interval_ms] [-f] [-r] "
+            "[-v] file\n",
+            prog);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    int doorbells = 8;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:m:t:frv")) != -1) {
+        switch (opt) {
+        case 'h':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = optarg;
+            break;
+        case 'n':
+            doorbells = atoi(optarg);
+            break;
+        case 'm':
+            uploads_each = atoi(optarg);
+            break;
+        case 't':
+            interval_ms = atof(optarg);
+            break;
+        case 'f':
+            framed = true;
+            break;
+        case 'r':
+            config.reuse_connection = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || doorbells < 1 || uploads_each < 1) {
+        return usage(argv[0]);
+    }
+    path = argv[optind];
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return 1;
+    }
+    if (!verbose) {
+        log_set_level(LOG_WARN);
+    }
+    // See ClientUpload in lib/client.h
+    signal(SIGPIPE, SIG_IGN);
+
+    doorbell *all = calloc(doorbells, sizeof(doorbell));
+    double start = now_ms();
+    for (int i = 0; i < doorbells; i++) {
+        all[i].latencies = malloc(uploads_each * sizeof(double));
+        if (pthread_create(&all[i].tid, NULL, run, &all[i]) != 0) {
+            fprintf(stderr, "Could only start %d doorbells\n", i);
+            doorbells = i;
+            break;
+        }
+    }
+
+    int ok = 0;
+    int failed[CLIENT_ERR_PROTOCOL + 1] = {0};
+    double *latencies = malloc((size_t)doorbells * uploads_each * sizeof(double));
+    for (int i = 0; i < doorbells; i++) {
+        pthread_join(all[i].tid, NULL);
+        memcpy(latencies + ok, all[i].latencies, all[i].ok * sizeof(double));
+        ok += all[i].ok;
+        for (int e = 0; e <= CLIENT_ERR_PROTOCOL; e++) {
+            failed[e] += all[i].failed[e];
+        }
+    }
+    double elapsed = now_ms() - start;
+    int total = doorbells * uploads_each;
+    qsort(latencies, ok, sizeof(double), compare);
+
+    printf("%d doorbells, %d %s uploads of %lld bytes: %d ok, %d failed in %.1f ms\n", doorbells,
+           total, framed ? "framed" : "plain", (long long)st.st_size, ok, total - ok, elapsed);
+    printf("throughput   %.1f uploads/s, %.2f MB/s\n", ok * 1000 / elapsed,
+           ok * (double)st.st_size / 1e3 / elapsed);
+    printf("latency ms   p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+           percentile(latencies, ok, 50), percentile(latencies, ok, 90),
+           percentile(latencies, ok, 99), ok > 0 ? latencies[ok - 1] : 0);
+    for (int e = 0; e <= CLIENT_ERR_PROTOCOL; e++) {
+        if (failed[e] > 0) {
+            printf("failed       %d: %s\n", failed[e], client_strerror(e));
+        }
+    }
+
+    for (int i = 0; i < doorbells; i++) {
+        free(all[i].latencies);
+    }
+    free(all);
+    free(latencies);
+    return ok == total ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+// Replays an SPI trace recorded with DOORBELL_SPI_TRACE through the ST7735 emulator and prints
+// what each frame cost on the wire. Frame 0 includes the panel init sequence.
+//
+// Usage: ./st7735_trace [-d divider] [-b prefix] trace.bin
+//   -d  SPI clock divider used for the wire time estimate (default 8, what device.c sets)
+//   -b  Save what the panel shows after every frame as <prefix><frame>.bmp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../lib/st7735_emu.h"
+
+// Largest record the trace reader accepts. lcd.c sends at most one full screen per transfer.
+#define RECORD_MAX (256 * 1024)
+
+static void print_stats(const char *label, const st7735_stats *stats, uint32_t divider) {
+    printf("%-6s %8u %8u %10u %8u %12.1f\n", label, stats->commands, stats->windows,
+           stats->data_bytes, stats->pixels, st7735_wire_time_us(stats, divider));
+}
+
+static void end_frame(st7735_emu *emu, uint32_t divider, const char *bmp_prefix) {
+    st7735_stats stats;
+    char label[16];
+    uint32_t frame = emu->frames;
+
+    st7735_emu_end_frame(emu, &stats);
+    snprintf(label, sizeof(label), "%u", frame);
+    print_stats(label, &stats, divider);
+
+    if (stats.stray_bytes > 0) {
+        printf("       warning: %u data bytes sent after a command that takes none\n",
+               stats.stray_bytes);
+    }
+    if (bmp_prefix) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s%u.bmp", bmp_prefix, frame);
+        if (st7735_emu_write_bmp(emu, path) != 0) {
+            fprintf(stderr, "Failed to write %s\n", path);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t divider = 8;
+    const char *bmp_prefix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:b:")) != -1) {
+        switch (opt) {
+        case 'd':
+            divider = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bmp_prefix = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d divider] [-b prefix] trace.bin\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc || divider == 0) {
+        fprintf(stderr, "Usage: %s [-d divider] [-b prefix] trace.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *fp = fopen(argv[optind], "rb");
+    if (!fp) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    static st7735_emu emu;
+    uint8_t *buf = malloc(RECORD_MAX);
+    uint8_t type;
+    uint32_t len;
+    int status;
+
+    st7735_emu_init(&emu);
+    printf("%-6s %8s %8s %10s %8s %12s\n", "frame", "commands", "windows", "data", "pixels",
+           "wire us");
+
+    while ((status = st7735_trace_read(fp, &type, buf, &len, RECORD_MAX)) == 1) {
+        switch (type) {
+        case ST7735_TRACE_COMMAND:
+            st7735_emu_write(&emu, false, buf, len);
+            break;
+        case ST7735_TRACE_DATA:
+            st7735_emu_write(&emu, true, buf, len);
+            break;
+        case ST7735_TRACE_FRAME:
+            end_frame(&emu, divider, bmp_prefix);
+            break;
+        default:
+            fprintf(stderr, "Unknown record type 0x%02x\n", type);
+            status = -1;
+            break;
+        }
+        if (status == -1) {
+            break;
+        }
+    }
+
+    // Whatever was sent after the last flush, such as a final LCD_SetArealColor
+    if (emu.frame.commands > 0 || emu.frame.data_bytes > 0) {
+        end_frame(&emu, divider, bmp_prefix);
+    }
+
+    printf("\n");
+    print_stats("total", &emu.total, divider);
+    if (emu.frames > 0) {
+        st7735_stats average = {
+            .commands = emu.total.commands / emu.frames,
+            .windows = emu.total.windows / emu.frames,
+            .data_bytes = emu.total.data_bytes / emu.frames,
+            .pixels = emu.total.pixels / emu.frames,
+        };
+        print_stats("mean", &average, divider);
+    }
+
+    free(buf);
+    fclose(fp);
+    if (status == -1) {
+        fprintf(stderr, "%s is truncated or malformed\n", argv[optind]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,677 @@
+// Local stand-in for the upload server, for trying out and measuring lib/client.c and lib/upload.c
+// without the real one. Point the doorbell at it by resolving ecen224.byu.edu to this machine.
+//
+// Each message is a hw_id followed by a file. A BMP ends where the size in its header says, so
+// several can share one connection. Anything else ends when the connection goes quiet for
+// IDLE_END_MS. Every message is answered, and every connection prints a summary when it closes.
+//
+// It is also the reference server for the framed protocol in lib/frame.h. A message starting with
+// FRAME_MAGIC is read as a frame: its checksum is checked and it is acked by seq as soon as it is
+// in, while the client keeps sending the ones behind it. Both kinds can share a connection.
+//
+// Every connection is served from one epoll loop, so thousands of simulated doorbells (see
+// tools/loadgen) cost no threads. The options below make it behave like a slow, far away or
+// unreliable server. Ctrl-C prints totals.
+//
+// Usage: ./upload_server [-p port] [-i hw_id_length] [-c] [-l latency_ms] [-j jitter_ms]
+//                        [-b bytes_per_s] [-d drop_percent] [-r response] [-q]
+//   -p  Port to listen on (default 2240)
+//   -i  Length of the hw_id in front of every file (default 9)
+//   -c  Close the connection after every response, like a server without keep-alive
+//   -l  Hold every response this long after its message is in (default 0)
+//   -j  Add up to this much more, at random, to every response delay (default 0)
+//   -b  Read each connection no faster than this (default no limit). The kernel still buffers
+//       what the client sends, so its sends can finish early, but responses wait for the reads.
+//   -d  Close the connection instead of answering this percent of messages (default 0)
+//   -r  Response to plain messages, {bytes} becomes the size (default "Received {bytes} bytes")
+//   -q  Only print connection summaries and the totals, not every message
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/frame.h"
+
+// How long a message that is not a BMP can go quiet before it counts as finished
+#define IDLE_END_MS 200
+
+// Bytes of a BMP needed to read its file size
+#define BMP_SIZE_END 6
+
+// Most connections open at once. More are accepted and closed straight away.
+#define MAX_CONNS 4096
+
+// Most responses a connection can have waiting out their delay. Reading stops while it is full.
+#define MAX_PENDING 32
+
+// Longest response, the text from -r is cut off to fit
+#define MAX_REPLY 128
+
+// Most bytes read per recv
+#define READ_CHUNK 65536
+
+// How much a connection under -b may read in one go after a quiet spell, in milliseconds of its
+// rate
+#define BURST_MS 50
+
+typedef enum {
+    READ_START,       // Waiting for the first four bytes of a message
+    READ_LEGACY_HEAD, // The rest of the hw_id and the start of the file
+    READ_FRAME_HEAD,  // The rest of a frame header
+    READ_BODY,        // A payload of known length
+    READ_UNTIL_IDLE,  // A plain message that is not a BMP, ended by IDLE_END_MS of quiet
+} ReadState;
+
+typedef struct {
+    double due_ms;
+    size_t len;
+    uint8_t data[MAX_REPLY];
+} reply;
+
+typedef struct {
+    int fd; // -1 if the slot is free
+    int id;
+    ReadState state;
+    uint8_t *head; // Start of the message, head_size bytes
+    size_t head_need;
+    size_t head_got;
+    bool framed;
+    FrameHeader frame;
+    uint32_t crc;
+    size_t body_left;
+    size_t msg_size;
+    double msg_start;
+    double last_read_ms;
+    reply pending[MAX_PENDING]; // Responses waiting out -l and -j, oldest first
+    int pending_head;
+    int num_pending;
+    uint8_t out[MAX_REPLY]; // The response being written
+    size_t out_len;
+    size_t out_sent;
+    double credit; // Bytes -b lets it read right now
+    double credit_at;
+    bool peer_closed;
+    bool closing;    // Close once the pending responses are out
+    uint32_t events; // What epoll is watching for
+    double due_ms;   // When its next timer runs out, -1 if none is running
+    int timer_index; // Position in timers, -1 if not there
+    int messages;
+    size_t total;
+    double opened;
+} conn;
+
+static int hw_id_len = 9;
+static bool close_each = false;
+static double latency_ms = 0;
+static double jitter_ms = 0;
+static double bandwidth = 0; // Bytes per second, 0 for no limit
+static double drop_percent = 0;
+static const char *response = "Received {bytes} bytes";
+static bool quiet = false;
+
+static conn conns[MAX_CONNS];
+static int free_conns[MAX_CONNS]; // Indexes of the free slots in conns
+static int num_free = 0;
+// Min-heap by due_ms of the connections with a timer running, so a wakeup only looks at the
+// connections that are ready or due rather than every one that is open
+static conn *timers[MAX_CONNS];
+static int num_timers = 0;
+static size_t head_size;
+static int epoll_fd;
+static int next_conn = 1;
+static volatile sig_atomic_t stop = 0;
+
+static struct {
+    int connections;
+    long messages;
+    long frames;
+    long bad_crc;
+    long dropped;
+    size_t bytes;
+} totals;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double now_epoch_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static const char *content_name(uint16_t type) {
+    switch (type) {
+    case FRAME_CONTENT_BMP:
+        return "bmp";
+    case FRAME_CONTENT_TEXT:
+        return "text";
+    default:
+        return "binary";
+    }
+}
+
+// Writes the -r text with {bytes} filled in. Returns its length.
+static size_t format_response(uint8_t *out, size_t bytes) {
+    char *text = (char *)out;
+    size_t len = 0;
+    for (const char *p = response; *p && len < MAX_REPLY - 1; p++) {
+        if (strncmp(p, "{bytes}", 7) == 0) {
+            int n = snprintf(text + len, MAX_REPLY - len, "%zu", bytes);
+            len = len + n < MAX_REPLY - 1 ? len + n : MAX_REPLY - 1;
+            p += 6;
+        } else {
+            text[len++] = *p;
+        }
+    }
+    return len;
+}
+
+static void timer_swap(int a, int b) {
+    conn *c = timers[a];
+    timers[a] = timers[b];
+    timers[b] = c;
+    timers[a]->timer_index = a;
+    timers[b]->timer_index = b;
+}
+
+// Moves the timer at i up or down until the heap is in order again
+static void timer_fix(int i) {
+    while (i > 0 && timers[i]->due_ms < timers[(i - 1) / 2]->due_ms) {
+        timer_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int least = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < num_timers; child++) {
+            if (timers[child]->due_ms < timers[least]->due_ms) {
+                least = child;
+            }
+        }
+        if (least == i) {
+            return;
+        }
+        timer_swap(i, least);
+        i = least;
+    }
+}
+
+// Runs the connection's timer out at due_ms, or stops it if due_ms is negative
+static void timer_set(conn *c, double due_ms) {
+    c->due_ms = due_ms;
+    int i = c->timer_index;
+    if (due_ms < 0) {
+        if (i >= 0) {
+            c->timer_index = -1;
+            if (i != --num_timers) {
+                timers[i] = timers[num_timers];
+                timers[i]->timer_index = i;
+                timer_fix(i);
+            }
+        }
+        return;
+    }
+    if (i < 0) {
+        i = num_timers++;
+        timers[i] = c;
+        c->timer_index = i;
+    }
+    timer_fix(i);
+}
+
+static void close_conn(conn *c) {
+    printf("conn %d closed: %d messages, %zu bytes, open %.1f ms\n", c->id, c->messages, c->total,
+           now_ms() - c->opened);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->head);
+    c->fd = -1;
+    timer_set(c, -1);
+    free_conns[num_free++] = (int)(c - conns);
+}
+
+static void start_message(conn *c) {
+    c->state = READ_START;
+    c->head_need = 4;
+    c->head_got = 0;
+    c->msg_size = 0;
+}
+
+static void queue_reply(conn *c, const uint8_t *data, size_t len) {
+    reply *r = &c->pending[(c->pending_head + c->num_pending) % MAX_PENDING];
+    r->due_ms = now_ms() + latency_ms + (jitter_ms > 0 ? jitter_ms * rand() / RAND_MAX : 0);
+    r->len = len;
+    memcpy(r->data, data, len);
+    c->num_pending++;
+}
+
+static void finish_message(conn *c) {
+    c->messages++;
+    c->total += c->msg_size;
+    totals.messages++;
+    totals.bytes += c->msg_size;
+
+    if (drop_percent > 0 && 100.0 * rand() / RAND_MAX < drop_percent) {
+        if (!quiet) {
+            printf("conn %d msg %d: dropped\n", c->id, c->messages);
+        }
+        totals.dropped++;
+        c->peer_closed = true;
+        c->num_pending = 0;
+        return;
+    }
+
+    uint8_t data[MAX_REPLY];
+    size_t len;
+    if (c->framed) {
+        bool crc_ok = c->crc == c->frame.crc32;
+        totals.frames++;
+        totals.bad_crc += !crc_ok;
+        FrameAck ack = {
+            .seq = c->frame.seq,
+            .status = crc_ok ? FRAME_STATUS_OK : FRAME_STATUS_BAD_CRC,
+        };
+        frame_encode_ack(&ack, data);
+        len = FRAME_ACK_SIZE;
+        if (!quiet) {
+            printf("conn %d msg %d: frame %u %s %s %u bytes, crc %s, made %.0f ms ago, "
+                   "in %.1f ms\n",
+                   c->id, c->messages, c->frame.seq, c->frame.hw_id,
+                   content_name(c->frame.content_type), c->frame.length, crc_ok ? "ok" : "BAD",
+                   now_epoch_ms() - (double)c->frame.timestamp_ms, now_ms() - c->msg_start);
+        }
+    } else {
+        size_t file_size = c->msg_size - hw_id_len;
+        len = format_response(data, file_size);
+        if (!quiet) {
+            printf("conn %d msg %d: %.*s %zu bytes in %.1f ms\n", c->id, c->messages, hw_id_len,
+                   c->head, file_size, now_ms() - c->msg_start);
+        }
+    }
+    queue_reply(c, data, len);
+    if (close_each) {
+        c->closing = true;
+    }
+    start_message(c);
+}
+
+// The message header is in. Works out how the rest of the message is read.
+static void parse_head(conn *c) {
+    if (c->state == READ_START) {
+        c->msg_start = now_ms();
+        c->framed = frame_is_magic(c->head);
+        c->state = c->framed ? READ_FRAME_HEAD : READ_LEGACY_HEAD;
+        c->head_need = c->framed ? FRAME_HEADER_SIZE : (size_t)hw_id_len + BMP_SIZE_END;
+        return;
+    }
+
+    if (c->state == READ_FRAME_HEAD) {
+        frame_decode_header(c->head, &c->frame);
+        if (c->frame.length > FRAME_MAX_LENGTH) {
+            // The payload is not read, so the connection cannot carry on past it
+            FrameAck ack = {.seq = c->frame.seq, .status = FRAME_STATUS_TOO_LARGE};
+            uint8_t data[FRAME_ACK_SIZE];
+            frame_encode_ack(&ack, data);
+            queue_reply(c, data, sizeof(data));
+            c->closing = true;
+            return;
+        }
+        c->crc = 0;
+        c->body_left = c->frame.length;
+    } else {
+        const uint8_t *file = c->head + hw_id_len;
+        if (file[0] != 'B' || file[1] != 'M') {
+            c->state = READ_UNTIL_IDLE;
+            return;
+        }
+        uint32_t bmp_size = file[2] | file[3] << 8 | file[4] << 16 | (uint32_t)file[5] << 24;
+        c->body_left = bmp_size > BMP_SIZE_END ? bmp_size - BMP_SIZE_END : 0;
+    }
+    c->state = READ_BODY;
+    if (c->body_left == 0) {
+        finish_message(c);
+    }
+}
+
+// Runs bytes from the connection through the message parser
+static void consume(conn *c, const uint8_t *data, size_t len) {
+    while (len > 0 && !c->closing && !c->peer_closed) {
+        size_t n;
+        if (c->state == READ_UNTIL_IDLE) {
+            n = len;
+        } else if (c->state == READ_BODY) {
+            n = len < c->body_left ? len : c->body_left;
+            if (c->framed) {
+                c->crc = frame_crc32(c->crc, data, n);
+            }
+            c->body_left -= n;
+        } else {
+            n = c->head_need - c->head_got;
+            n = len < n ? len : n;
+            memcpy(c->head + c->head_got, data, n);
+            c->head_got += n;
+        }
+        c->msg_size += n;
+        data += n;
+        len -= n;
+
+        if (c->state == READ_BODY && c->body_left == 0) {
+            finish_message(c);
+        } else if (c->state != READ_BODY && c->state != READ_UNTIL_IDLE &&
+                   c->head_got == c->head_need) {
+            parse_head(c);
+        }
+    }
+}
+
+// Bytes the connection may read now, topped up at the -b rate
+static size_t read_allowance(conn *c, double now) {
+    if (bandwidth <= 0) {
+        return READ_CHUNK;
+    }
+    double burst = bandwidth * BURST_MS / 1000;
+    c->credit += (now - c->credit_at) * bandwidth / 1000;
+    c->credit = c->credit < burst ? c->credit : burst;
+    c->credit_at = now;
+    if (c->credit < 1) {
+        return 0;
+    }
+    return c->credit < READ_CHUNK ? (size_t)c->credit : READ_CHUNK;
+}
+
+static bool wants_read(const conn *c) {
+    return !c->peer_closed && !c->closing && c->num_pending < MAX_PENDING;
+}
+
+static void on_readable(conn *c, double now) {
+    static uint8_t buf[READ_CHUNK];
+
+    while (wants_read(c)) {
+        size_t allowed = read_allowance(c, now);
+        if (allowed == 0) {
+            return;
+        }
+        ssize_t n = recv(c->fd, buf, allowed, 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                c->peer_closed = true;
+                c->num_pending = 0;
+            }
+            return;
+        }
+        if (n == 0) {
+            // A plain message that is not a BMP also ends when the client closes
+            if (c->state == READ_UNTIL_IDLE) {
+                finish_message(c);
+            }
+            c->peer_closed = true;
+            return;
+        }
+        if (bandwidth > 0) {
+            c->credit -= n;
+        }
+        c->last_read_ms = now;
+        consume(c, buf, n);
+    }
+}
+
+// Moves due responses into the output buffer and writes as much as the socket takes
+static void flush(conn *c, double now) {
+    for (;;) {
+        while (c->out_sent < c->out_len) {
+            ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    c->peer_closed = true;
+                    c->num_pending = 0;
+                    c->out_len = 0;
+                }
+                return;
+            }
+            c->out_sent += n;
+        }
+        if (c->num_pending == 0 || c->pending[c->pending_head].due_ms > now) {
+            return;
+        }
+        const reply *r = &c->pending[c->pending_head];
+        memcpy(c->out, r->data, r->len);
+        c->out_len = r->len;
+        c->out_sent = 0;
+        c->pending_head = (c->pending_head + 1) % MAX_PENDING;
+        c->num_pending--;
+    }
+}
+
+// When the next timer of a connection is due, or -1 if none is running
+static double next_due(const conn *c) {
+    double due = -1;
+    double t[3] = {-1, -1, -1};
+    if (c->num_pending > 0 && c->out_sent >= c->out_len) {
+        t[0] = c->pending[c->pending_head].due_ms;
+    }
+    if (c->state == READ_UNTIL_IDLE) {
+        t[1] = c->last_read_ms + IDLE_END_MS;
+    }
+    if (bandwidth > 0 && wants_read(c) && c->credit < 1) {
+        t[2] = c->credit_at + (1 - c->credit) * 1000 / bandwidth;
+    }
+    for (int k = 0; k < 3; k++) {
+        if (t[k] >= 0 && (due < 0 || t[k] < due)) {
+            due = t[k];
+        }
+    }
+    return due;
+}
+
+// Runs the timers of a connection, closes it once it is finished and otherwise points epoll at
+// what it is waiting for and sets its next timer
+static void service(conn *c, double now) {
+    if (c->state == READ_UNTIL_IDLE && now - c->last_read_ms >= IDLE_END_MS) {
+        finish_message(c);
+    }
+    flush(c, now);
+    bool output = c->out_sent < c->out_len || c->num_pending > 0;
+    if ((c->peer_closed || c->closing) && !output) {
+        close_conn(c);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (wants_read(c) && (bandwidth <= 0 || read_allowance(c, now) > 0)) {
+        events |= EPOLLIN;
+    }
+    if (c->out_sent < c->out_len) {
+        events |= EPOLLOUT;
+    }
+    if (events != c->events) {
+        struct epoll_event ev = {.events = events, .data.ptr = c};
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+    timer_set(c, next_due(c));
+}
+
+// Milliseconds until the next timer of any connection is due, or -1 if none is running
+static int next_timeout(double now) {
+    if (num_timers == 0) {
+        return -1;
+    }
+    double due = timers[0]->due_ms;
+    // Rounded up, so the timer has passed by the time epoll_wait returns
+    return due > now ? (int)(due - now) + 1 : 0;
+}
+
+static void accept_all(int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        if (num_free == 0) {
+            fprintf(stderr, "Too many connections, closing a new one\n");
+            close(fd);
+            continue;
+        }
+
+        int on = 1;
+        // Acks are small writes that must not wait behind Nagle for the previous one's ACK
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        conn *c = &conns[free_conns[--num_free]];
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->due_ms = -1;
+        c->timer_index = -1;
+        c->id = next_conn++;
+        c->head = malloc(head_size);
+        c->opened = now_ms();
+        c->credit_at = c->opened;
+        c->credit = bandwidth * BURST_MS / 1000;
+        c->events = EPOLLIN;
+        start_message(c);
+        totals.connections++;
+
+        struct epoll_event ev = {.events = c->events, .data.ptr = c};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int port = 2240;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:i:cl:j:b:d:r:q")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'i':
+            hw_id_len = atoi(optarg);
+            break;
+        case 'c':
+            close_each = true;
+            break;
+        case 'l':
+            latency_ms = atof(optarg);
+            break;
+        case 'j':
+            jitter_ms = atof(optarg);
+            break;
+        case 'b':
+            bandwidth = atof(optarg);
+            break;
+        case 'd':
+            drop_percent = atof(optarg);
+            break;
+        case 'r':
+            response = optarg;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-p port] [-i hw_id_length] [-c] [-l latency_ms] [-j jitter_ms]\n"
+                    "       [-b bytes_per_s] [-d drop_percent] [-r response] [-q]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (hw_id_len < 0) {
+        hw_id_len = 0;
+    }
+    head_size = (size_t)hw_id_len + BMP_SIZE_END;
+    head_size = head_size > FRAME_HEADER_SIZE ? head_size : FRAME_HEADER_SIZE;
+    srand(time(NULL));
+    // Handed out lowest first
+    for (int i = 0; i < MAX_CONNS; i++) {
+        conns[i].fd = -1;
+        conns[i].timer_index = -1;
+        free_conns[num_free++] = MAX_CONNS - 1 - i;
+    }
+
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1;
+    int off = 0;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // Takes IPv4 connections too
+    setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr = {.sin6_family = AF_INET6, .sin6_port = htons(port)};
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 512) != 0) {
+        perror("listen");
+        return 1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_ev);
+    printf("Listening on port %d\n", port);
+    fflush(stdout);
+
+    struct epoll_event events[64];
+    conn *due[MAX_CONNS];
+    while (!stop) {
+        int n = epoll_wait(epoll_fd, events, 64, next_timeout(now_ms()));
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        double now = now_ms();
+        for (int i = 0; i < n; i++) {
+            conn *c = events[i].data.ptr;
+            if (!c) {
+                accept_all(listen_fd);
+                continue;
+            }
+            if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                on_readable(c, now);
+            }
+            if (c->fd >= 0) {
+                service(c, now);
+            }
+        }
+        // Taken off the heap first, since servicing a connection can set its timer again
+        int num_due = 0;
+        while (num_timers > 0 && timers[0]->due_ms <= now) {
+            due[num_due++] = timers[0];
+            timer_set(timers[0], -1);
+        }
+        for (int i = 0; i < num_due; i++) {
+            if (due[i]->fd >= 0) {
+                service(due[i], now);
+            }
+        }
+        fflush(stdout);
+    }
+
+    printf("\n%d connections, %ld messages (%ld framed, %ld bad crc), %ld dropped, %zu bytes\n",
+           totals.connections, totals.messages, totals.frames, totals.bad_crc, totals.dropped,
+           totals.bytes);
+    return 0;
+}